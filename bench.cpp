@@ -0,0 +1,413 @@
+// Benchmark suite for the physics and grid hot paths: force solvers, the
+// integration step, the space-time grid and the lighting model, each at
+// several body counts. Results go out as JSON so runs can be diffed across
+// builds and machines.
+//
+// interactions_per_second counts body pairs for the direct sums (Barnes-Hut
+// reports the direct-sum equivalent, so the two compare as speedups),
+// lattice point x source pairs for the grid and body x light-blocker pairs
+// for lighting.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "bodies.h"
+#include "collisions.h"
+#include "curvature_field.h"
+#include "ensemble.h"
+#include "integrators.h"
+#include "lighting.h"
+#include "physics.h"
+#include "scenario.h"
+#include "thread_pool.h"
+#include "units.h"
+
+struct BenchResult
+{
+    std::string name;
+    size_t bodies;
+    unsigned reps;
+    double secondsPerRep;
+    double interactionsPerRep;
+    size_t stateBytes;
+    long long peakRssBytes;
+};
+
+static long long peakRssBytes()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return (long long)usage.ru_maxrss; // bytes on macOS
+#else
+    return (long long)usage.ru_maxrss * 1024; // kilobytes on Linux
+#endif
+}
+
+static size_t bodyStoreBytes(const BodyStore &bodies)
+{
+    return bodies.Size() * (6 * sizeof(float) + 2 * sizeof(double) + sizeof(bodies.hue[0]) + sizeof(bodies.type[0]));
+}
+
+// A star with count - 1 bodies on circular orbits in a thin disk, their
+// masses drawn between minFraction and maxFraction of the star's
+static void makeDisk(size_t count, double minFraction, double maxFraction, BodyStore &bodies)
+{
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    const double starMass = 2e30;
+
+    bodies.Clear();
+    bodies.Reserve(count);
+    bodies.Add(0, 0, 0, 0, 0, 0, starMass, {{1.0f, 0.9f, 0.2f, 1.0f}}, STAR);
+    for (size_t i = 1; i < count; ++i)
+    {
+        double r = 50.0 + 490.0 * unit(rng);
+        double angle = 2.0 * M_PI * unit(rng);
+        double speed = sqrt(FORCE_SCALE * starMass / r);
+        bodies.Add((float)(r * cos(angle)), (float)(r * sin(angle)), (float)(10.0 * (unit(rng) - 0.5)),
+                   (float)(-speed * sin(angle)), (float)(speed * cos(angle)), 0.0f,
+                   starMass * (minFraction + (maxFraction - minFraction) * unit(rng)), {{0.3f, 0.5f, 1.0f, 1.0f}});
+    }
+}
+
+// Times fn, which returns the interactions it performed, until minTime has
+// passed. The first call doubles as a warm-up unless it alone used up the time.
+template <typename Fn>
+static BenchResult measure(const std::string &name, size_t bodies, size_t stateBytes, double minTime, Fn fn)
+{
+    typedef std::chrono::steady_clock Clock;
+    BenchResult result;
+    result.name = name;
+    result.bodies = bodies;
+    result.stateBytes = stateBytes;
+
+    Clock::time_point start = Clock::now();
+    double interactions = fn();
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    unsigned reps = 1;
+    if (elapsed < minTime)
+    {
+        reps = 0;
+        interactions = 0.0;
+        start = Clock::now();
+        do
+        {
+            interactions += fn();
+            ++reps;
+            elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        } while (elapsed < minTime);
+    }
+
+    result.reps = reps;
+    result.secondsPerRep = elapsed / reps;
+    result.interactionsPerRep = interactions / reps;
+    result.peakRssBytes = peakRssBytes();
+    fprintf(stderr, "%-24s n=%-8zu %10.3f ms/rep  %8.2f ns/body\n", name.c_str(), bodies,
+            result.secondsPerRep * 1e3, result.secondsPerRep * 1e9 / (double)bodies);
+    return result;
+}
+
+static void writeJson(FILE *out, const std::vector<BenchResult> &results, unsigned threads, const char *isa)
+{
+    fprintf(out, "{\n");
+    fprintf(out, "  \"threads\": %u,\n", threads);
+    fprintf(out, "  \"simd_isa\": \"%s\",\n", isa);
+#ifdef __VERSION__
+    fprintf(out, "  \"compiler\": \"%s\",\n", __VERSION__);
+#endif
+    fprintf(out, "  \"results\": [\n");
+    for (size_t r = 0; r < results.size(); ++r)
+    {
+        const BenchResult &b = results[r];
+        fprintf(out,
+                "    {\"name\": \"%s\", \"n\": %zu, \"reps\": %u, \"seconds_per_rep\": %.9g, "
+                "\"ns_per_body\": %.6g, \"interactions_per_second\": %.6g, \"state_bytes\": %zu, "
+                "\"peak_rss_bytes\": %lld}%s\n",
+                b.name.c_str(), b.bodies, b.reps, b.secondsPerRep, b.secondsPerRep * 1e9 / (double)b.bodies,
+                b.interactionsPerRep / b.secondsPerRep, b.stateBytes, b.peakRssBytes,
+                r + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+static void printUsage(const char *argv0)
+{
+    std::printf("Usage: %s [options]\n", argv0);
+    std::printf("  --sizes LIST         comma-separated body counts (default: 10,1000,100000)\n");
+    std::printf("  --min-time SEC       time each benchmark for at least this long (default: 0.5)\n");
+    std::printf("  --filter TEXT        only run benchmarks whose name contains TEXT\n");
+    std::printf("  --threads N          worker threads (default: all cores)\n");
+    std::printf("  --output FILE        write JSON results to FILE (default: stdout)\n");
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<size_t> sizes = {10, 1000, 100000};
+    double minTime = 0.5;
+    const char *filter = nullptr;
+    const char *outputPath = nullptr;
+    unsigned threadCount = 0;
+
+    for (int a = 1; a < argc; ++a)
+    {
+        const char *arg = argv[a];
+        if (std::strcmp(arg, "--help") == 0 || std::strcmp(arg, "-h") == 0)
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        if (a + 1 >= argc)
+        {
+            fprintf(stderr, "Missing value for %s\n", arg);
+            return -1;
+        }
+
+        const char *value = argv[++a];
+        if (std::strcmp(arg, "--sizes") == 0)
+        {
+            sizes.clear();
+            for (const char *p = value; *p;)
+            {
+                char *end;
+                unsigned long long n = std::strtoull(p, &end, 10);
+                if (end == p || n == 0)
+                {
+                    fprintf(stderr, "Bad size list %s\n", value);
+                    return -1;
+                }
+                sizes.push_back((size_t)n);
+                p = *end == ',' ? end + 1 : end;
+            }
+        }
+        else if (std::strcmp(arg, "--min-time") == 0)
+            minTime = std::atof(value);
+        else if (std::strcmp(arg, "--filter") == 0)
+            filter = value;
+        else if (std::strcmp(arg, "--threads") == 0)
+            threadCount = (unsigned)std::atoi(value);
+        else if (std::strcmp(arg, "--output") == 0)
+            outputPath = value;
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", arg);
+            printUsage(argv[0]);
+            return -1;
+        }
+    }
+
+    ThreadPool pool(threadCount);
+    GravitySolver gravity;
+    gravity.pool = &pool;
+    std::vector<BenchResult> results;
+    auto wanted = [&](const std::string &name) { return !filter || name.find(filter) != std::string::npos; };
+
+    for (size_t n : sizes)
+    {
+        // Earth-like planets for the physics; the grid gets bodies heavy
+        // enough (over 1% of the star) that every one of them bends it
+        BodyStore disk, heavyDisk;
+        makeDisk(n, 1e-6, 1e-5, disk);
+        makeDisk(n, 0.01, 0.05, heavyDisk);
+        const size_t bodyBytes = bodyStoreBytes(disk);
+        const size_t accelBytes = n * sizeof(std::array<float, 3>);
+        const double pairs = (double)n * (double)(n - 1);
+        std::vector<std::array<float, 3>> accels;
+
+        // Force evaluation alone, for every solver
+        const ForceSolver solvers[] = {DIRECT_SUM, DIRECT_SIMD, BARNES_HUT};
+        const char *const solverNames[] = {"direct", "simd", "barnes-hut"}; // as --solver spells them
+        for (int s = 0; s < 3; ++s)
+        {
+            const ForceSolver solver = solvers[s];
+            std::string name = std::string("force/") + solverNames[s];
+            if (!wanted(name))
+                continue;
+            gravity.settings.solver = solver;
+            results.push_back(measure(name, n, bodyBytes + accelBytes, minTime,
+                                      [&]()
+                                      {
+                                          gravity.Compute(disk, accels);
+                                          return pairs;
+                                      }));
+        }
+        if (wanted("force/simd-mixed"))
+        {
+            gravity.settings.solver = DIRECT_SIMD;
+            gravity.settings.precision = PRECISION_MIXED;
+            results.push_back(measure("force/simd-mixed", n, bodyBytes + accelBytes, minTime,
+                                      [&]()
+                                      {
+                                          gravity.Compute(disk, accels);
+                                          return pairs;
+                                      }));
+            gravity.settings.precision = PRECISION_SINGLE;
+        }
+        if (wanted("force/simd-reproducible"))
+        {
+            gravity.settings.solver = DIRECT_SIMD;
+            gravity.settings.reproducible = true;
+            results.push_back(measure("force/simd-reproducible", n, bodyBytes + accelBytes, minTime,
+                                      [&]()
+                                      {
+                                          gravity.Compute(disk, accels);
+                                          return pairs;
+                                      }));
+            gravity.settings.reproducible = false;
+        }
+        gravity.settings.solver = BARNES_HUT;
+
+        // Kick and drift with fixed forces: the integration arithmetic by itself
+        if (wanted("integrate/kick-drift"))
+        {
+            BodyStore bodies = disk;
+            gravity.Compute(bodies, accels);
+            results.push_back(measure("integrate/kick-drift", n, bodyBytes + accelBytes, minTime,
+                                      [&]()
+                                      {
+                                          kickBodies(bodies, accels, SECONDS_PER_YEAR);
+                                          driftBodies(bodies, SECONDS_PER_YEAR);
+                                          return 0.0;
+                                      }));
+        }
+
+        // Whole steps, forces included (Barnes-Hut, as the viewer runs by
+        // default); interactions count the force evaluations each step made
+        const char *const integratorNames[] = {"euler", "leapfrog", "yoshida4", "wisdom-holman", "block"};
+        for (int type = SYMPLECTIC_EULER; type <= BLOCK_TIMESTEP; ++type)
+        {
+            std::string name = std::string("step/") + integratorNames[type];
+            if (!wanted(name))
+                continue;
+            BodyStore bodies = disk;
+            std::unique_ptr<Integrator> integrator = createIntegrator((IntegratorType)type);
+            results.push_back(measure(name, n, bodyBytes + accelBytes, minTime,
+                                      [&]()
+                                      {
+                                          unsigned long long before = gravity.evaluations;
+                                          integrator->Step(bodies, gravity, SECONDS_PER_YEAR);
+                                          return (double)(gravity.evaluations - before) * (n - 1);
+                                      }));
+        }
+
+        // Collision detection over a one-day step. The disk is spread until
+        // bodies sit about ten display diameters apart (hash cells are sized
+        // from the 6-pixel minimum radius, so a denser disk would pile many
+        // bodies into each cell), keeping Kepler speeds; any that touch merge
+        // before timing
+        if (wanted("collisions"))
+        {
+            const double day = SECONDS_PER_YEAR / 365.24;
+            const double spread = std::max(1.0, sqrt((double)n / 65.0));
+            BodyStore bodies = disk;
+            for (size_t i = 1; i < bodies.Size(); ++i)
+            {
+                bodies.x[i] *= (float)spread;
+                bodies.y[i] *= (float)spread;
+                bodies.vx[i] /= (float)sqrt(spread);
+                bodies.vy[i] /= (float)sqrt(spread);
+            }
+            CollisionSolver collisions;
+            collisions.pool = &pool;
+            collisions.Resolve(bodies, day);
+            results.push_back(measure("collisions", bodies.Size(), bodyStoreBytes(bodies), minTime,
+                                      [&]()
+                                      {
+                                          collisions.Resolve(bodies, day);
+                                          return 0.0;
+                                      }));
+        }
+
+        // n independent copies of the 9-body solar system with jittered
+        // masses, ten one-day steps per rep; n counts members here
+        if (wanted("ensemble"))
+        {
+            BodyStore solar;
+            loadSolarSystem(solar);
+            SweepSettings sweep;
+            sweep.members = n;
+            sweep.massJitter = 0.1;
+            std::vector<BodyStore> members;
+            std::vector<SweepMember> parameters;
+            makeSweep(solar, sweep, members, parameters);
+            Ensemble ensemble;
+            ensemble.pool = &pool;
+            ensemble.Load(members);
+            const size_t bodies = ensemble.Bodies();
+            const double day = SECONDS_PER_YEAR / 365.24;
+            results.push_back(measure("ensemble", n, n * bodies * 10 * sizeof(double), minTime,
+                                      [&]()
+                                      {
+                                          ensemble.Advance(day, 10);
+                                          return 10.0 * n * bodies * (bodies - 1);
+                                      }));
+        }
+
+        // Full re-evaluation of the space-time grid; every body is a source
+        const GridLayout layouts[] = {{false, 100, 50.0f}, {true, 20, 20.0f}};
+        for (const GridLayout &layout : layouts)
+        {
+            std::string name = layout.threeD ? "grid/3d" : "grid/2d";
+            if (!wanted(name))
+                continue;
+            CurvatureField field;
+            field.Update(heavyDisk, layout, &pool);
+            size_t points = layout.threeD ? (size_t)layout.size * layout.size * layout.size
+                                          : (size_t)layout.size * layout.size;
+            results.push_back(measure(name, n, bodyBytes + field.Vertices().size() * sizeof(float), minTime,
+                                      [&]()
+                                      {
+                                          field.Invalidate();
+                                          field.Update(heavyDisk, layout, &pool);
+                                          return (double)points * n;
+                                      }));
+        }
+
+        // Per-body lighting with a few black holes casting shadows
+        if (wanted("lighting"))
+        {
+            std::vector<std::array<float, 4>> blackHoles;
+            for (size_t i = 1; i < n && blackHoles.size() < 4; i += std::max<size_t>(1, n / 4))
+                blackHoles.push_back({{disk.x[i], disk.y[i], disk.z[i], 20.0f}});
+            const float light[3] = {disk.x[0], disk.y[0], disk.z[0]};
+            volatile float sink = 0.0f;
+            results.push_back(measure("lighting", n, bodyBytes, minTime,
+                                      [&]()
+                                      {
+                                          float total = 0.0f;
+                                          for (size_t i = 0; i < n; ++i)
+                                          {
+                                              const float position[3] = {disk.x[i], disk.y[i], disk.z[i]};
+                                              total += calculateLightIntensity(light, position, blackHoles);
+                                          }
+                                          sink = total;
+                                          return (double)n * blackHoles.size();
+                                      }));
+            (void)sink;
+        }
+    }
+
+    FILE *out = stdout;
+    if (outputPath)
+    {
+        out = fopen(outputPath, "w");
+        if (!out)
+        {
+            fprintf(stderr, "Failed to write %s\n", outputPath);
+            return -1;
+        }
+    }
+    writeJson(out, results, pool.ThreadCount(), kernelIsaName(gravity.settings.isa));
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,151 @@
+#include "bodies.h"
+#include "units.h"
+
+#include <cmath>
+
+float celestialRadius(double mass, double density, CelestialType type)
+{
+    if (type == BLACK_HOLE)
+    {
+        // Schwarzschild radius for black hole event horizon
+        const double c = 299792458.0; // speed of light
+        double schwarzschildRadius = (2.0 * G * mass) / (c * c);
+        return (float)(schwarzschildRadius / DISTANCE_SCALE * 1000000); // Scale for visibility
+    }
+
+    double volume = mass / density;
+    double radiusMeters = pow((3.0 * volume) / (4.0 * M_PI), 1.0 / 3.0);
+
+    const double SUN_SCALE_FACTOR = 5e6;
+    const double PLANET_SCALE_FACTOR = 1e6;
+
+    double radiusPixels;
+    if (mass > 1e29 || type == STAR)
+    {
+        radiusPixels = radiusMeters / SUN_SCALE_FACTOR;
+        const double MAX_SUN_RADIUS = 250.0;
+        if (radiusPixels > MAX_SUN_RADIUS)
+            radiusPixels = MAX_SUN_RADIUS;
+    }
+    else
+    {
+        radiusPixels = radiusMeters / PLANET_SCALE_FACTOR;
+        const double MIN_PLANET_RADIUS = 6.0;
+        if (radiusPixels < MIN_PLANET_RADIUS)
+            radiusPixels = MIN_PLANET_RADIUS;
+    }
+
+    return (float)radiusPixels;
+}
+
+float physicalRadius(double mass, double density, CelestialType type)
+{
+    if (mass <= 0.0)
+        return 0.0f;
+    if (type == BLACK_HOLE)
+    {
+        const double c = 299792458.0; // speed of light
+        return (float)((2.0 * G * mass) / (c * c) / DISTANCE_SCALE);
+    }
+    if (density <= 0.0)
+        return 0.0f;
+    double radiusMeters = pow((3.0 * mass / density) / (4.0 * M_PI), 1.0 / 3.0);
+    return (float)(radiusMeters / DISTANCE_SCALE);
+}
+
+size_t BodyStore::Add(float px, float py, float pz, float pvx, float pvy, float pvz, double m,
+                      const std::array<float, 4> &color, CelestialType objectType, double rho)
+{
+    x.push_back(px);
+    y.push_back(py);
+    z.push_back(pz);
+    vx.push_back(pvx);
+    vy.push_back(pvy);
+    vz.push_back(pvz);
+    mass.push_back(m);
+    density.push_back(rho);
+    hue.push_back(color);
+    type.push_back(objectType);
+    return x.size() - 1;
+}
+
+void BodyStore::Reserve(size_t count)
+{
+    x.reserve(count);
+    y.reserve(count);
+    z.reserve(count);
+    vx.reserve(count);
+    vy.reserve(count);
+    vz.reserve(count);
+    mass.reserve(count);
+    density.reserve(count);
+    hue.reserve(count);
+    type.reserve(count);
+}
+
+void BodyStore::Clear()
+{
+    x.clear();
+    y.clear();
+    z.clear();
+    vx.clear();
+    vy.clear();
+    vz.clear();
+    mass.clear();
+    density.clear();
+    hue.clear();
+    type.clear();
+    origin = {{0.0, 0.0, 0.0}};
+}
+
+void BodyStore::Resize(size_t count)
+{
+    x.resize(count);
+    y.resize(count);
+    z.resize(count);
+    vx.resize(count);
+    vy.resize(count);
+    vz.resize(count);
+    mass.resize(count);
+    density.resize(count);
+    hue.resize(count);
+    type.resize(count);
+}
+
+void BodyStore::Rebase(const std::array<double, 3> &shift)
+{
+    AlignedVector<float> *columns[3] = {&x, &y, &z};
+    for (int k = 0; k < 3; ++k)
+    {
+        if (shift[k] == 0.0)
+            continue;
+        for (float &offset : *columns[k])
+            offset = (float)(offset - shift[k]);
+        origin[k] += shift[k];
+    }
+}
+
+void BodyStore::Compact(const std::vector<unsigned char> &keep)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < x.size(); ++i)
+    {
+        if (!keep[i])
+            continue;
+        if (count != i)
+        {
+            x[count] = x[i];
+            y[count] = y[i];
+            z[count] = z[i];
+            vx[count] = vx[i];
+            vy[count] = vy[i];
+            vz[count] = vz[i];
+            mass[count] = mass[i];
+            density[count] = density[i];
+            hue[count] = hue[i];
+            type[count] = type[i];
+        }
+        ++count;
+    }
+    Resize(count);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+// Celestial object types
+enum CelestialType
+{
+    PLANET,
+    STAR,
+    BLACK_HOLE
+};
+
+// Allocator that hands out cache-line aligned blocks so SoA columns can be
+// streamed with aligned vector loads.
+template <typename T, size_t Alignment = 64>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind
+    {
+        typedef AlignedAllocator<U, Alignment> other;
+    };
+
+    AlignedAllocator() {}
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+    T *allocate(size_t n)
+    {
+        void *p = nullptr;
+        if (posix_memalign(&p, Alignment, n * sizeof(T)) != 0)
+            throw std::bad_alloc();
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, size_t) { free(p); }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// Display radius in pixels for a body of the given mass, density and type
+float celestialRadius(double mass, double density, CelestialType type);
+
+// True radius in pixels, without the display scaling: the sphere of the
+// given mass and density, or the event horizon for a black hole. Zero for
+// massless bodies.
+float physicalRadius(double mass, double density, CelestialType type);
+
+// Structure-of-arrays storage for every simulated body.
+//
+// Each physical quantity is its own contiguous, 64-byte aligned column so
+// the force, integration and grid loops can stream them without copies.
+// Index i in every column refers to the same body.
+//
+// Positions are float32 offsets from a double-precision origin. Forces and
+// integrators only ever need differences, so they work on the offsets
+// directly; anything that needs where a body actually is (drawing, output,
+// angular momentum) adds the origin. Moving the origin with the system
+// (see recenterBodies) keeps the offsets small and their ulps fine.
+class BodyStore
+{
+public:
+    std::array<double, 3> origin = {{0.0, 0.0, 0.0}}; // pixels
+    AlignedVector<float> x, y, z;    // position relative to origin (pixels)
+    AlignedVector<float> vx, vy, vz; // velocity (pixels per second)
+    AlignedVector<double> mass;      // kg
+    AlignedVector<double> density;   // kg/m^3
+    std::vector<std::array<float, 4>> hue;
+    std::vector<CelestialType> type;
+
+    size_t Add(float px, float py, float pz, float pvx, float pvy, float pvz, double m,
+               const std::array<float, 4> &color, CelestialType objectType = PLANET, double rho = 1400.0);
+    void Reserve(size_t count);
+    void Clear(); // also puts the origin back at zero
+
+    // Set every column to count entries; new entries are zeroed (bulk loaders fill them)
+    void Resize(size_t count);
+
+    // Drop every body whose keep flag is zero; the rest keep their order
+    void Compact(const std::vector<unsigned char> &keep);
+
+    // Move the origin by shift pixels without moving any body. Each offset is
+    // rounded to float32 once; the rounding is exact for every body the
+    // shift brings closer to the origin when shift is a multiple of its ulp.
+    void Rebase(const std::array<double, 3> &shift);
+
+    // Absolute position of body i (pixels)
+    std::array<double, 3> Position(size_t i) const
+    {
+        return {{origin[0] + x[i], origin[1] + y[i], origin[2] + z[i]}};
+    }
+
+    size_t Size() const { return x.size(); }
+    float Radius(size_t i) const { return celestialRadius(mass[i], density[i], type[i]); }
+    float PhysicalRadius(size_t i) const { return physicalRadius(mass[i], density[i], type[i]); }
+};
@@ -0,0 +1,256 @@
+#include "checkpoint.h"
+#include "profiler.h"
+#include "scenario.h"
+
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char CHECKPOINT_MAGIC[8] = {'G', 'R', 'A', 'V', 'C', 'K', 'P', '\0'};
+static const uint32_t CHECKPOINT_VERSION = 1;
+static const size_t CHECKPOINT_ALIGNMENT = 64;
+
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t integrator;
+    double simTime;
+    uint64_t step;
+    double timestep;
+    uint32_t solver; // low 16 bits the solver, high 16 the precision (0, single, in older files)
+    uint32_t isa;    // low 16 bits the kernel ISA, bit 16 set for reproducible kernels
+    float theta;
+    float softening;
+    uint64_t stateSize;
+};
+static_assert(sizeof(CheckpointHeader) == 64, "checkpoint header must stay 64 bytes");
+
+static size_t alignUp(size_t offset)
+{
+    return (offset + CHECKPOINT_ALIGNMENT - 1) / CHECKPOINT_ALIGNMENT * CHECKPOINT_ALIGNMENT;
+}
+
+void captureCheckpoint(Checkpoint &checkpoint, const BodyStore &bodies, const GravitySolver &gravity,
+                       const Integrator &integrator, double simTime, uint64_t step, double timestep)
+{
+    checkpoint.bodies = bodies; // column-wise copies into the existing buffers
+    checkpoint.simTime = simTime;
+    checkpoint.step = step;
+    checkpoint.timestep = timestep;
+    checkpoint.integrator = integrator.Type();
+    checkpoint.forces = gravity.settings;
+    integrator.SaveState(checkpoint.integratorState);
+}
+
+std::unique_ptr<Integrator> restoreIntegrator(Checkpoint &checkpoint)
+{
+    KernelIsa available = detectKernelIsa();
+    KernelIsa saved = checkpoint.forces.isa;
+    bool supported = saved == ISA_SCALAR || saved == available || (saved == ISA_AVX2 && available == ISA_AVX512);
+    if (checkpoint.forces.reproducible)
+    {
+        // Every kernel gives the same bits, so take the fastest one here
+        checkpoint.forces.isa = available;
+    }
+    else if (!supported)
+    {
+        fprintf(stderr, "Checkpoint used the %s kernel, which this host lacks; using %s\n", kernelIsaName(saved),
+                kernelIsaName(available));
+        checkpoint.forces.isa = available;
+    }
+
+    std::unique_ptr<Integrator> integrator = createIntegrator(checkpoint.integrator);
+    if (!integrator->LoadState(checkpoint.integratorState))
+    {
+        fprintf(stderr, "Checkpoint integrator state is invalid; forces will be recomputed\n");
+        integrator->Reset();
+    }
+    return integrator;
+}
+
+bool saveCheckpoint(const char *path, const Checkpoint &checkpoint)
+{
+    std::string temporary = std::string(path) + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to write checkpoint %s\n", temporary.c_str());
+        return false;
+    }
+
+    CheckpointHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    header.version = CHECKPOINT_VERSION;
+    header.integrator = (uint32_t)checkpoint.integrator;
+    header.simTime = checkpoint.simTime;
+    header.step = checkpoint.step;
+    header.timestep = checkpoint.timestep;
+    header.solver = (uint32_t)checkpoint.forces.solver | (uint32_t)checkpoint.forces.precision << 16;
+    header.isa = (uint32_t)checkpoint.forces.isa | (uint32_t)checkpoint.forces.reproducible << 16;
+    header.theta = checkpoint.forces.theta;
+    header.softening = checkpoint.forces.softening;
+    header.stateSize = checkpoint.integratorState.size();
+
+    // The body block starts 64-byte aligned so its columns stay aligned in the file
+    size_t stateEnd = sizeof(header) + checkpoint.integratorState.size();
+    size_t pad = alignUp(stateEnd) - stateEnd;
+    static const char padding[CHECKPOINT_ALIGNMENT] = {0};
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && (checkpoint.integratorState.empty() ||
+                fwrite(checkpoint.integratorState.data(), 1, checkpoint.integratorState.size(), file) ==
+                    checkpoint.integratorState.size());
+    ok = ok && (pad == 0 || fwrite(padding, 1, pad, file) == pad);
+    ok = ok && writeBinaryScenario(file, checkpoint.bodies);
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = (fclose(file) == 0) && ok;
+    ok = ok && rename(temporary.c_str(), path) == 0;
+    if (!ok)
+    {
+        fprintf(stderr, "Failed to write checkpoint %s\n", path);
+        remove(temporary.c_str());
+    }
+    return ok;
+}
+
+bool loadCheckpoint(const char *path, Checkpoint &checkpoint)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to open checkpoint %s\n", path);
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(CheckpointHeader))
+    {
+        fprintf(stderr, "%s: not a checkpoint\n", path);
+        close(fd);
+        return false;
+    }
+
+    const size_t fileSize = (size_t)info.st_size;
+    void *mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "Failed to map checkpoint %s\n", path);
+        return false;
+    }
+
+    const unsigned char *data = static_cast<const unsigned char *>(mapping);
+    CheckpointHeader header;
+    std::memcpy(&header, data, sizeof(header));
+
+    bool ok = true;
+    if (std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0)
+    {
+        fprintf(stderr, "%s: not a checkpoint\n", path);
+        ok = false;
+    }
+    else if (header.version != CHECKPOINT_VERSION || header.integrator > BLOCK_TIMESTEP ||
+             (header.solver & 0xffff) > BARNES_HUT || header.solver >> 16 > PRECISION_MIXED ||
+             header.isa > ISA_NEON)
+    {
+        fprintf(stderr, "%s: unsupported checkpoint version %u\n", path, header.version);
+        ok = false;
+    }
+    else if (header.stateSize > fileSize - sizeof(header))
+    {
+        fprintf(stderr, "%s: truncated checkpoint\n", path);
+        ok = false;
+    }
+
+    if (ok)
+    {
+        size_t stateEnd = sizeof(header) + (size_t)header.stateSize;
+        size_t bodyOffset = alignUp(stateEnd);
+        ok = bodyOffset <= fileSize &&
+             readBinaryScenario(data + bodyOffset, fileSize - bodyOffset, checkpoint.bodies, path);
+        if (ok)
+        {
+            checkpoint.simTime = header.simTime;
+            checkpoint.step = header.step;
+            checkpoint.timestep = header.timestep;
+            checkpoint.integrator = (IntegratorType)header.integrator;
+            checkpoint.forces.solver = (ForceSolver)(header.solver & 0xffff);
+            checkpoint.forces.precision = (ForcePrecision)(header.solver >> 16);
+            checkpoint.forces.isa = (KernelIsa)(header.isa & 0xffff);
+            checkpoint.forces.reproducible = (header.isa >> 16 & 1) != 0;
+            checkpoint.forces.theta = header.theta;
+            checkpoint.forces.softening = header.softening;
+            checkpoint.integratorState.assign(data + sizeof(header), data + stateEnd);
+        }
+    }
+
+    munmap(mapping, fileSize);
+    return ok;
+}
+
+CheckpointWriter::CheckpointWriter(const std::string &checkpointPath) : path(checkpointPath), written(0)
+{
+    thread = std::thread(&CheckpointWriter::Run, this);
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    thread.join();
+}
+
+void CheckpointWriter::Submit(Checkpoint &checkpoint)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        std::swap(pending, checkpoint);
+        hasPending = true;
+    }
+    wake.notify_all();
+}
+
+void CheckpointWriter::Flush()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    idle.wait(guard, [this]
+              { return !hasPending && !writing; });
+}
+
+void CheckpointWriter::Run()
+{
+    PROFILE_THREAD("checkpoint writer");
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;)
+    {
+        wake.wait(guard, [this]
+                  { return stopping || hasPending; });
+        if (!hasPending)
+            return; // stopping with nothing left to write
+
+        std::swap(current, pending);
+        hasPending = false;
+        writing = true;
+
+        guard.unlock();
+        {
+            PROFILE_SCOPE("checkpoint write");
+            if (saveCheckpoint(path.c_str(), current))
+                ++written;
+        }
+        guard.lock();
+
+        writing = false;
+        idle.notify_all();
+    }
+}
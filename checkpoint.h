@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bodies.h"
+#include "integrators.h"
+#include "physics.h"
+
+// Everything needed to resume a run bit for bit
+struct Checkpoint
+{
+    BodyStore bodies;
+    double simTime = 0.0; // simulated seconds since the run began
+    uint64_t step = 0;
+    double timestep = 0.0;
+    IntegratorType integrator = LEAPFROG_KDK;
+    ForceSettings forces;
+    std::vector<char> integratorState; // Integrator::SaveState()
+};
+
+// Copy a running simulation into checkpoint, reusing its buffers
+void captureCheckpoint(Checkpoint &checkpoint, const BodyStore &bodies, const GravitySolver &gravity,
+                       const Integrator &integrator, double simTime, uint64_t step, double timestep);
+
+// Recreate the integrator a checkpoint was taken with, cached state included.
+// The saved SIMD kernel is kept if this host supports it; otherwise results
+// are still correct but no longer bit-exact, and a warning is printed.
+// Runs with reproducible kernels stay bit-exact on any host.
+std::unique_ptr<Integrator> restoreIntegrator(Checkpoint &checkpoint);
+
+// Checkpoint files: a 64-byte header (magic "GRAVCKP\0", version, time,
+// step, timestep, integrator and solver settings), the integrator state,
+// then the bodies as a binary scenario block. Saving writes a temporary
+// file and renames it over path, so a crash never leaves a torn checkpoint.
+bool saveCheckpoint(const char *path, const Checkpoint &checkpoint);
+bool loadCheckpoint(const char *path, Checkpoint &checkpoint);
+
+// Writes checkpoints on a background thread so the step loop never waits
+// on the disk. Submit() takes the caller's checkpoint by swapping in a
+// spare, so after the first few calls no allocation happens either. If a
+// write is still running, a newer submission replaces any that is queued.
+class CheckpointWriter
+{
+public:
+    explicit CheckpointWriter(const std::string &path);
+    ~CheckpointWriter();
+
+    CheckpointWriter(const CheckpointWriter &) = delete;
+    CheckpointWriter &operator=(const CheckpointWriter &) = delete;
+
+    void Submit(Checkpoint &checkpoint);
+
+    // Block until everything submitted so far is on disk
+    void Flush();
+
+    unsigned long long Written() const { return written; }
+
+private:
+    void Run();
+
+    std::string path;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    Checkpoint pending;
+    Checkpoint current; // being written, owned by the writer thread
+    bool hasPending = false;
+    bool writing = false;
+    bool stopping = false;
+    std::atomic<unsigned long long> written;
+    std::thread thread;
+};
@@ -0,0 +1,441 @@
+#include "collisions.h"
+#include "profiler.h"
+#include "units.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Boxes wider than this many cells are tested against every body instead
+static const double LARGE_BOX_CELLS = 4.0;
+// Buckets (or bodies, for large boxes) per narrow-phase task; each task
+// writes its own pair list, so the pairs come out in the same order on
+// any number of threads
+static const size_t PAIR_CHUNK = 4096;
+// Pairs the force solvers skip as coincident, so they hold no potential either
+static const double MIN_DIST2 = 1e-6;
+
+static inline uint32_t hashCell(int64_t x, int64_t y, int64_t z, uint32_t mask)
+{
+    uint64_t h = (uint64_t)x * 73856093u ^ (uint64_t)y * 19349663u ^ (uint64_t)z * 83492791u;
+    return (uint32_t)(h ^ (h >> 32)) & mask;
+}
+
+static inline bool boxesOverlap(const float aLo[3], const float aHi[3], const float bLo[3], const float bHi[3])
+{
+    return aLo[0] <= bHi[0] && bLo[0] <= aHi[0] && aLo[1] <= bHi[1] && bLo[1] <= aHi[1] && aLo[2] <= bHi[2] &&
+           bLo[2] <= aHi[2];
+}
+
+// Test particles (massless) pass through each other; anything with mass
+// sweeps them up
+static inline bool interacts(const BodyStore &bodies, uint32_t i, uint32_t j)
+{
+    return bodies.mass[i] > 0.0 || bodies.mass[j] > 0.0;
+}
+
+// Closest approach of two spheres over the last step. Both are taken to
+// have moved in a straight line at their current velocity, which ends at
+// their current positions.
+static bool touched(const BodyStore &bodies, uint32_t i, uint32_t j, double reach, double timestep)
+{
+    const double d[3] = {(double)bodies.x[j] - bodies.x[i], (double)bodies.y[j] - bodies.y[i],
+                         (double)bodies.z[j] - bodies.z[i]};
+    const double w[3] = {((double)bodies.vx[j] - bodies.vx[i]) * timestep,
+                         ((double)bodies.vy[j] - bodies.vy[i]) * timestep,
+                         ((double)bodies.vz[j] - bodies.vz[i]) * timestep};
+    const double d0[3] = {d[0] - w[0], d[1] - w[1], d[2] - w[2]}; // separation at the start of the step
+
+    double ww = w[0] * w[0] + w[1] * w[1] + w[2] * w[2];
+    double s = 1.0;
+    if (ww > 0.0)
+        s = std::min(1.0, std::max(0.0, -(d0[0] * w[0] + d0[1] * w[1] + d0[2] * w[2]) / ww));
+
+    double cx = d0[0] + w[0] * s;
+    double cy = d0[1] + w[1] * s;
+    double cz = d0[2] + w[2] * s;
+    return cx * cx + cy * cy + cz * cz < reach * reach;
+}
+
+void CollisionSolver::ComputeBoxes(const BodyStore &bodies, double timestep)
+{
+    const size_t n = bodies.Size();
+    boxes.resize(n);
+    auto fill = [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            const float p[3] = {bodies.x[i], bodies.y[i], bodies.z[i]};
+            const float v[3] = {bodies.vx[i], bodies.vy[i], bodies.vz[i]};
+            Box &box = boxes[i];
+            box.radius = bodies.PhysicalRadius(i);
+            float travel = 0.0f;
+            for (int k = 0; k < 3; ++k)
+            {
+                float start = (float)(p[k] - v[k] * timestep);
+                box.lo[k] = std::min(p[k], start) - box.radius;
+                box.hi[k] = std::max(p[k], start) + box.radius;
+                travel = std::max(travel, std::fabs(p[k] - start));
+            }
+            box.extent = travel + 2.0f * bodies.Radius(i);
+        }
+    };
+    if (pool)
+        pool->ParallelFor(n, 1024, fill);
+    else
+        fill(0, n);
+
+    // Cells twice the mean box hold most boxes within 2 x 2 x 2 cells. True
+    // radii are far below a pixel, so cells are sized from the display radii
+    // instead of collapsing towards the size of a planet.
+    double extentSum = 0.0;
+    for (const Box &box : boxes)
+        extentSum += box.extent;
+    cellSize = std::max(2.0 * extentSum / (double)n, 1e-3);
+
+    large.clear();
+    for (size_t i = 0; i < n; ++i)
+    {
+        const Box &box = boxes[i];
+        float extent = std::max(box.hi[0] - box.lo[0], std::max(box.hi[1] - box.lo[1], box.hi[2] - box.lo[2]));
+        if (extent > LARGE_BOX_CELLS * cellSize)
+            large.push_back((uint32_t)i);
+    }
+}
+
+void CollisionSolver::CellRange(const Box &box, int64_t lo[3], int64_t hi[3]) const
+{
+    for (int k = 0; k < 3; ++k)
+    {
+        lo[k] = (int64_t)floor(box.lo[k] / cellSize);
+        hi[k] = (int64_t)floor(box.hi[k] / cellSize);
+    }
+}
+
+void CollisionSolver::BuildHash()
+{
+    const size_t n = boxes.size();
+    size_t buckets = 16;
+    while (buckets < 2 * (n - large.size()))
+        buckets *= 2;
+    tableMask = (uint32_t)(buckets - 1);
+
+    // Every cell a box covers, without repeats where two cells share a bucket
+    keys.clear();
+    std::vector<uint32_t> covered;
+    size_t nextLarge = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (nextLarge < large.size() && large[nextLarge] == i)
+        {
+            ++nextLarge;
+            continue;
+        }
+
+        int64_t lo[3], hi[3];
+        CellRange(boxes[i], lo, hi);
+        covered.clear();
+        for (int64_t cx = lo[0]; cx <= hi[0]; ++cx)
+            for (int64_t cy = lo[1]; cy <= hi[1]; ++cy)
+                for (int64_t cz = lo[2]; cz <= hi[2]; ++cz)
+                    covered.push_back(hashCell(cx, cy, cz, tableMask));
+        std::sort(covered.begin(), covered.end());
+        covered.erase(std::unique(covered.begin(), covered.end()), covered.end());
+        for (uint32_t bucket : covered)
+            keys.push_back((uint64_t)bucket << 32 | i);
+    }
+
+    // Counting sort by bucket; bodies stay in ascending order within a bucket
+    starts.assign(buckets + 1, 0);
+    for (uint64_t key : keys)
+        starts[(key >> 32) + 1]++;
+    for (size_t b = 0; b < buckets; ++b)
+        starts[b + 1] += starts[b];
+    cursor.assign(starts.begin(), starts.end() - 1);
+    entries.resize(keys.size());
+    for (uint64_t key : keys)
+        entries[cursor[key >> 32]++] = (uint32_t)key;
+}
+
+void CollisionSolver::FindPairs(const BodyStore &bodies, double timestep)
+{
+    const size_t n = boxes.size();
+    const size_t buckets = (size_t)tableMask + 1;
+    const size_t bucketChunks = (buckets + PAIR_CHUNK - 1) / PAIR_CHUNK;
+    const size_t bodyChunks = large.empty() ? 0 : (n + PAIR_CHUNK - 1) / PAIR_CHUNK;
+    chunkPairs.resize(bucketChunks + bodyChunks);
+    for (std::vector<Pair> &pairs : chunkPairs)
+        pairs.clear();
+
+    auto bucketPairs = [&](size_t begin, size_t end)
+    {
+        for (size_t c = begin; c < end; ++c)
+        {
+            std::vector<Pair> &out = chunkPairs[c];
+            const size_t last = std::min(buckets, (c + 1) * PAIR_CHUNK);
+            for (size_t b = c * PAIR_CHUNK; b < last; ++b)
+            {
+                for (uint32_t ea = starts[b]; ea < starts[b + 1]; ++ea)
+                {
+                    const uint32_t i = entries[ea];
+                    const Box &bi = boxes[i];
+                    for (uint32_t eb = ea + 1; eb < starts[b + 1]; ++eb)
+                    {
+                        const uint32_t j = entries[eb];
+                        const Box &bj = boxes[j];
+                        if (!boxesOverlap(bi.lo, bi.hi, bj.lo, bj.hi) || !interacts(bodies, i, j))
+                            continue;
+
+                        // Boxes sharing several cells meet in several buckets; only the
+                        // bucket of the cell holding the low corner of the overlap counts
+                        int64_t cx = (int64_t)floor(std::max(bi.lo[0], bj.lo[0]) / cellSize);
+                        int64_t cy = (int64_t)floor(std::max(bi.lo[1], bj.lo[1]) / cellSize);
+                        int64_t cz = (int64_t)floor(std::max(bi.lo[2], bj.lo[2]) / cellSize);
+                        if (hashCell(cx, cy, cz, tableMask) != b)
+                            continue;
+
+                        if (touched(bodies, i, j, (double)bi.radius + bj.radius, timestep))
+                            out.push_back({i, j});
+                    }
+                }
+            }
+        }
+    };
+
+    auto largePairs = [&](size_t begin, size_t end)
+    {
+        for (size_t c = begin; c < end; ++c)
+        {
+            std::vector<Pair> &out = chunkPairs[bucketChunks + c];
+            const size_t last = std::min(n, (c + 1) * PAIR_CHUNK);
+            for (size_t j = c * PAIR_CHUNK; j < last; ++j)
+            {
+                const Box &bj = boxes[j];
+                const bool jLarge = std::binary_search(large.begin(), large.end(), (uint32_t)j);
+                for (uint32_t l : large)
+                {
+                    // Two large bodies are tested once, from the higher index
+                    if (l == j || (jLarge && l > j))
+                        continue;
+                    const Box &bl = boxes[l];
+                    if (!boxesOverlap(bl.lo, bl.hi, bj.lo, bj.hi) || !interacts(bodies, l, (uint32_t)j))
+                        continue;
+                    if (touched(bodies, l, (uint32_t)j, (double)bl.radius + bj.radius, timestep))
+                        out.push_back({std::min(l, (uint32_t)j), std::max(l, (uint32_t)j)});
+                }
+            }
+        }
+    };
+
+    if (pool)
+    {
+        pool->ParallelFor(bucketChunks, 1, bucketPairs);
+        pool->ParallelFor(bodyChunks, 1, largePairs);
+    }
+    else
+    {
+        bucketPairs(0, bucketChunks);
+        largePairs(0, bodyChunks);
+    }
+}
+
+uint32_t CollisionSolver::Find(uint32_t i)
+{
+    while (parent[i] != i)
+    {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+// Black holes win over everything else, then mass, then the lower index
+bool CollisionSolver::Dominates(const BodyStore &bodies, uint32_t a, uint32_t b) const
+{
+    bool aHole = bodies.type[a] == BLACK_HOLE;
+    bool bHole = bodies.type[b] == BLACK_HOLE;
+    if (aHole != bHole)
+        return aHole;
+    if (bodies.mass[a] != bodies.mass[b])
+        return bodies.mass[a] > bodies.mass[b];
+    return a < b;
+}
+
+// What merging mergers[first, last) into their centre of mass takes out of
+// the system: motion about that centre, spin about it, the pair potentials
+// inside the group, and the change in its potential with every other body
+// now that the group pulls from one point. Potentials are softened like the
+// force solvers'. Groups are merged one after another, so bodies of groups
+// already merged count at their new place and absorbed ones not at all;
+// massless bodies carry nothing.
+void CollisionSolver::AddLosses(const BodyStore &bodies, size_t first, size_t last, const double pos[3],
+                                const double mom[3], double mass)
+{
+    members.clear();
+    members.push_back(mergers[first].survivor);
+    for (size_t g = first; g < last; ++g)
+    {
+        if (bodies.mass[mergers[g].absorbed] > 0.0)
+            members.push_back(mergers[g].absorbed);
+    }
+    if (members.size() < 2)
+        return; // only test particles were swept up
+
+    const double centre[3] = {pos[0] / mass, pos[1] / mass, pos[2] / mass};
+    const double velocity[3] = {mom[0] / mass, mom[1] / mass, mom[2] / mass};
+    const double softening2 = (double)softening * softening;
+    double kinetic = 0.0, potential = 0.0, angular[3] = {0.0, 0.0, 0.0};
+    for (size_t a = 0; a < members.size(); ++a)
+    {
+        const uint32_t i = members[a];
+        const double mi = bodies.mass[i];
+        const double r[3] = {bodies.x[i] - centre[0], bodies.y[i] - centre[1], bodies.z[i] - centre[2]};
+        const double v[3] = {bodies.vx[i] - velocity[0], bodies.vy[i] - velocity[1], bodies.vz[i] - velocity[2]};
+        kinetic += 0.5 * mi * (v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        angular[0] += mi * (r[1] * v[2] - r[2] * v[1]);
+        angular[1] += mi * (r[2] * v[0] - r[0] * v[2]);
+        angular[2] += mi * (r[0] * v[1] - r[1] * v[0]);
+        for (size_t b = a + 1; b < members.size(); ++b)
+        {
+            const uint32_t j = members[b];
+            const double d[3] = {(double)bodies.x[j] - bodies.x[i], (double)bodies.y[j] - bodies.y[i],
+                                 (double)bodies.z[j] - bodies.z[i]};
+            const double r2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+            if (r2 >= MIN_DIST2)
+                potential -= FORCE_SCALE * mi * bodies.mass[j] / sqrt(r2 + softening2);
+        }
+    }
+
+    for (size_t k = 0; k < bodies.Size(); ++k)
+    {
+        if (!keep[k] || k == members[0] || bodies.mass[k] <= 0.0)
+            continue;
+        const double p[3] = {bodies.x[k], bodies.y[k], bodies.z[k]};
+        double before = 0.0;
+        for (uint32_t i : members)
+        {
+            const double d[3] = {bodies.x[i] - p[0], bodies.y[i] - p[1], bodies.z[i] - p[2]};
+            const double r2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+            if (r2 >= MIN_DIST2)
+                before += bodies.mass[i] / sqrt(r2 + softening2);
+        }
+        const double d[3] = {centre[0] - p[0], centre[1] - p[1], centre[2] - p[2]};
+        const double r2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+        const double after = r2 >= MIN_DIST2 ? mass / sqrt(r2 + softening2) : 0.0;
+        potential += FORCE_SCALE * bodies.mass[k] * (after - before);
+    }
+
+    // Pixels to SI, one factor of DISTANCE_SCALE per length
+    const double scale2 = DISTANCE_SCALE * DISTANCE_SCALE;
+    losses.kinetic += kinetic * scale2;
+    losses.potential += potential * scale2;
+    for (int k = 0; k < 3; ++k)
+        losses.angular[k] += angular[k] * scale2;
+}
+
+size_t CollisionSolver::Resolve(BodyStore &bodies, double timestep)
+{
+    PROFILE_SCOPE("collisions");
+    mergers.clear();
+    remap.clear();
+    losses = MergerLosses();
+    const size_t n = bodies.Size();
+    if (n < 2)
+        return 0;
+
+    ComputeBoxes(bodies, timestep);
+    BuildHash();
+    FindPairs(bodies, timestep);
+
+    // Touching bodies form groups rooted at their dominant member, so the
+    // survivor does not depend on the order the pairs were found in
+    bool touching = false;
+    parent.resize(n);
+    for (size_t i = 0; i < n; ++i)
+        parent[i] = (uint32_t)i;
+    for (const std::vector<Pair> &pairs : chunkPairs)
+    {
+        for (const Pair &pair : pairs)
+        {
+            uint32_t a = Find(pair.a);
+            uint32_t b = Find(pair.b);
+            if (a == b)
+                continue;
+            if (Dominates(bodies, a, b))
+                parent[b] = a;
+            else
+                parent[a] = b;
+            touching = true;
+        }
+    }
+    if (!touching)
+        return 0;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        uint32_t root = Find((uint32_t)i);
+        if (root != i)
+            mergers.push_back({root, (uint32_t)i});
+    }
+    std::sort(mergers.begin(), mergers.end(), [](const Merger &a, const Merger &b)
+              { return a.survivor != b.survivor ? a.survivor < b.survivor : a.absorbed < b.absorbed; });
+
+    keep.assign(n, 1);
+    for (const Merger &merger : mergers)
+        keep[merger.absorbed] = 0;
+
+    // Sum mass, momentum and volume over each group in double precision
+    for (size_t g = 0; g < mergers.size();)
+    {
+        const size_t first = g;
+        const uint32_t s = mergers[g].survivor;
+        double m = bodies.mass[s];
+        double volume = bodies.density[s] > 0.0 ? m / bodies.density[s] : 0.0;
+        double pos[3] = {m * bodies.x[s], m * bodies.y[s], m * bodies.z[s]};
+        double mom[3] = {m * bodies.vx[s], m * bodies.vy[s], m * bodies.vz[s]};
+        for (; g < mergers.size() && mergers[g].survivor == s; ++g)
+        {
+            const uint32_t i = mergers[g].absorbed;
+            const double mi = bodies.mass[i];
+            m += mi;
+            if (bodies.density[i] > 0.0)
+                volume += mi / bodies.density[i];
+            pos[0] += mi * bodies.x[i];
+            pos[1] += mi * bodies.y[i];
+            pos[2] += mi * bodies.z[i];
+            mom[0] += mi * bodies.vx[i];
+            mom[1] += mi * bodies.vy[i];
+            mom[2] += mi * bodies.vz[i];
+        }
+
+        if (m > 0.0)
+            AddLosses(bodies, first, g, pos, mom, m);
+
+        bodies.mass[s] = m;
+        if (m > 0.0)
+        {
+            bodies.x[s] = (float)(pos[0] / m);
+            bodies.y[s] = (float)(pos[1] / m);
+            bodies.z[s] = (float)(pos[2] / m);
+            bodies.vx[s] = (float)(mom[0] / m);
+            bodies.vy[s] = (float)(mom[1] / m);
+            bodies.vz[s] = (float)(mom[2] / m);
+        }
+        // Black holes keep their density; their radius only follows the mass
+        if (bodies.type[s] != BLACK_HOLE && volume > 0.0)
+            bodies.density[s] = m / volume;
+    }
+
+    remap.resize(n);
+    uint32_t next = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (keep[i])
+            remap[i] = next++;
+    }
+    for (const Merger &merger : mergers)
+        remap[merger.absorbed] = remap[merger.survivor];
+
+    bodies.Compact(keep);
+    absorbed += mergers.size();
+    return mergers.size();
+}
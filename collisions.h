@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "bodies.h"
+#include "thread_pool.h"
+
+// One body folded into another by Resolve(), in indices from before the
+// absorbed bodies were removed
+struct Merger
+{
+    uint32_t survivor;
+    uint32_t absorbed;
+};
+
+// What the mergers of one Resolve() took out of the conserved totals, in SI
+// units. Mass, momentum and each group's centre of mass are kept; the
+// group's motion about that centre, its spin and its own binding energy go
+// into the merged body, and its potential with the rest of the system
+// shifts as its mass comes together. Absorbing massless test particles
+// loses nothing.
+struct MergerLosses
+{
+    double kinetic = 0.0;          // J, motion about each group's centre of mass
+    double potential = 0.0;        // J, potential energy before the mergers minus after
+    double angular[3] = {0, 0, 0}; // kg m^2 / s, each group's spin
+
+    double Energy() const { return kinetic + potential; }
+};
+
+// Collision detection and merging.
+//
+// Contact uses each body's physical radius (physicalRadius), not the
+// enlarged one it is drawn with.
+//
+// Broad phase: each body's bounding box over the last step (its radius
+// around the segment it travelled) goes into a uniform spatial hash with
+// cells twice the mean box size, so a pass costs O(n). Boxes larger than a
+// few cells (stars, black holes) are tested against every body instead of
+// being spread over thousands of cells.
+//
+// Narrow phase: the closest approach of the two spheres moving in straight
+// lines over the step, so fast movers cannot tunnel through each other
+// between two steps.
+//
+// Every connected group of touching bodies merges into one, conserving mass
+// and momentum: a black hole absorbs everything it touches, otherwise the
+// most massive body survives. Absorbed bodies are removed from the store.
+// Massless test particles never collide with each other.
+class CollisionSolver
+{
+public:
+    ThreadPool *pool = nullptr; // narrow phase runs here when set
+    float softening = 0.0f;     // the force solver's, for the binding energy in Losses()
+
+    // Merge every pair that touched during the step that just moved each
+    // body by velocity * timestep. Returns the number of bodies removed.
+    size_t Resolve(BodyStore &bodies, double timestep);
+
+    // After Resolve(): for every old index, the new index of the body that
+    // holds it now (its own, or its survivor's if it was absorbed)
+    const std::vector<uint32_t> &Remap() const { return remap; }
+
+    // Mergers performed by the last Resolve()
+    const std::vector<Merger> &Mergers() const { return mergers; }
+
+    // What the last Resolve()'s mergers took out of the conserved totals
+    const MergerLosses &Losses() const { return losses; }
+
+    // Bodies absorbed so far
+    unsigned long long absorbed = 0;
+
+private:
+    struct Box
+    {
+        float lo[3], hi[3];
+        float radius; // physical, for contact
+        float extent; // with the display radius, for sizing cells
+    };
+
+    struct Pair
+    {
+        uint32_t a, b;
+    };
+
+    void ComputeBoxes(const BodyStore &bodies, double timestep);
+    void BuildHash();
+    void FindPairs(const BodyStore &bodies, double timestep);
+    void CellRange(const Box &box, int64_t lo[3], int64_t hi[3]) const;
+    uint32_t Find(uint32_t i);
+    bool Dominates(const BodyStore &bodies, uint32_t a, uint32_t b) const;
+    void AddLosses(const BodyStore &bodies, size_t first, size_t last, const double pos[3], const double mom[3],
+                   double mass);
+
+    std::vector<Box> boxes;
+    std::vector<uint32_t> large; // bodies tested against every other body
+    double cellSize = 1.0;
+    uint32_t tableMask = 0;
+
+    std::vector<uint64_t> keys;      // (bucket << 32) | body for every cell a box covers
+    std::vector<uint32_t> starts;    // first entry of each bucket, one past the end last
+    std::vector<uint32_t> entries;   // bodies grouped by bucket, ascending within each
+    std::vector<uint32_t> cursor;
+    std::vector<std::vector<Pair>> chunkPairs;
+
+    std::vector<uint32_t> parent; // union-find over touching bodies
+    std::vector<Merger> mergers;
+    MergerLosses losses;
+    std::vector<uint32_t> members; // massive bodies of the group AddLosses() is on
+    std::vector<unsigned char> keep;
+    std::vector<uint32_t> remap;
+};
@@ -0,0 +1,223 @@
+#include "curvature_field.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static inline void pushVertex(std::vector<float> &verts, float x, float y, float z)
+{
+    verts.push_back(x);
+    verts.push_back(y);
+    verts.push_back(z);
+}
+
+// The Sun (body 0) always bends the grid; other bodies only above 1% of its
+// mass. The Sun passes that cut too, so it contributes twice, as it always has.
+void CurvatureField::CollectSources(const BodyStore &bodies)
+{
+    sources.clear();
+    size_t n = bodies.Size();
+    if (n == 0)
+        return;
+
+    const double sunMass = bodies.mass[0];
+    const std::array<double, 3> sun = bodies.Position(0);
+    sources.push_back({(float)sun[0], (float)sun[1], (float)sun[2], sunMass});
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (bodies.mass[i] > sunMass * 0.01)
+        {
+            const std::array<double, 3> r = bodies.Position(i);
+            sources.push_back({(float)r[0], (float)r[1], (float)r[2], bodies.mass[i]});
+        }
+    }
+}
+
+bool CurvatureField::SourcesMoved() const
+{
+    if (sources.size() != evaluatedSources.size())
+        return true;
+
+    const float tolerance2 = tolerance * tolerance;
+    for (size_t s = 0; s < sources.size(); ++s)
+    {
+        const Source &a = sources[s];
+        const Source &b = evaluatedSources[s];
+        float dx = a.x - b.x;
+        float dy = a.y - b.y;
+        float dz = a.z - b.z;
+        if (a.mass != b.mass || dx * dx + dy * dy + dz * dz > tolerance2)
+            return true;
+    }
+    return false;
+}
+
+// Space-time curvature at a point due to all massive objects
+float CurvatureField::Curvature(float x, float y, float z) const
+{
+    float totalCurvature = 0.0f;
+    for (const Source &source : sources)
+    {
+        float dx = x - source.x;
+        float dy = y - source.y;
+        float dz = z - source.z;
+        float dist = sqrt(dx * dx + dy * dy + dz * dz);
+        if (dist > 1.0f)
+        {
+            totalCurvature += source.mass / (dist * dist) * 1e-25f;
+        }
+    }
+    return totalCurvature;
+}
+
+bool CurvatureField::Update(const BodyStore &bodies, const GridLayout &layout, ThreadPool *pool)
+{
+    PROFILE_SCOPE("curvature field");
+    CollectSources(bodies);
+
+    bool layoutChanged = layout.threeD != current.threeD || layout.size != current.size ||
+                         layout.spacing != current.spacing;
+    if (valid && !layoutChanged && !SourcesMoved())
+        return false;
+
+    current = layout;
+    evaluatedSources = sources;
+    Evaluate(pool);
+    BuildVertices(pool);
+    valid = true;
+    return true;
+}
+
+void CurvatureField::Evaluate(ThreadPool *pool)
+{
+    const int n = current.size;
+    const size_t rowPoints = current.threeD ? (size_t)n * n : (size_t)n;
+    field.resize(rowPoints * n);
+
+    // One lattice row of i per task
+    auto evaluateRows = [&](size_t rowBegin, size_t rowEnd)
+    {
+        for (int i = (int)rowBegin; i < (int)rowEnd; ++i)
+        {
+            float *out = &field[i * rowPoints];
+            if (current.threeD)
+            {
+                const float step = current.spacing * 2.0f; // wider spacing for 3D
+                float x = (i - n / 2) * step;
+                for (int j = 0; j < n; ++j)
+                {
+                    float y = (j - n / 2) * step;
+                    for (int k = 0; k < n; ++k)
+                        out[j * n + k] = Curvature(x, y, (k - n / 2) * step);
+                }
+            }
+            else
+            {
+                float x = (i - n / 2) * current.spacing;
+                for (int j = 0; j < n; ++j)
+                    out[j] = Curvature(x, (j - n / 2) * current.spacing, 0);
+            }
+        }
+    };
+
+    size_t grain = std::max<size_t>(1, 4096 / rowPoints);
+    if (pool)
+        pool->ParallelFor(n, grain, evaluateRows);
+    else
+        evaluateRows(0, n);
+}
+
+void CurvatureField::BuildVertices(ThreadPool *pool)
+{
+    const int n = current.size;
+    rows.resize(n);
+
+    auto buildRows = [&](size_t rowBegin, size_t rowEnd)
+    {
+        for (int i = (int)rowBegin; i < (int)rowEnd; ++i)
+        {
+            std::vector<float> &verts = rows[i];
+            verts.clear();
+
+            if (current.threeD)
+            {
+                const float step = current.spacing * 2.0f;
+                for (int j = 0; j < n; ++j)
+                {
+                    for (int k = 0; k < n; ++k)
+                    {
+                        float x = (i - n / 2) * step;
+                        float y = (j - n / 2) * step;
+                        float z = (k - n / 2) * step;
+                        float displacement = field[((size_t)i * n + j) * n + k] * 50.0f;
+
+                        // Lines to adjacent points; only every other line to reduce clutter
+                        if (i < n - 1 && (i + j + k) % 2 == 0)
+                        {
+                            float displacement2 = field[((size_t)(i + 1) * n + j) * n + k] * 50.0f;
+                            pushVertex(verts, x, y - displacement, z);
+                            pushVertex(verts, x + step, y - displacement2, z);
+                        }
+
+                        if (j < n - 1 && (i + j + k) % 2 == 0)
+                        {
+                            float displacement2 = field[((size_t)i * n + j + 1) * n + k] * 50.0f;
+                            pushVertex(verts, x, y - displacement, z);
+                            pushVertex(verts, x, y + step - displacement2, z);
+                        }
+
+                        // Z-direction lines even more sparsely
+                        if (k < n - 1 && (i + j + k) % 3 == 0)
+                        {
+                            float displacement2 = field[((size_t)i * n + j) * n + k + 1] * 500.0f;
+                            pushVertex(verts, x, y - displacement, z);
+                            pushVertex(verts, x, y - displacement2, z + step);
+                        }
+                    }
+                }
+            }
+            else
+            {
+                for (int j = 0; j < n; ++j)
+                {
+                    float x = (i - n / 2) * current.spacing;
+                    float y = (j - n / 2) * current.spacing;
+                    float z = -200.0f; // fixed plane below the solar system
+                    float displacement = field[(size_t)i * n + j] * 500.0f;
+
+                    if (i < n - 1)
+                    {
+                        float displacement2 = field[(size_t)(i + 1) * n + j] * 500.0f;
+                        pushVertex(verts, x, y, z - displacement);
+                        pushVertex(verts, x + current.spacing, y, z - displacement2);
+                    }
+
+                    if (j < n - 1)
+                    {
+                        float displacement2 = field[(size_t)i * n + j + 1] * 500.0f;
+                        pushVertex(verts, x, y, z - displacement);
+                        pushVertex(verts, x, y + current.spacing, z - displacement2);
+                    }
+                }
+            }
+        }
+    };
+
+    if (pool)
+        pool->ParallelFor(n, 4, buildRows);
+    else
+        buildRows(0, n);
+
+    size_t total = 0;
+    for (const auto &row : rows)
+        total += row.size();
+    vertices.resize(total);
+    size_t offset = 0;
+    for (const auto &row : rows)
+    {
+        if (!row.empty())
+            std::memcpy(&vertices[offset], row.data(), row.size() * sizeof(float));
+        offset += row.size();
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "bodies.h"
+#include "thread_pool.h"
+
+// Lattice the space-time grid is drawn on
+struct GridLayout
+{
+    bool threeD;   // false: size x size points on a plane, true: size^3 points
+    int size;      // points per axis
+    float spacing; // pixels between neighbouring points
+};
+
+// Cached curvature lattice and the grid line vertices built from it.
+//
+// Each lattice point is evaluated once per update instead of once per line
+// end, and the whole field is skipped while no massive body has moved more
+// than tolerance pixels since the last evaluation.
+class CurvatureField
+{
+public:
+    float tolerance = 0.5f; // pixels a source may drift before the field is re-evaluated
+
+    // Re-evaluate the field if the layout changed or a source moved; returns
+    // true when Vertices() was rebuilt
+    bool Update(const BodyStore &bodies, const GridLayout &layout, ThreadPool *pool);
+
+    // Line segment end points (x, y, z per vertex), two vertices per line
+    const std::vector<float> &Vertices() const { return vertices; }
+
+    // Force the next Update() to re-evaluate
+    void Invalidate() { valid = false; }
+
+private:
+    struct Source
+    {
+        float x, y, z;
+        double mass;
+    };
+
+    void CollectSources(const BodyStore &bodies);
+    bool SourcesMoved() const;
+    float Curvature(float x, float y, float z) const;
+    void Evaluate(ThreadPool *pool);
+    void BuildVertices(ThreadPool *pool);
+
+    GridLayout current = {false, 0, 0.0f};
+    bool valid = false;
+
+    std::vector<Source> sources;          // this update
+    std::vector<Source> evaluatedSources; // when the field was last evaluated
+    std::vector<float> field;             // curvature per lattice point
+    std::vector<std::vector<float>> rows; // vertices per lattice row, joined into vertices
+    std::vector<float> vertices;
+};
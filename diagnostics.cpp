@@ -0,0 +1,208 @@
+#include "diagnostics.h"
+#include "profiler.h"
+#include "units.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Bodies per partial sum; partials are added in order, so the result does
+// not depend on the thread count
+static const size_t REDUCTION_CHUNK = 4096;
+
+static double length3(const double v[3])
+{
+    return sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+}
+
+const Conservation &ConservationMonitor::Measure(const BodyStore &bodies, GravitySolver &gravity,
+                                                 const Integrator &integrator, double time)
+{
+    PROFILE_SCOPE("conservation");
+    const size_t n = bodies.Size();
+    if (!integrator.ForcesAtStepEnd() || !gravity.trackPotentials || gravity.potentials.size() != n)
+    {
+        // The last force pass saw other positions (or did not track potentials)
+        bool tracking = gravity.trackPotentials;
+        gravity.trackPotentials = true;
+        gravity.Compute(bodies, scratch);
+        gravity.trackPotentials = tracking;
+    }
+
+    // Positions and velocities are in pixels: one factor of DISTANCE_SCALE
+    // per length turns them into SI
+    const double scale = DISTANCE_SCALE;
+    const double scale2 = scale * scale;
+    const float *phi = gravity.potentials.data();
+
+    const size_t chunks = (n + REDUCTION_CHUNK - 1) / REDUCTION_CHUNK;
+    partials.assign(chunks, Conservation());
+    auto reduce = [&](size_t begin, size_t end)
+    {
+        for (size_t c = begin; c < end; ++c)
+        {
+            Conservation &sum = partials[c];
+            const size_t last = std::min(n, (c + 1) * REDUCTION_CHUNK);
+            for (size_t i = c * REDUCTION_CHUNK; i < last; ++i)
+            {
+                const double m = bodies.mass[i];
+                const std::array<double, 3> r = bodies.Position(i);
+                const double v[3] = {bodies.vx[i], bodies.vy[i], bodies.vz[i]};
+                const double l[3] = {r[1] * v[2] - r[2] * v[1], r[2] * v[0] - r[0] * v[2], r[0] * v[1] - r[1] * v[0]};
+                const double v2 = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+
+                sum.kinetic += 0.5 * m * v2;
+                sum.potential += 0.5 * m * phi[i];
+                for (int k = 0; k < 3; ++k)
+                {
+                    sum.momentum[k] += m * v[k];
+                    sum.angular[k] += m * l[k];
+                }
+                sum.momentumScale += m * sqrt(v2);
+                sum.angularScale += m * length3(l);
+            }
+        }
+    };
+    if (gravity.pool)
+        gravity.pool->ParallelFor(chunks, 1, reduce);
+    else
+        reduce(0, chunks);
+
+    Conservation total;
+    total.time = time;
+    for (int k = 0; k < 3; ++k)
+    {
+        total.force[k] = gravity.netForce[k];
+        total.torque[k] = gravity.netTorque[k];
+    }
+    for (const Conservation &sum : partials)
+    {
+        total.kinetic += sum.kinetic;
+        total.potential += sum.potential;
+        for (int k = 0; k < 3; ++k)
+        {
+            total.momentum[k] += sum.momentum[k];
+            total.angular[k] += sum.angular[k];
+        }
+        total.momentumScale += sum.momentumScale;
+        total.angularScale += sum.angularScale;
+    }
+    if (combine)
+        combine(total);
+    total.kinetic *= scale2;
+    total.potential *= scale2;
+    total.momentumScale *= scale;
+    total.angularScale *= scale2;
+    for (int k = 0; k < 3; ++k)
+    {
+        total.momentum[k] *= scale;
+        total.angular[k] *= scale2;
+        total.force[k] *= scale;
+        total.torque[k] *= scale2;
+    }
+
+    // Trapezoids between measurements; a leapfrog step kicks with the mean
+    // of the forces at its two ends, so measuring every step is exact
+    if (haveReference && gravity.settings.solver == BARNES_HUT)
+    {
+        const double elapsed = total.time - latest.time;
+        impulse += 0.5 * (length3(latest.force) + length3(total.force)) * elapsed;
+        angularImpulse += 0.5 * (length3(latest.torque) + length3(total.torque)) * elapsed;
+    }
+    latest = total;
+    const bool approximateRsqrt = gravity.settings.solver == DIRECT_SIMD && !gravity.settings.reproducible;
+    passRoundoff = (approximateRsqrt ? 2.0 : 1.0) * FLT_EPSILON;
+    if (!haveReference)
+    {
+        reference = total;
+        absorbed = Conservation();
+        impulse = angularImpulse = 0.0;
+        haveReference = true;
+        referenceEvaluations = gravity.evaluations;
+        maxEnergyDrift = 0.0;
+        energyAlarm = momentumAlarm = angularAlarm = false;
+    }
+    forcePasses = n > 0 ? (double)(gravity.evaluations - referenceEvaluations) / n : 0.0;
+    maxEnergyDrift = std::max(maxEnergyDrift, EnergyDrift());
+    return latest;
+}
+
+void ConservationMonitor::Absorb(const MergerLosses &losses)
+{
+    absorbed.kinetic += losses.kinetic;
+    absorbed.potential += losses.potential;
+    for (int k = 0; k < 3; ++k)
+        absorbed.angular[k] += losses.angular[k];
+}
+
+double ConservationMonitor::EnergyDrift() const
+{
+    double e0 = reference.Energy();
+    return e0 != 0.0 ? fabs((latest.Energy() + absorbed.Energy() - e0) / e0) : 0.0;
+}
+
+double ConservationMonitor::MomentumDrift() const
+{
+    double d[3];
+    for (int k = 0; k < 3; ++k)
+        d[k] = latest.momentum[k] - reference.momentum[k];
+    return reference.momentumScale > 0.0 ? length3(d) / reference.momentumScale : 0.0;
+}
+
+double ConservationMonitor::AngularMomentumDrift() const
+{
+    double d[3];
+    for (int k = 0; k < 3; ++k)
+        d[k] = latest.angular[k] + absorbed.angular[k] - reference.angular[k];
+    return reference.angularScale > 0.0 ? length3(d) / reference.angularScale : 0.0;
+}
+
+double ConservationMonitor::MomentumTolerance() const
+{
+    if (momentumTolerance > 0.0)
+        return momentumTolerance;
+    // Four standard deviations of the random walk, and never below one pass
+    double tolerance = 4.0 * passRoundoff * sqrt(std::max(forcePasses, 1.0));
+    // Twice the impulse covers measurements more than a step apart
+    if (reference.momentumScale > 0.0)
+        tolerance += 2.0 * impulse / reference.momentumScale;
+    return tolerance;
+}
+
+double ConservationMonitor::AngularMomentumTolerance() const
+{
+    if (momentumTolerance > 0.0)
+        return momentumTolerance;
+    double tolerance = 4.0 * passRoundoff * sqrt(std::max(forcePasses, 1.0));
+    if (reference.angularScale > 0.0)
+        tolerance += 2.0 * angularImpulse / reference.angularScale;
+    return tolerance;
+}
+
+static bool checkDrift(FILE *out, const char *what, double drift, double tolerance, double time, bool &alarm)
+{
+    bool over = drift > tolerance;
+    if (over && !alarm)
+        fprintf(out, "Warning: %s drift %.3g exceeds %.3g at %.3f years\n", what, drift, tolerance,
+                time / SECONDS_PER_YEAR);
+    else if (!over && alarm)
+        fprintf(out, "%s drift back within %.3g at %.3f years\n", what, tolerance, time / SECONDS_PER_YEAR);
+    alarm = over;
+    return over;
+}
+
+bool ConservationMonitor::CheckAlarms(FILE *out)
+{
+    bool energy = checkDrift(out, "Energy", EnergyDrift(), energyTolerance, latest.time, energyAlarm);
+    bool momentum = checkDrift(out, "Momentum", MomentumDrift(), MomentumTolerance(), latest.time, momentumAlarm);
+    bool angular = checkDrift(out, "Angular momentum", AngularMomentumDrift(), AngularMomentumTolerance(), latest.time,
+                              angularAlarm);
+    return energy || momentum || angular;
+}
+
+void ConservationMonitor::Print(FILE *out) const
+{
+    fprintf(out, "t = %.3f years: E = %.6e J (drift %.2e), 2K/|W| = %.4f, dP = %.2e, dL = %.2e\n",
+            latest.time / SECONDS_PER_YEAR, latest.Energy(), EnergyDrift(), latest.VirialRatio(), MomentumDrift(),
+            AngularMomentumDrift());
+}
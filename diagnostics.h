@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+#include "bodies.h"
+#include "collisions.h"
+#include "integrators.h"
+#include "physics.h"
+#include "thread_pool.h"
+
+// Conserved quantities of the whole system at one instant, in SI units
+struct Conservation
+{
+    double time = 0.0;               // simulated seconds
+    double kinetic = 0.0;            // J
+    double potential = 0.0;          // J, pair sum counted once
+    double momentum[3] = {0, 0, 0};  // kg m / s
+    double angular[3] = {0, 0, 0};   // kg m^2 / s, about the origin
+    double momentumScale = 0.0;      // sum m |v|, for relative drift
+    double angularScale = 0.0;       // sum m |r x v|, for relative drift
+    double force[3] = {0, 0, 0};     // N, net force of the last force pass (GravitySolver netForce)
+    double torque[3] = {0, 0, 0};    // N m, its net torque about the origin
+
+    double Energy() const { return kinetic + potential; }
+    double VirialRatio() const { return potential != 0.0 ? 2.0 * kinetic / -potential : 0.0; }
+};
+
+// Energy, momentum and angular momentum bookkeeping with drift alarms.
+//
+// The potential comes from the force pass itself (GravitySolver
+// trackPotentials), so measuring after an integrator whose last force pass
+// sees the final positions costs only one O(n) pass over the columns. Other
+// integrators get a separate potential pass, so measure them less often.
+class ConservationMonitor
+{
+public:
+    double energyTolerance = 1e-3; // |E - E0| / |E0| that raises the alarm
+    double momentumTolerance = 0;  // |P - P0| / sum m |v|, likewise for L; 0 uses MomentumTolerance()
+
+    // Multi-process runs: replace the sums over this process's bodies with
+    // the sums over every process's (called before units are applied)
+    std::function<void(Conservation &sum)> combine;
+
+    // Turn on potential tracking in the solver the monitor will be fed from
+    static void Prepare(GravitySolver &gravity) { gravity.trackPotentials = true; }
+
+    // Conserved quantities of the state the integrator just produced. The
+    // first measurement becomes the reference that drifts are taken against.
+    const Conservation &Measure(const BodyStore &bodies, GravitySolver &gravity, const Integrator &integrator,
+                                double time);
+
+    const Conservation &Latest() const { return latest; }
+    const Conservation &Reference() const { return reference; }
+    double EnergyDrift() const;
+    double MomentumDrift() const;
+    double AngularMomentumDrift() const;
+    double MaxEnergyDrift() const { return maxEnergyDrift; }
+
+    // Momentum drift the force solver allows by now. Every solver returns
+    // float32 accelerations that are kicked into float32 velocities, so each
+    // force pass adds an error of a few float32 ulps per body with a random
+    // sign, and the drift grows with the square root of the passes since the
+    // reference. The fast SIMD kernels' refined rsqrt estimate doubles the
+    // per-pass error; the exact sqrt of the double-precision solvers and
+    // reproducible kernels does not. Barnes-Hut adds twice the impulse of
+    // the net force its cell approximations leave over (|net force|
+    // integrated over time), which bounds the drift they can cause. That
+    // force grows with theta and with how unevenly the mass is spread, so
+    // it is measured rather than modelled.
+    double MomentumTolerance() const;
+    double AngularMomentumTolerance() const; // likewise, with the net torque
+
+    // Warn on stderr when a drift crosses its tolerance (once per crossing);
+    // true while any quantity is out of tolerance
+    bool CheckAlarms(FILE *out = stderr);
+
+    // Take the next measurement as the new reference
+    void Reset() { haveReference = false; }
+
+    // Carry what mergers took out of the system forward, so the drifts keep
+    // measuring the integrator instead of the collisions
+    void Absorb(const MergerLosses &losses);
+
+    void Print(FILE *out) const;
+
+private:
+    Conservation latest;
+    Conservation reference;
+    Conservation absorbed; // taken out by mergers since the reference
+    bool haveReference = false;
+    unsigned long long referenceEvaluations = 0; // gravity.evaluations when the reference was taken
+    double forcePasses = 0.0;                    // force passes over every body since the reference
+    double passRoundoff = 0.0;                   // relative error of one pass's accelerations
+    double impulse = 0.0;                        // Barnes-Hut: integral of |net force| since the reference
+    double angularImpulse = 0.0;                 // likewise for the net torque
+    double maxEnergyDrift = 0.0;
+    bool energyAlarm = false;
+    bool momentumAlarm = false;
+    bool angularAlarm = false;
+
+    std::vector<std::array<float, 3>> scratch; // accels of a separate potential pass
+    std::vector<Conservation> partials;
+};
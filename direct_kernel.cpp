@@ -0,0 +1,760 @@
+#include "direct_kernel.h"
+
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+
+#include "simd_config.h"
+
+// Pairs closer than 1e-3 pixels are skipped, as in the reference direct sum
+static const float MIN_DIST2 = 1e-6f;
+
+// Every kernel is instantiated with and without the potential sum, so runs
+// that do not track energy pay nothing for it. The self pair adds no force
+// but would add gm_i / softening to the potential, so its lane is masked off.
+//
+// They are also instantiated with and without compensated sums. The pair
+// math is float32 either way; compensated kernels carry a Kahan correction
+// per lane, reduce the lanes in double and finish the row in double.
+
+// Row i's position and its index among the sources (which the potential skips)
+static inline size_t rowPosition(const DirectKernelArgs &args, size_t i, float &xi, float &yi, float &zi)
+{
+    if (!args.targetX)
+    {
+        xi = args.x[i];
+        yi = args.y[i];
+        zi = args.z[i];
+        return i;
+    }
+    xi = args.targetX[i];
+    yi = args.targetY[i];
+    zi = args.targetZ[i];
+    return args.sourceOf[i] == UINT32_MAX ? SIZE_MAX : args.sourceOf[i];
+}
+
+// Tail of a row that does not fill a whole vector, summed in Real
+template <bool Potential, typename Real>
+static inline void accumulateScalar(const DirectKernelArgs &args, size_t i, size_t jBegin,
+                                    Real &ax, Real &ay, Real &az, Real &phi)
+{
+    float xi, yi, zi;
+    const size_t self = rowPosition(args, i, xi, yi, zi);
+    for (size_t j = jBegin; j < args.count; ++j)
+    {
+        float dx = args.x[j] - xi;
+        float dy = args.y[j] - yi;
+        float dz = args.z[j] - zi;
+        float r2 = dx * dx + dy * dy + dz * dz + args.softening2;
+        if (r2 <= MIN_DIST2)
+            continue;
+
+        float invR = 1.0f / sqrtf(r2);
+        float s = args.gm[j] * invR * invR * invR;
+        ax += s * dx;
+        ay += s * dy;
+        az += s * dz;
+        if (Potential && j != self)
+            phi -= args.gm[j] * invR;
+    }
+}
+
+// Adds the scalar tail from jBegin on to the vector sums and stores the row
+template <bool Potential, typename Real>
+static inline void finishRow(const DirectKernelArgs &args, size_t i, size_t jBegin, Real ax, Real ay, Real az,
+                             Real phi)
+{
+    accumulateScalar<Potential>(args, i, jBegin, ax, ay, az, phi);
+    args.accels[i] = {{(float)ax, (float)ay, (float)az}};
+    if (Potential)
+        args.potentials[i] = (float)phi;
+}
+
+// Without vectors the compensated variant simply sums in double
+template <bool Potential, bool Compensated>
+static void directKernelScalar(const DirectKernelArgs &args, size_t begin, size_t end)
+{
+    typedef typename std::conditional<Compensated, double, float>::type Real;
+    for (size_t k = begin; k < end; ++k)
+    {
+        const size_t i = args.rows ? args.rows[k] : k;
+        finishRow<Potential>(args, i, 0, Real(0), Real(0), Real(0), Real(0));
+    }
+}
+
+#if GRAV_X86
+__attribute__((target("avx2,fma"))) static inline float horizontalSum(__m256 v)
+{
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+    return _mm_cvtss_f32(lo);
+}
+
+// sum += a * b, or sum -= a * b, with a Kahan correction when Compensated
+template <bool Compensated>
+__attribute__((target("avx2,fma"))) static inline void accumulate(__m256 &sum, __m256 &comp, __m256 a, __m256 b)
+{
+    if (!Compensated)
+    {
+        sum = _mm256_fmadd_ps(a, b, sum);
+        return;
+    }
+    __m256 y = _mm256_fmsub_ps(a, b, comp);
+    __m256 t = _mm256_add_ps(sum, y);
+    comp = _mm256_sub_ps(_mm256_sub_ps(t, sum), y);
+    sum = t;
+}
+
+template <bool Compensated>
+__attribute__((target("avx2,fma"))) static inline void accumulateNeg(__m256 &sum, __m256 &comp, __m256 a, __m256 b)
+{
+    if (!Compensated)
+    {
+        sum = _mm256_fnmadd_ps(a, b, sum);
+        return;
+    }
+    __m256 y = _mm256_fnmsub_ps(a, b, comp);
+    __m256 t = _mm256_add_ps(sum, y);
+    comp = _mm256_sub_ps(_mm256_sub_ps(t, sum), y);
+    sum = t;
+}
+
+__attribute__((target("avx2,fma"))) static inline double compensatedSum(__m256 sum, __m256 comp)
+{
+    float s[8], c[8];
+    _mm256_storeu_ps(s, sum);
+    _mm256_storeu_ps(c, comp);
+    double total = 0.0;
+    for (int l = 0; l < 8; ++l)
+        total += (double)s[l] - c[l];
+    return total;
+}
+
+template <bool Potential, bool Compensated>
+__attribute__((target("avx2,fma"))) static void directKernelAvx2(const DirectKernelArgs &args, size_t begin, size_t end)
+{
+    const size_t n = args.count;
+    const size_t nVec = n & ~(size_t)7;
+    const __m256 eps2 = _mm256_set1_ps(args.softening2);
+    const __m256 minDist2 = _mm256_set1_ps(MIN_DIST2);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 threeHalves = _mm256_set1_ps(1.5f);
+    const __m256 lane = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+
+    for (size_t k = begin; k < end; ++k)
+    {
+        const size_t i = args.rows ? args.rows[k] : k;
+        float px, py, pz;
+        const size_t self = rowPosition(args, i, px, py, pz);
+        const size_t selfBlock = self & ~(size_t)7;
+        const __m256 notSelf = _mm256_cmp_ps(lane, _mm256_set1_ps((float)(self & 7)), _CMP_NEQ_OQ);
+        const __m256 xi = _mm256_set1_ps(px);
+        const __m256 yi = _mm256_set1_ps(py);
+        const __m256 zi = _mm256_set1_ps(pz);
+        __m256 ax = _mm256_setzero_ps(), cx = _mm256_setzero_ps();
+        __m256 ay = _mm256_setzero_ps(), cy = _mm256_setzero_ps();
+        __m256 az = _mm256_setzero_ps(), cz = _mm256_setzero_ps();
+        __m256 phi = _mm256_setzero_ps(), cphi = _mm256_setzero_ps();
+
+        for (size_t j = 0; j < nVec; j += 8)
+        {
+            __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(args.x + j), xi);
+            __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(args.y + j), yi);
+            __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(args.z + j), zi);
+            __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_fmadd_ps(dz, dz, eps2)));
+
+            // 12-bit rsqrt estimate refined by one Newton-Raphson step
+            __m256 invR = _mm256_rsqrt_ps(r2);
+            invR = _mm256_mul_ps(invR, _mm256_fnmadd_ps(_mm256_mul_ps(half, r2), _mm256_mul_ps(invR, invR), threeHalves));
+
+            __m256 valid = _mm256_cmp_ps(r2, minDist2, _CMP_GT_OQ);
+            __m256 invR3 = _mm256_mul_ps(invR, _mm256_mul_ps(invR, invR));
+            invR3 = _mm256_and_ps(invR3, valid);
+            __m256 gm = _mm256_loadu_ps(args.gm + j);
+            __m256 s = _mm256_mul_ps(gm, invR3);
+
+            accumulate<Compensated>(ax, cx, s, dx);
+            accumulate<Compensated>(ay, cy, s, dy);
+            accumulate<Compensated>(az, cz, s, dz);
+            if (Potential)
+            {
+                __m256 keep = j == selfBlock ? _mm256_and_ps(valid, notSelf) : valid;
+                accumulateNeg<Compensated>(phi, cphi, gm, _mm256_and_ps(invR, keep));
+            }
+        }
+
+        if (Compensated)
+            finishRow<Potential>(args, i, nVec, compensatedSum(ax, cx), compensatedSum(ay, cy),
+                                 compensatedSum(az, cz), Potential ? compensatedSum(phi, cphi) : 0.0);
+        else
+            finishRow<Potential>(args, i, nVec, horizontalSum(ax), horizontalSum(ay), horizontalSum(az),
+                                 Potential ? horizontalSum(phi) : 0.0f);
+    }
+}
+
+// GCC's AVX-512 headers seed intrinsics with self-initialized undefined
+// vectors, which -Wmaybe-uninitialized reports once they inline here.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+template <bool Compensated>
+__attribute__((target("avx512f"))) static inline void accumulate(__m512 &sum, __m512 &comp, __m512 a, __m512 b)
+{
+    if (!Compensated)
+    {
+        sum = _mm512_fmadd_ps(a, b, sum);
+        return;
+    }
+    __m512 y = _mm512_fmsub_ps(a, b, comp);
+    __m512 t = _mm512_add_ps(sum, y);
+    comp = _mm512_sub_ps(_mm512_sub_ps(t, sum), y);
+    sum = t;
+}
+
+// sum -= a * b in the lanes of mask only
+template <bool Compensated>
+__attribute__((target("avx512f"))) static inline void accumulateNeg(__m512 &sum, __m512 &comp, __m512 a, __m512 b,
+                                                                    __mmask16 mask)
+{
+    if (!Compensated)
+    {
+        sum = _mm512_mask3_fnmadd_ps(a, b, sum, mask);
+        return;
+    }
+    __m512 y = _mm512_fnmsub_ps(a, b, comp);
+    __m512 t = _mm512_add_ps(sum, y);
+    comp = _mm512_mask_sub_ps(comp, mask, _mm512_sub_ps(t, sum), y);
+    sum = _mm512_mask_mov_ps(sum, mask, t);
+}
+
+__attribute__((target("avx512f"))) static inline double compensatedSum(__m512 sum, __m512 comp)
+{
+    // Each half widens to double exactly before the lanes are added
+    __m512d lo = _mm512_sub_pd(_mm512_cvtps_pd(_mm512_castps512_ps256(sum)),
+                               _mm512_cvtps_pd(_mm512_castps512_ps256(comp)));
+    __m512d hi = _mm512_sub_pd(_mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(sum), 1))),
+                               _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(comp), 1))));
+    return _mm512_reduce_add_pd(_mm512_add_pd(lo, hi));
+}
+
+template <bool Potential, bool Compensated>
+__attribute__((target("avx512f"))) static void directKernelAvx512(const DirectKernelArgs &args, size_t begin, size_t end)
+{
+    const size_t n = args.count;
+    const size_t nVec = n & ~(size_t)15;
+    const __m512 eps2 = _mm512_set1_ps(args.softening2);
+    const __m512 minDist2 = _mm512_set1_ps(MIN_DIST2);
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 threeHalves = _mm512_set1_ps(1.5f);
+
+    for (size_t k = begin; k < end; ++k)
+    {
+        const size_t i = args.rows ? args.rows[k] : k;
+        float px, py, pz;
+        const size_t self = rowPosition(args, i, px, py, pz);
+        const size_t selfBlock = self & ~(size_t)15;
+        const __mmask16 notSelf = (__mmask16) ~(1u << (self & 15));
+        const __m512 xi = _mm512_set1_ps(px);
+        const __m512 yi = _mm512_set1_ps(py);
+        const __m512 zi = _mm512_set1_ps(pz);
+        __m512 ax = _mm512_setzero_ps(), cx = _mm512_setzero_ps();
+        __m512 ay = _mm512_setzero_ps(), cy = _mm512_setzero_ps();
+        __m512 az = _mm512_setzero_ps(), cz = _mm512_setzero_ps();
+        __m512 phi = _mm512_setzero_ps(), cphi = _mm512_setzero_ps();
+
+        for (size_t j = 0; j < nVec; j += 16)
+        {
+            __m512 dx = _mm512_sub_ps(_mm512_loadu_ps(args.x + j), xi);
+            __m512 dy = _mm512_sub_ps(_mm512_loadu_ps(args.y + j), yi);
+            __m512 dz = _mm512_sub_ps(_mm512_loadu_ps(args.z + j), zi);
+            __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_fmadd_ps(dz, dz, eps2)));
+
+            // 14-bit rsqrt estimate refined by one Newton-Raphson step
+            __m512 invR = _mm512_rsqrt14_ps(r2);
+            invR = _mm512_mul_ps(invR, _mm512_fnmadd_ps(_mm512_mul_ps(half, r2), _mm512_mul_ps(invR, invR), threeHalves));
+
+            __mmask16 valid = _mm512_cmp_ps_mask(r2, minDist2, _CMP_GT_OQ);
+            __m512 invR3 = _mm512_maskz_mul_ps(valid, invR, _mm512_mul_ps(invR, invR));
+            __m512 gm = _mm512_loadu_ps(args.gm + j);
+            __m512 s = _mm512_mul_ps(gm, invR3);
+
+            accumulate<Compensated>(ax, cx, s, dx);
+            accumulate<Compensated>(ay, cy, s, dy);
+            accumulate<Compensated>(az, cz, s, dz);
+            if (Potential)
+                accumulateNeg<Compensated>(phi, cphi, gm, invR,
+                                           j == selfBlock ? (__mmask16)(valid & notSelf) : valid);
+        }
+
+        if (Compensated)
+            finishRow<Potential>(args, i, nVec, compensatedSum(ax, cx), compensatedSum(ay, cy),
+                                 compensatedSum(az, cz), Potential ? compensatedSum(phi, cphi) : 0.0);
+        else
+            finishRow<Potential>(args, i, nVec, _mm512_reduce_add_ps(ax), _mm512_reduce_add_ps(ay),
+                                 _mm512_reduce_add_ps(az), Potential ? _mm512_reduce_add_ps(phi) : 0.0f);
+    }
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+#if GRAV_NEON
+template <bool Compensated>
+static inline void accumulate(float32x4_t &sum, float32x4_t &comp, float32x4_t a, float32x4_t b)
+{
+    if (!Compensated)
+    {
+        sum = vfmaq_f32(sum, a, b);
+        return;
+    }
+    float32x4_t y = vfmaq_f32(vnegq_f32(comp), a, b);
+    float32x4_t t = vaddq_f32(sum, y);
+    comp = vsubq_f32(vsubq_f32(t, sum), y);
+    sum = t;
+}
+
+template <bool Compensated>
+static inline void accumulateNeg(float32x4_t &sum, float32x4_t &comp, float32x4_t a, float32x4_t b)
+{
+    if (!Compensated)
+    {
+        sum = vfmsq_f32(sum, a, b);
+        return;
+    }
+    float32x4_t y = vfmsq_f32(vnegq_f32(comp), a, b);
+    float32x4_t t = vaddq_f32(sum, y);
+    comp = vsubq_f32(vsubq_f32(t, sum), y);
+    sum = t;
+}
+
+static inline double compensatedSum(float32x4_t sum, float32x4_t comp)
+{
+    float64x2_t lo = vsubq_f64(vcvt_f64_f32(vget_low_f32(sum)), vcvt_f64_f32(vget_low_f32(comp)));
+    float64x2_t hi = vsubq_f64(vcvt_high_f64_f32(sum), vcvt_high_f64_f32(comp));
+    return vaddvq_f64(vaddq_f64(lo, hi));
+}
+
+template <bool Potential, bool Compensated>
+static void directKernelNeon(const DirectKernelArgs &args, size_t begin, size_t end)
+{
+    const size_t n = args.count;
+    const size_t nVec = n & ~(size_t)3;
+    const float32x4_t eps2 = vdupq_n_f32(args.softening2);
+    const float32x4_t minDist2 = vdupq_n_f32(MIN_DIST2);
+    const uint32_t laneIndex[4] = {0, 1, 2, 3};
+    const uint32x4_t lane = vld1q_u32(laneIndex);
+
+    for (size_t k = begin; k < end; ++k)
+    {
+        const size_t i = args.rows ? args.rows[k] : k;
+        float px, py, pz;
+        const size_t selfIndex = rowPosition(args, i, px, py, pz);
+        const size_t selfBlock = selfIndex & ~(size_t)3;
+        const uint32x4_t self = vceqq_u32(lane, vdupq_n_u32((uint32_t)(selfIndex & 3)));
+        const float32x4_t xi = vdupq_n_f32(px);
+        const float32x4_t yi = vdupq_n_f32(py);
+        const float32x4_t zi = vdupq_n_f32(pz);
+        float32x4_t ax = vdupq_n_f32(0.0f), cx = vdupq_n_f32(0.0f);
+        float32x4_t ay = vdupq_n_f32(0.0f), cy = vdupq_n_f32(0.0f);
+        float32x4_t az = vdupq_n_f32(0.0f), cz = vdupq_n_f32(0.0f);
+        float32x4_t phi = vdupq_n_f32(0.0f), cphi = vdupq_n_f32(0.0f);
+
+        for (size_t j = 0; j < nVec; j += 4)
+        {
+            float32x4_t dx = vsubq_f32(vld1q_f32(args.x + j), xi);
+            float32x4_t dy = vsubq_f32(vld1q_f32(args.y + j), yi);
+            float32x4_t dz = vsubq_f32(vld1q_f32(args.z + j), zi);
+            float32x4_t r2 = vfmaq_f32(vfmaq_f32(vfmaq_f32(eps2, dz, dz), dy, dy), dx, dx);
+
+            // 8-bit rsqrt estimate needs two Newton-Raphson steps for full float precision
+            float32x4_t invR = vrsqrteq_f32(r2);
+            invR = vmulq_f32(invR, vrsqrtsq_f32(vmulq_f32(r2, invR), invR));
+            invR = vmulq_f32(invR, vrsqrtsq_f32(vmulq_f32(r2, invR), invR));
+
+            float32x4_t invR3 = vmulq_f32(invR, vmulq_f32(invR, invR));
+            uint32x4_t valid = vcgtq_f32(r2, minDist2);
+            invR3 = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(invR3), valid));
+            float32x4_t gm = vld1q_f32(args.gm + j);
+            float32x4_t s = vmulq_f32(gm, invR3);
+
+            accumulate<Compensated>(ax, cx, s, dx);
+            accumulate<Compensated>(ay, cy, s, dy);
+            accumulate<Compensated>(az, cz, s, dz);
+            if (Potential)
+            {
+                uint32x4_t keep = j == selfBlock ? vbicq_u32(valid, self) : valid;
+                accumulateNeg<Compensated>(phi, cphi, gm,
+                                           vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(invR), keep)));
+            }
+        }
+
+        if (Compensated)
+            finishRow<Potential>(args, i, nVec, compensatedSum(ax, cx), compensatedSum(ay, cy),
+                                 compensatedSum(az, cz), Potential ? compensatedSum(phi, cphi) : 0.0);
+        else
+            finishRow<Potential>(args, i, nVec, vaddvq_f32(ax), vaddvq_f32(ay), vaddvq_f32(az),
+                                 Potential ? vaddvq_f32(phi) : 0.0f);
+    }
+}
+#endif
+
+// Reproducible kernels give the same bits on every instruction set. Each
+// row is split into the same 16 lanes everywhere (source j always lands in
+// lane j % 16, AVX2 carrying two vectors of lanes and NEON four), and every
+// lane does the same operations: fused multiply-adds, which round once on
+// any hardware, and an exact square root and divide in place of the rsqrt
+// estimate, whose precision differs between instruction sets. The lanes are
+// then reduced by the same fixed pairwise tree. The potential is summed
+// positive, as gm / r = s * r^2, and negated at the end.
+static const size_t LANES = 16;
+
+struct LaneSums
+{
+    float ax[LANES], ay[LANES], az[LANES], psi[LANES];
+    float cx[LANES], cy[LANES], cz[LANES], cpsi[LANES]; // Kahan corrections, zero when uncompensated
+};
+
+// Lane l meets lane l + 8, then l + 4, l + 2 and l + 1
+template <typename Real>
+static inline Real laneTreeSum(const float *sum, const float *comp)
+{
+    Real lanes[LANES];
+    for (size_t l = 0; l < LANES; ++l)
+        lanes[l] = (Real)sum[l] - (Real)comp[l];
+    for (size_t width = LANES / 2; width > 0; width /= 2)
+        for (size_t l = 0; l < width; ++l)
+            lanes[l] += lanes[l + width];
+    return lanes[0];
+}
+
+template <bool Potential, bool Compensated>
+static inline void finishReproducibleRow(const DirectKernelArgs &args, size_t i, size_t jBegin, const LaneSums &sums)
+{
+    typedef typename std::conditional<Compensated, double, float>::type Real;
+    finishRow<Potential>(args, i, jBegin, laneTreeSum<Real>(sums.ax, sums.cx), laneTreeSum<Real>(sums.ay, sums.cy),
+                         laneTreeSum<Real>(sums.az, sums.cz),
+                         Potential ? -laneTreeSum<Real>(sums.psi, sums.cpsi) : Real(0));
+}
+
+// The vector accumulate() in plain floats; fmaf rounds exactly like the
+// vector multiply-adds (in software where the CPU has none)
+template <bool Compensated>
+static inline void accumulate(float &sum, float &comp, float a, float b)
+{
+    if (!Compensated)
+    {
+        sum = fmaf(a, b, sum);
+        return;
+    }
+    float y = fmaf(a, b, -comp);
+    float t = sum + y;
+    comp = (t - sum) - y;
+    sum = t;
+}
+
+template <bool Potential, bool Compensated>
+static void reproducibleKernelScalar(const DirectKernelArgs &args, size_t begin, size_t end)
+{
+    const size_t nVec = args.count & ~(LANES - 1);
+    for (size_t k = begin; k < end; ++k)
+    {
+        const size_t i = args.rows ? args.rows[k] : k;
+        float xi, yi, zi;
+        const size_t self = rowPosition(args, i, xi, yi, zi);
+        LaneSums sums = {};
+
+        for (size_t j = 0; j < nVec; j += LANES)
+            for (size_t l = 0; l < LANES; ++l)
+            {
+                float dx = args.x[j + l] - xi;
+                float dy = args.y[j + l] - yi;
+                float dz = args.z[j + l] - zi;
+                float r2 = fmaf(dx, dx, fmaf(dy, dy, fmaf(dz, dz, args.softening2)));
+                bool valid = r2 > MIN_DIST2;
+                float s = valid ? args.gm[j + l] / (r2 * sqrtf(r2)) : 0.0f;
+                accumulate<Compensated>(sums.ax[l], sums.cx[l], s, dx);
+                accumulate<Compensated>(sums.ay[l], sums.cy[l], s, dy);
+                accumulate<Compensated>(sums.az[l], sums.cz[l], s, dz);
+                if (Potential)
+                    accumulate<Compensated>(sums.psi[l], sums.cpsi[l], j + l != self ? s : 0.0f, r2);
+            }
+
+        finishReproducibleRow<Potential, Compensated>(args, i, nVec, sums);
+    }
+}
+
+#if GRAV_X86
+template <bool Potential, bool Compensated>
+__attribute__((target("avx2,fma"))) static void reproducibleKernelAvx2(const DirectKernelArgs &args, size_t begin,
+                                                                       size_t end)
+{
+    const size_t nVec = args.count & ~(LANES - 1);
+    const __m256 eps2 = _mm256_set1_ps(args.softening2);
+    const __m256 minDist2 = _mm256_set1_ps(MIN_DIST2);
+    const __m256 lane = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+
+    for (size_t k = begin; k < end; ++k)
+    {
+        const size_t i = args.rows ? args.rows[k] : k;
+        float px, py, pz;
+        const size_t self = rowPosition(args, i, px, py, pz);
+        const size_t selfBlock = self & ~(LANES - 1);
+        const __m256 xi = _mm256_set1_ps(px);
+        const __m256 yi = _mm256_set1_ps(py);
+        const __m256 zi = _mm256_set1_ps(pz);
+        // Lanes 0-7 in [0], 8-15 in [1]
+        __m256 notSelf[2], ax[2], ay[2], az[2], psi[2], cx[2], cy[2], cz[2], cpsi[2];
+        for (int h = 0; h < 2; ++h)
+        {
+            notSelf[h] = _mm256_cmp_ps(_mm256_add_ps(lane, _mm256_set1_ps(8.0f * h)),
+                                       _mm256_set1_ps((float)(self & (LANES - 1))), _CMP_NEQ_OQ);
+            ax[h] = ay[h] = az[h] = psi[h] = _mm256_setzero_ps();
+            cx[h] = cy[h] = cz[h] = cpsi[h] = _mm256_setzero_ps();
+        }
+
+        for (size_t j = 0; j < nVec; j += LANES)
+            for (int h = 0; h < 2; ++h)
+            {
+                const size_t jh = j + 8 * h;
+                __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(args.x + jh), xi);
+                __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(args.y + jh), yi);
+                __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(args.z + jh), zi);
+                __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_fmadd_ps(dz, dz, eps2)));
+                __m256 valid = _mm256_cmp_ps(r2, minDist2, _CMP_GT_OQ);
+                __m256 r3 = _mm256_mul_ps(r2, _mm256_sqrt_ps(r2));
+                __m256 s = _mm256_and_ps(_mm256_div_ps(_mm256_loadu_ps(args.gm + jh), r3), valid);
+
+                accumulate<Compensated>(ax[h], cx[h], s, dx);
+                accumulate<Compensated>(ay[h], cy[h], s, dy);
+                accumulate<Compensated>(az[h], cz[h], s, dz);
+                if (Potential)
+                    accumulate<Compensated>(psi[h], cpsi[h], j == selfBlock ? _mm256_and_ps(s, notSelf[h]) : s, r2);
+            }
+
+        LaneSums sums;
+        for (int h = 0; h < 2; ++h)
+        {
+            _mm256_storeu_ps(sums.ax + 8 * h, ax[h]);
+            _mm256_storeu_ps(sums.ay + 8 * h, ay[h]);
+            _mm256_storeu_ps(sums.az + 8 * h, az[h]);
+            _mm256_storeu_ps(sums.psi + 8 * h, psi[h]);
+            _mm256_storeu_ps(sums.cx + 8 * h, cx[h]);
+            _mm256_storeu_ps(sums.cy + 8 * h, cy[h]);
+            _mm256_storeu_ps(sums.cz + 8 * h, cz[h]);
+            _mm256_storeu_ps(sums.cpsi + 8 * h, cpsi[h]);
+        }
+        finishReproducibleRow<Potential, Compensated>(args, i, nVec, sums);
+    }
+}
+
+// Same false positive as directKernelAvx512.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+template <bool Potential, bool Compensated>
+__attribute__((target("avx512f"))) static void reproducibleKernelAvx512(const DirectKernelArgs &args, size_t begin,
+                                                                        size_t end)
+{
+    const size_t nVec = args.count & ~(LANES - 1);
+    const __m512 eps2 = _mm512_set1_ps(args.softening2);
+    const __m512 minDist2 = _mm512_set1_ps(MIN_DIST2);
+
+    for (size_t k = begin; k < end; ++k)
+    {
+        const size_t i = args.rows ? args.rows[k] : k;
+        float px, py, pz;
+        const size_t self = rowPosition(args, i, px, py, pz);
+        const size_t selfBlock = self & ~(LANES - 1);
+        const __mmask16 notSelf = (__mmask16) ~(1u << (self & (LANES - 1)));
+        const __m512 xi = _mm512_set1_ps(px);
+        const __m512 yi = _mm512_set1_ps(py);
+        const __m512 zi = _mm512_set1_ps(pz);
+        __m512 ax = _mm512_setzero_ps(), cx = _mm512_setzero_ps();
+        __m512 ay = _mm512_setzero_ps(), cy = _mm512_setzero_ps();
+        __m512 az = _mm512_setzero_ps(), cz = _mm512_setzero_ps();
+        __m512 psi = _mm512_setzero_ps(), cpsi = _mm512_setzero_ps();
+
+        for (size_t j = 0; j < nVec; j += LANES)
+        {
+            __m512 dx = _mm512_sub_ps(_mm512_loadu_ps(args.x + j), xi);
+            __m512 dy = _mm512_sub_ps(_mm512_loadu_ps(args.y + j), yi);
+            __m512 dz = _mm512_sub_ps(_mm512_loadu_ps(args.z + j), zi);
+            __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_fmadd_ps(dz, dz, eps2)));
+            __mmask16 valid = _mm512_cmp_ps_mask(r2, minDist2, _CMP_GT_OQ);
+            __m512 r3 = _mm512_mul_ps(r2, _mm512_sqrt_ps(r2));
+            __m512 s = _mm512_maskz_div_ps(valid, _mm512_loadu_ps(args.gm + j), r3);
+
+            accumulate<Compensated>(ax, cx, s, dx);
+            accumulate<Compensated>(ay, cy, s, dy);
+            accumulate<Compensated>(az, cz, s, dz);
+            if (Potential)
+                accumulate<Compensated>(psi, cpsi, j == selfBlock ? _mm512_maskz_mov_ps(notSelf, s) : s, r2);
+        }
+
+        LaneSums sums;
+        _mm512_storeu_ps(sums.ax, ax);
+        _mm512_storeu_ps(sums.ay, ay);
+        _mm512_storeu_ps(sums.az, az);
+        _mm512_storeu_ps(sums.psi, psi);
+        _mm512_storeu_ps(sums.cx, cx);
+        _mm512_storeu_ps(sums.cy, cy);
+        _mm512_storeu_ps(sums.cz, cz);
+        _mm512_storeu_ps(sums.cpsi, cpsi);
+        finishReproducibleRow<Potential, Compensated>(args, i, nVec, sums);
+    }
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+#if GRAV_NEON
+template <bool Potential, bool Compensated>
+static void reproducibleKernelNeon(const DirectKernelArgs &args, size_t begin, size_t end)
+{
+    const size_t nVec = args.count & ~(LANES - 1);
+    const float32x4_t eps2 = vdupq_n_f32(args.softening2);
+    const float32x4_t minDist2 = vdupq_n_f32(MIN_DIST2);
+    const uint32_t laneIndex[4] = {0, 1, 2, 3};
+    const uint32x4_t lane = vld1q_u32(laneIndex);
+
+    for (size_t k = begin; k < end; ++k)
+    {
+        const size_t i = args.rows ? args.rows[k] : k;
+        float px, py, pz;
+        const size_t selfIndex = rowPosition(args, i, px, py, pz);
+        const size_t selfBlock = selfIndex & ~(LANES - 1);
+        const float32x4_t xi = vdupq_n_f32(px);
+        const float32x4_t yi = vdupq_n_f32(py);
+        const float32x4_t zi = vdupq_n_f32(pz);
+        // Lanes 4q to 4q + 3 in [q]
+        uint32x4_t self[4];
+        float32x4_t ax[4], ay[4], az[4], psi[4], cx[4], cy[4], cz[4], cpsi[4];
+        for (int q = 0; q < 4; ++q)
+        {
+            self[q] = vceqq_u32(vaddq_u32(lane, vdupq_n_u32(4 * q)), vdupq_n_u32((uint32_t)(selfIndex & (LANES - 1))));
+            ax[q] = ay[q] = az[q] = psi[q] = vdupq_n_f32(0.0f);
+            cx[q] = cy[q] = cz[q] = cpsi[q] = vdupq_n_f32(0.0f);
+        }
+
+        for (size_t j = 0; j < nVec; j += LANES)
+            for (int q = 0; q < 4; ++q)
+            {
+                const size_t jq = j + 4 * q;
+                float32x4_t dx = vsubq_f32(vld1q_f32(args.x + jq), xi);
+                float32x4_t dy = vsubq_f32(vld1q_f32(args.y + jq), yi);
+                float32x4_t dz = vsubq_f32(vld1q_f32(args.z + jq), zi);
+                float32x4_t r2 = vfmaq_f32(vfmaq_f32(vfmaq_f32(eps2, dz, dz), dy, dy), dx, dx);
+                uint32x4_t valid = vcgtq_f32(r2, minDist2);
+                float32x4_t r3 = vmulq_f32(r2, vsqrtq_f32(r2));
+                float32x4_t s = vdivq_f32(vld1q_f32(args.gm + jq), r3);
+                s = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(s), valid));
+
+                accumulate<Compensated>(ax[q], cx[q], s, dx);
+                accumulate<Compensated>(ay[q], cy[q], s, dy);
+                accumulate<Compensated>(az[q], cz[q], s, dz);
+                if (Potential)
+                {
+                    float32x4_t keep =
+                        j == selfBlock ? vreinterpretq_f32_u32(vbicq_u32(vreinterpretq_u32_f32(s), self[q])) : s;
+                    accumulate<Compensated>(psi[q], cpsi[q], keep, r2);
+                }
+            }
+
+        LaneSums sums;
+        for (int q = 0; q < 4; ++q)
+        {
+            vst1q_f32(sums.ax + 4 * q, ax[q]);
+            vst1q_f32(sums.ay + 4 * q, ay[q]);
+            vst1q_f32(sums.az + 4 * q, az[q]);
+            vst1q_f32(sums.psi + 4 * q, psi[q]);
+            vst1q_f32(sums.cx + 4 * q, cx[q]);
+            vst1q_f32(sums.cy + 4 * q, cy[q]);
+            vst1q_f32(sums.cz + 4 * q, cz[q]);
+            vst1q_f32(sums.cpsi + 4 * q, cpsi[q]);
+        }
+        finishReproducibleRow<Potential, Compensated>(args, i, nVec, sums);
+    }
+}
+#endif
+
+KernelIsa detectKernelIsa()
+{
+#if GRAV_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return ISA_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return ISA_AVX2;
+#elif GRAV_NEON
+    return ISA_NEON;
+#endif
+    return ISA_SCALAR;
+}
+
+#define GRAV_SELECT_KERNEL(kernel)                                                                              \
+    (compensated ? (potentials ? kernel<true, true> : kernel<false, true>)                                       \
+                 : (potentials ? kernel<true, false> : kernel<false, false>))
+
+static DirectKernelFn selectReproducibleKernel(KernelIsa isa, bool potentials, bool compensated)
+{
+    switch (isa)
+    {
+#if GRAV_X86
+    case ISA_AVX512:
+        return GRAV_SELECT_KERNEL(reproducibleKernelAvx512);
+    case ISA_AVX2:
+        return GRAV_SELECT_KERNEL(reproducibleKernelAvx2);
+#endif
+#if GRAV_NEON
+    case ISA_NEON:
+        return GRAV_SELECT_KERNEL(reproducibleKernelNeon);
+#endif
+    default:
+        return GRAV_SELECT_KERNEL(reproducibleKernelScalar);
+    }
+}
+
+DirectKernelFn selectDirectKernel(KernelIsa isa, bool potentials, bool compensated, bool reproducible)
+{
+    if (reproducible)
+        return selectReproducibleKernel(isa, potentials, compensated);
+    switch (isa)
+    {
+#if GRAV_X86
+    case ISA_AVX512:
+        return GRAV_SELECT_KERNEL(directKernelAvx512);
+    case ISA_AVX2:
+        return GRAV_SELECT_KERNEL(directKernelAvx2);
+#endif
+#if GRAV_NEON
+    case ISA_NEON:
+        return GRAV_SELECT_KERNEL(directKernelNeon);
+#endif
+    default:
+        return GRAV_SELECT_KERNEL(directKernelScalar);
+    }
+}
+
+#undef GRAV_SELECT_KERNEL
+
+const char *kernelIsaName(KernelIsa isa)
+{
+    switch (isa)
+    {
+    case ISA_AVX2:
+        return "AVX2";
+    case ISA_AVX512:
+        return "AVX-512";
+    case ISA_NEON:
+        return "NEON";
+    default:
+        return "scalar";
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Instruction sets the direct-summation kernel is compiled for
+enum KernelIsa
+{
+    ISA_SCALAR,
+    ISA_AVX2,   // x86-64 AVX2 + FMA
+    ISA_AVX512, // x86-64 AVX-512F
+    ISA_NEON    // arm64 Advanced SIMD
+};
+
+// Inputs for one pass of the float32 pairwise kernel. gm[j] is the
+// pre-scaled mass FORCE_SCALE * m_j so a_i = sum_j gm_j * r_ij / (|r_ij|^2 + eps^2)^1.5
+//
+// x, y, z, gm and count describe the sources. Rows are read from the same
+// arrays unless target* are set, which lets massless test particles feel the
+// sources without being among them.
+struct DirectKernelArgs
+{
+    const float *x;
+    const float *y;
+    const float *z;
+    const float *gm;
+    size_t count;
+    const float *targetX = nullptr; // optional row positions, indexed like accels
+    const float *targetY = nullptr;
+    const float *targetZ = nullptr;
+    const uint32_t *sourceOf = nullptr; // with target*: row -> its source index, UINT32_MAX if none
+    float softening2;              // Plummer softening length squared (pixels^2), 0 disables
+    std::array<float, 3> *accels;  // output, one entry per body
+    const uint32_t *rows;          // optional: entry k of [begin, end) is body rows[k]
+    float *potentials = nullptr;   // output for kernels selected with potentials:
+                                   // phi_i = -sum_j gm_j / (|r_ij|^2 + eps^2)^0.5 (pixels^2 / s^2)
+};
+
+// Computes accels[i] for rows i in [begin, end) against every source
+typedef void (*DirectKernelFn)(const DirectKernelArgs &args, size_t begin, size_t end);
+
+// Best instruction set supported by the CPU we are running on
+KernelIsa detectKernelIsa();
+
+// Kernel for the requested instruction set, falling back to scalar if it
+// was not compiled into this binary. With potentials the kernel also fills
+// args.potentials; accelerations come out bit-identical either way.
+//
+// With compensated the pair math stays float32 but every lane keeps a Kahan
+// correction term and rows are reduced in double, so thousands of small
+// contributions are not lost next to a dominant one. The correction
+// lengthens each sum's dependency chain, so pairs cost up to twice as much.
+//
+// With reproducible every instruction set splits a row into the same 16
+// lanes, does the same arithmetic in every lane (fused multiply-adds, which
+// round once everywhere, an exact square root and divide, and no other
+// product or sum fused), and reduces the lanes in the same fixed order, so
+// accelerations and potentials come out bit-identical whichever kernel runs
+// them. Rows never depend on how they are split between threads in any mode,
+// so this is only for comparing runs across machines: it is opt-in because
+// the exact square root and divide cost 35-60% more per pair than the rsqrt
+// estimate on AVX-512 and 25-50% on AVX2 (force/simd-reproducible against
+// force/simd in grav-bench, 1000 to 10000 bodies), and several times more
+// on the scalar fallback, where fmaf may be a library call.
+DirectKernelFn selectDirectKernel(KernelIsa isa, bool potentials = false, bool compensated = false,
+                                  bool reproducible = false);
+
+const char *kernelIsaName(KernelIsa isa);
@@ -0,0 +1,400 @@
+#include "domain.h"
+#include "profiler.h"
+#include "units.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+typedef std::chrono::steady_clock Clock;
+
+// Morton keys interleave this many bits of each coordinate (63 in all)
+static const int KEY_BITS = 21;
+
+// One body on its way to another rank
+struct PackedBody
+{
+    float x, y, z, vx, vy, vz;
+    float hue[4];
+    double mass, density;
+    uint64_t id, key;
+    int32_t type;
+};
+
+// A point on the curve and the weight of the bodies up to the next one
+struct CurveSample
+{
+    uint64_t key, id;
+    double weight;
+};
+
+static bool curveLess(uint64_t keyA, uint64_t idA, uint64_t keyB, uint64_t idB)
+{
+    return keyA != keyB ? keyA < keyB : idA < idB;
+}
+
+// Spread the low KEY_BITS bits of v so two zero bits follow each one
+static uint64_t spreadBits(uint64_t v)
+{
+    v &= (1ull << KEY_BITS) - 1;
+    v = (v | v << 32) & 0x1f00000000ffffull;
+    v = (v | v << 16) & 0x1f0000ff0000ffull;
+    v = (v | v << 8) & 0x100f00f00f00f00full;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2) & 0x1249249249249249ull;
+    return v;
+}
+
+// Bytes of a vector of plain structs, and back
+template <typename T>
+static void packInto(const std::vector<T> &items, std::vector<char> &bytes)
+{
+    bytes.resize(items.size() * sizeof(T));
+    if (!items.empty())
+        std::memcpy(bytes.data(), items.data(), bytes.size());
+}
+
+template <typename T>
+static void unpackAppend(const std::vector<char> &bytes, std::vector<T> &items)
+{
+    size_t count = bytes.size() / sizeof(T);
+    size_t first = items.size();
+    items.resize(first + count);
+    if (count > 0)
+        std::memcpy(&items[first], bytes.data(), count * sizeof(T));
+}
+
+static PackedBody packBody(const BodyStore &bodies, size_t i, uint64_t id, uint64_t key)
+{
+    PackedBody b;
+    b.x = bodies.x[i];
+    b.y = bodies.y[i];
+    b.z = bodies.z[i];
+    b.vx = bodies.vx[i];
+    b.vy = bodies.vy[i];
+    b.vz = bodies.vz[i];
+    for (int k = 0; k < 4; ++k)
+        b.hue[k] = bodies.hue[i][k];
+    b.mass = bodies.mass[i];
+    b.density = bodies.density[i];
+    b.id = id;
+    b.key = key;
+    b.type = (int32_t)bodies.type[i];
+    return b;
+}
+
+static void unpackBody(const PackedBody &b, BodyStore &bodies, size_t i)
+{
+    bodies.x[i] = b.x;
+    bodies.y[i] = b.y;
+    bodies.z[i] = b.z;
+    bodies.vx[i] = b.vx;
+    bodies.vy[i] = b.vy;
+    bodies.vz[i] = b.vz;
+    bodies.hue[i] = {b.hue[0], b.hue[1], b.hue[2], b.hue[3]};
+    bodies.mass[i] = b.mass;
+    bodies.density[i] = b.density;
+    bodies.type[i] = (CelestialType)b.type;
+}
+
+bool DomainDecomposition::Adopt(BodyStore &bodies, uint64_t firstId)
+{
+    ids.resize(bodies.Size());
+    for (size_t i = 0; i < ids.size(); ++i)
+        ids[i] = firstId + i;
+    return Rebalance(bodies, 1.0);
+}
+
+bool DomainDecomposition::Rebalance(BodyStore &bodies, double bodyWeight)
+{
+    PROFILE_SCOPE("rebalance");
+    const int size = transport.Size();
+    const size_t n = bodies.Size();
+
+    // Bounding box of the whole system; maxima go in negated so one
+    // minimum reduction finds both
+    double box[6];
+    for (int k = 0; k < 6; ++k)
+        box[k] = std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < n; ++i)
+    {
+        const double p[3] = {bodies.x[i], bodies.y[i], bodies.z[i]};
+        for (int k = 0; k < 3; ++k)
+        {
+            box[k] = std::min(box[k], p[k]);
+            box[3 + k] = std::min(box[3 + k], -p[k]);
+        }
+    }
+    if (!allReduce(transport, box, 6, REDUCE_MIN))
+    {
+        failed = true;
+        return false;
+    }
+
+    double lo[3], cellsPer[3];
+    for (int k = 0; k < 3; ++k)
+    {
+        lo[k] = box[k];
+        double extent = -box[3 + k] - box[k];
+        cellsPer[k] = extent > 0.0 ? ((1 << KEY_BITS) - 1) / extent : 0.0;
+    }
+
+    std::vector<uint64_t> keys(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        const double p[3] = {bodies.x[i], bodies.y[i], bodies.z[i]};
+        uint64_t key = 0;
+        for (int k = 0; k < 3; ++k)
+            key |= spreadBits((uint64_t)((p[k] - lo[k]) * cellsPer[k])) << (2 - k);
+        keys[i] = key;
+    }
+    std::vector<uint32_t> order(n);
+    for (size_t i = 0; i < n; ++i)
+        order[i] = (uint32_t)i;
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+              { return curveLess(keys[a], ids[a], keys[b], ids[b]); });
+
+    // Every rank describes its stretch of the curve with evenly spaced
+    // samples; all ranks then cut the merged list at the same places
+    const size_t perRank = std::max<size_t>(64, 16 * (size_t)size);
+    std::vector<CurveSample> samples;
+    for (size_t s = 0; s < perRank && s < n; ++s)
+    {
+        size_t first = s * n / std::min(perRank, n);
+        size_t last = (s + 1) * n / std::min(perRank, n);
+        uint32_t i = order[first];
+        samples.push_back({keys[i], ids[i], bodyWeight * (double)(last - first)});
+    }
+    std::vector<char> bytes;
+    packInto(samples, bytes);
+    std::vector<std::vector<char>> all;
+    if (!allGather(transport, bytes.data(), bytes.size(), all))
+    {
+        failed = true;
+        return false;
+    }
+    samples.clear();
+    for (const std::vector<char> &from : all)
+        unpackAppend(from, samples);
+    std::sort(samples.begin(), samples.end(), [](const CurveSample &a, const CurveSample &b)
+              { return curveLess(a.key, a.id, b.key, b.id); });
+
+    double total = 0.0;
+    for (const CurveSample &s : samples)
+        total += s.weight;
+    std::vector<CurveSample> cuts; // rank r starts at cuts[r - 1]
+    double before = 0.0;
+    for (const CurveSample &s : samples)
+    {
+        while ((int)cuts.size() < size - 1 && before >= total * (cuts.size() + 1) / size)
+            cuts.push_back(s);
+        before += s.weight;
+    }
+    while ((int)cuts.size() < size - 1)
+        cuts.push_back({UINT64_MAX, UINT64_MAX, 0.0});
+
+    // Send every body to the rank whose stretch holds it
+    std::vector<std::vector<PackedBody>> leaving(size);
+    for (uint32_t i : order)
+    {
+        int to = 0;
+        while (to < size - 1 && !curveLess(keys[i], ids[i], cuts[to].key, cuts[to].id))
+            ++to;
+        leaving[to].push_back(packBody(bodies, i, ids[i], keys[i]));
+    }
+    std::vector<std::vector<char>> outgoing(size), incoming;
+    for (int r = 0; r < size; ++r)
+        packInto(leaving[r], outgoing[r]);
+    leaving.clear();
+    if (!allToAll(transport, outgoing, incoming))
+    {
+        failed = true;
+        return false;
+    }
+    outgoing.clear();
+
+    std::vector<PackedBody> arrived;
+    for (const std::vector<char> &from : incoming)
+        unpackAppend(from, arrived);
+    std::sort(arrived.begin(), arrived.end(), [](const PackedBody &a, const PackedBody &b)
+              { return curveLess(a.key, a.id, b.key, b.id); });
+
+    bodies.Resize(arrived.size());
+    ids.resize(arrived.size());
+    for (size_t i = 0; i < arrived.size(); ++i)
+    {
+        unpackBody(arrived[i], bodies, i);
+        ids[i] = arrived[i].id;
+    }
+    return true;
+}
+
+bool DomainDecomposition::AfterStep(BodyStore &bodies, double seconds)
+{
+    // Time spent waiting on the other ranks is not this rank's load
+    work += std::max(0.0, seconds - (exchangeSeconds - exchangeAtStep));
+    exchangeAtStep = exchangeSeconds;
+    if (failed || settings.rebalanceEvery == 0 || ++stepsSinceCheck < settings.rebalanceEvery)
+        return false;
+
+    std::vector<std::vector<char>> all;
+    if (!allGather(transport, &work, sizeof(work), all))
+    {
+        failed = true;
+        return false;
+    }
+    double busiest = 0.0, sum = 0.0;
+    for (const std::vector<char> &from : all)
+    {
+        double w;
+        std::memcpy(&w, from.data(), sizeof(w));
+        busiest = std::max(busiest, w);
+        sum += w;
+    }
+    const double mean = sum / all.size();
+    imbalance = mean > 0.0 ? busiest / mean - 1.0 : 0.0;
+
+    // Each local body is charged an even share of this rank's work
+    const double bodyWeight = bodies.Size() > 0 ? work / bodies.Size() : 0.0;
+    work = 0.0;
+    stepsSinceCheck = 0;
+    if (imbalance <= settings.imbalanceTolerance)
+        return false;
+
+    Clock::time_point start = Clock::now();
+    bool moved = Rebalance(bodies, bodyWeight);
+    // Moving bodies is exchange time too, but it falls outside the step
+    exchangeSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+    exchangeAtStep = exchangeSeconds;
+    rebalances += moved;
+    return moved;
+}
+
+bool DomainDecomposition::Gather(const BodyStore &bodies, BodyStore &all)
+{
+    const int size = transport.Size();
+    std::vector<PackedBody> mine(bodies.Size());
+    for (size_t i = 0; i < mine.size(); ++i)
+        mine[i] = packBody(bodies, i, ids[i], 0);
+
+    std::vector<std::vector<char>> outgoing(size), incoming;
+    packInto(mine, outgoing[0]);
+    mine.clear();
+    if (!allToAll(transport, outgoing, incoming))
+    {
+        failed = true;
+        return false;
+    }
+
+    all.Clear();
+    if (transport.Rank() != 0)
+        return true;
+    all.origin = bodies.origin; // shared by every rank
+
+    std::vector<PackedBody> arrived;
+    for (const std::vector<char> &from : incoming)
+        unpackAppend(from, arrived);
+    all.Resize(arrived.size());
+    for (const PackedBody &b : arrived)
+    {
+        if (b.id >= arrived.size())
+        {
+            fprintf(stderr, "Body %llu is out of range of the %zu gathered\n", (unsigned long long)b.id,
+                    arrived.size());
+            return false;
+        }
+        unpackBody(b, all, (size_t)b.id);
+    }
+    return true;
+}
+
+void DomainDecomposition::Refresh(const BodyStore &bodies, const ForceSettings &forces)
+{
+    PROFILE_SCOPE("domain exchange");
+    Clock::time_point start = Clock::now();
+    x.clear();
+    y.clear();
+    z.clear();
+    mass.clear();
+    if (failed)
+        return;
+
+    const int size = transport.Size();
+    const int rank = transport.Rank();
+    const size_t n = bodies.Size();
+
+    // Every rank's box; an empty rank's box is inside out and needs nothing
+    float box[6] = {INFINITY, INFINITY, INFINITY, -INFINITY, -INFINITY, -INFINITY};
+    for (size_t i = 0; i < n; ++i)
+    {
+        const float p[3] = {bodies.x[i], bodies.y[i], bodies.z[i]};
+        for (int k = 0; k < 3; ++k)
+        {
+            box[k] = std::min(box[k], p[k]);
+            box[3 + k] = std::max(box[3 + k], p[k]);
+        }
+    }
+    std::vector<std::vector<char>> boxes;
+    if (!allGather(transport, box, sizeof(box), boxes))
+    {
+        failed = true;
+        return;
+    }
+
+    exportX.clear();
+    exportY.clear();
+    exportZ.clear();
+    exportGm.clear();
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (bodies.mass[i] <= 0.0)
+            continue;
+        exportX.push_back(bodies.x[i]);
+        exportY.push_back(bodies.y[i]);
+        exportZ.push_back(bodies.z[i]);
+        exportGm.push_back(FORCE_SCALE * bodies.mass[i]);
+    }
+    if (forces.solver == BARNES_HUT)
+        exportTree.Build(exportX.data(), exportY.data(), exportZ.data(), exportGm.data(), exportGm.size());
+
+    std::vector<std::vector<char>> outgoing(size), incoming;
+    std::vector<Octree::PointMass> points;
+    for (int r = 0; r < size; ++r)
+    {
+        float other[6];
+        std::memcpy(other, boxes[r].data(), sizeof(other));
+        if (r == rank || !(other[0] <= other[3]))
+            continue;
+        points.clear();
+        if (forces.solver == BARNES_HUT)
+            exportTree.ExportEssential(other, other + 3, forces.theta, points);
+        else
+            for (size_t k = 0; k < exportGm.size(); ++k)
+                points.push_back({exportX[k], exportY[k], exportZ[k], exportGm[k]});
+        packInto(points, outgoing[r]);
+    }
+    if (!allToAll(transport, outgoing, incoming))
+    {
+        failed = true;
+        return;
+    }
+
+    for (int r = 0; r < size; ++r)
+    {
+        if (r == rank)
+            continue;
+        points.clear();
+        unpackAppend(incoming[r], points);
+        for (const Octree::PointMass &p : points)
+        {
+            x.push_back(p.x);
+            y.push_back(p.y);
+            z.push_back(p.z);
+            mass.push_back(p.gm / FORCE_SCALE);
+        }
+    }
+    exchangeSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "bodies.h"
+#include "octree.h"
+#include "physics.h"
+#include "transport.h"
+
+struct DomainSettings
+{
+    unsigned rebalanceEvery = 10;    // steps between load checks, 0 keeps the first split for the whole run
+    double imbalanceTolerance = 0.1; // rebalance when the busiest rank does this fraction more work than the mean
+};
+
+// One process's share of a system split across several processes.
+//
+// Bodies are ordered along a Morton (Z-order) curve through the bounding
+// box of the whole system and the curve is cut into one contiguous piece
+// per rank, so every rank owns a compact region of space. The cuts sit at
+// quantiles of measured work rather than of body count: the rank that
+// spent longest on its steps hands bodies to its neighbours.
+//
+// As the solver's remote sources it supplies what the other ranks'
+// bodies contribute at the start of every force pass: for Barnes-Hut the
+// cells of their trees that any walk from this rank's box would accept
+// whole (a locally essential tree), for the direct solvers every body.
+class DomainDecomposition : public RemoteSources
+{
+public:
+    DomainSettings settings;
+
+    explicit DomainDecomposition(Transport &transport) : transport(transport) {}
+
+    // Take bodies, this rank's slice of the system starting at global index
+    // firstId, and make the first split by body count. Every rank calls it.
+    bool Adopt(BodyStore &bodies, uint64_t firstId);
+
+    // Every rank calls this after every step with the wall-clock seconds the
+    // step took. True when bodies moved between ranks: forces the
+    // integrator cached belong to the old order (Integrator::Reset()).
+    bool AfterStep(BodyStore &bodies, double seconds);
+
+    // Rank 0 receives every body in global index order; the others get an
+    // empty store
+    bool Gather(const BodyStore &bodies, BodyStore &all);
+
+    void Refresh(const BodyStore &bodies, const ForceSettings &forces);
+
+    // A message could not be exchanged; the run cannot continue
+    bool Failed() const { return failed; }
+
+    // Busiest rank's work over the mean, minus one, at the last load check
+    double Imbalance() const { return imbalance; }
+    unsigned Rebalances() const { return rebalances; }
+
+    // Seconds this rank spent exchanging sources during force passes
+    double ExchangeSeconds() const { return exchangeSeconds; }
+
+    std::vector<uint64_t> ids; // global index of each local body
+
+private:
+    // Recut the curve so every rank gets an equal share of weight, each
+    // local body weighing bodyWeight, and move the bodies
+    bool Rebalance(BodyStore &bodies, double bodyWeight);
+
+    Transport &transport;
+    Octree exportTree; // local massive bodies, for the essential trees of the other ranks
+    std::vector<float> exportX, exportY, exportZ;
+    std::vector<double> exportGm;
+
+    bool failed = false;
+    double imbalance = 0.0;
+    unsigned rebalances = 0;
+    double exchangeSeconds = 0.0;
+    double exchangeAtStep = 0.0; // exchangeSeconds when the current step began
+    double work = 0.0;           // seconds of computation since the last load check
+    unsigned stepsSinceCheck = 0;
+};
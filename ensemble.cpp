@@ -0,0 +1,579 @@
+#include "ensemble.h"
+#include "profiler.h"
+#include "units.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+#include "simd_config.h"
+
+// Members per block: the widest vector (AVX-512, 8 doubles). A block is the
+// unit of work for one task and what member counts are padded to.
+static const size_t BLOCK = 8;
+
+// Pairs closer than 1e-3 pixels are skipped, as in the other solvers
+static const double MIN_DIST2 = 1e-6;
+
+// Inputs for one force pass over a range of members
+struct EnsembleForceArgs
+{
+    const double *x, *y, *z, *gm;
+    double *ax, *ay, *az;
+    size_t bodies;
+    size_t stride;
+    double softening2;
+};
+
+typedef void (*EnsembleForceFn)(const EnsembleForceArgs &args, size_t begin, size_t end);
+
+// Every pair is visited once and acts on both bodies. All kernels evaluate
+// the same expressions in the same order without fused multiply-adds, so a
+// member's trajectory does not depend on the lane or instruction set.
+static void forcesScalar(const EnsembleForceArgs &args, size_t begin, size_t end)
+{
+    const size_t n = args.bodies;
+    const size_t s = args.stride;
+    for (size_t m = begin; m < end; ++m)
+    {
+        for (size_t i = 0; i < n; ++i)
+            args.ax[i * s + m] = args.ay[i * s + m] = args.az[i * s + m] = 0.0;
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            const size_t a = i * s + m;
+            double axi = args.ax[a], ayi = args.ay[a], azi = args.az[a];
+            for (size_t j = i + 1; j < n; ++j)
+            {
+                const size_t b = j * s + m;
+                double dx = args.x[b] - args.x[a];
+                double dy = args.y[b] - args.y[a];
+                double dz = args.z[b] - args.z[a];
+                double r2 = dx * dx + dy * dy + dz * dz;
+                double invR = 1.0 / sqrt(r2 + args.softening2);
+                double invR3 = r2 > MIN_DIST2 ? invR * (invR * invR) : 0.0;
+
+                double si = args.gm[b] * invR3;
+                double sj = args.gm[a] * invR3;
+                axi = axi + si * dx;
+                ayi = ayi + si * dy;
+                azi = azi + si * dz;
+                args.ax[b] = args.ax[b] - sj * dx;
+                args.ay[b] = args.ay[b] - sj * dy;
+                args.az[b] = args.az[b] - sj * dz;
+            }
+            args.ax[a] = axi;
+            args.ay[a] = ayi;
+            args.az[a] = azi;
+        }
+    }
+}
+
+#if GRAV_X86
+__attribute__((target("avx2"))) static void forcesAvx2(const EnsembleForceArgs &args, size_t begin, size_t end)
+{
+    const size_t n = args.bodies;
+    const size_t s = args.stride;
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d eps2 = _mm256_set1_pd(args.softening2);
+    const __m256d minDist2 = _mm256_set1_pd(MIN_DIST2);
+    for (size_t m = begin; m < end; m += 4)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            _mm256_storeu_pd(args.ax + i * s + m, _mm256_setzero_pd());
+            _mm256_storeu_pd(args.ay + i * s + m, _mm256_setzero_pd());
+            _mm256_storeu_pd(args.az + i * s + m, _mm256_setzero_pd());
+        }
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            const size_t a = i * s + m;
+            const __m256d xi = _mm256_loadu_pd(args.x + a);
+            const __m256d yi = _mm256_loadu_pd(args.y + a);
+            const __m256d zi = _mm256_loadu_pd(args.z + a);
+            const __m256d gmi = _mm256_loadu_pd(args.gm + a);
+            __m256d axi = _mm256_loadu_pd(args.ax + a);
+            __m256d ayi = _mm256_loadu_pd(args.ay + a);
+            __m256d azi = _mm256_loadu_pd(args.az + a);
+            for (size_t j = i + 1; j < n; ++j)
+            {
+                const size_t b = j * s + m;
+                __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(args.x + b), xi);
+                __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(args.y + b), yi);
+                __m256d dz = _mm256_sub_pd(_mm256_loadu_pd(args.z + b), zi);
+                __m256d r2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)),
+                                           _mm256_mul_pd(dz, dz));
+                __m256d invR = _mm256_div_pd(one, _mm256_sqrt_pd(_mm256_add_pd(r2, eps2)));
+                __m256d invR3 = _mm256_mul_pd(invR, _mm256_mul_pd(invR, invR));
+                invR3 = _mm256_and_pd(invR3, _mm256_cmp_pd(r2, minDist2, _CMP_GT_OQ));
+
+                __m256d si = _mm256_mul_pd(_mm256_loadu_pd(args.gm + b), invR3);
+                __m256d sj = _mm256_mul_pd(gmi, invR3);
+                axi = _mm256_add_pd(axi, _mm256_mul_pd(si, dx));
+                ayi = _mm256_add_pd(ayi, _mm256_mul_pd(si, dy));
+                azi = _mm256_add_pd(azi, _mm256_mul_pd(si, dz));
+                _mm256_storeu_pd(args.ax + b, _mm256_sub_pd(_mm256_loadu_pd(args.ax + b), _mm256_mul_pd(sj, dx)));
+                _mm256_storeu_pd(args.ay + b, _mm256_sub_pd(_mm256_loadu_pd(args.ay + b), _mm256_mul_pd(sj, dy)));
+                _mm256_storeu_pd(args.az + b, _mm256_sub_pd(_mm256_loadu_pd(args.az + b), _mm256_mul_pd(sj, dz)));
+            }
+            _mm256_storeu_pd(args.ax + a, axi);
+            _mm256_storeu_pd(args.ay + a, ayi);
+            _mm256_storeu_pd(args.az + a, azi);
+        }
+    }
+}
+
+// GCC's AVX-512 headers seed intrinsics with self-initialized undefined
+// vectors, which -Wmaybe-uninitialized reports once they inline here.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+__attribute__((target("avx512f"))) static void forcesAvx512(const EnsembleForceArgs &args, size_t begin, size_t end)
+{
+    const size_t n = args.bodies;
+    const size_t s = args.stride;
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m512d eps2 = _mm512_set1_pd(args.softening2);
+    const __m512d minDist2 = _mm512_set1_pd(MIN_DIST2);
+    for (size_t m = begin; m < end; m += 8)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            _mm512_storeu_pd(args.ax + i * s + m, _mm512_setzero_pd());
+            _mm512_storeu_pd(args.ay + i * s + m, _mm512_setzero_pd());
+            _mm512_storeu_pd(args.az + i * s + m, _mm512_setzero_pd());
+        }
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            const size_t a = i * s + m;
+            const __m512d xi = _mm512_loadu_pd(args.x + a);
+            const __m512d yi = _mm512_loadu_pd(args.y + a);
+            const __m512d zi = _mm512_loadu_pd(args.z + a);
+            const __m512d gmi = _mm512_loadu_pd(args.gm + a);
+            __m512d axi = _mm512_loadu_pd(args.ax + a);
+            __m512d ayi = _mm512_loadu_pd(args.ay + a);
+            __m512d azi = _mm512_loadu_pd(args.az + a);
+            for (size_t j = i + 1; j < n; ++j)
+            {
+                const size_t b = j * s + m;
+                __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(args.x + b), xi);
+                __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(args.y + b), yi);
+                __m512d dz = _mm512_sub_pd(_mm512_loadu_pd(args.z + b), zi);
+                __m512d r2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)),
+                                           _mm512_mul_pd(dz, dz));
+                __m512d invR = _mm512_div_pd(one, _mm512_sqrt_pd(_mm512_add_pd(r2, eps2)));
+                __mmask8 valid = _mm512_cmp_pd_mask(r2, minDist2, _CMP_GT_OQ);
+                __m512d invR3 = _mm512_maskz_mul_pd(valid, invR, _mm512_mul_pd(invR, invR));
+
+                __m512d si = _mm512_mul_pd(_mm512_loadu_pd(args.gm + b), invR3);
+                __m512d sj = _mm512_mul_pd(gmi, invR3);
+                axi = _mm512_add_pd(axi, _mm512_mul_pd(si, dx));
+                ayi = _mm512_add_pd(ayi, _mm512_mul_pd(si, dy));
+                azi = _mm512_add_pd(azi, _mm512_mul_pd(si, dz));
+                _mm512_storeu_pd(args.ax + b, _mm512_sub_pd(_mm512_loadu_pd(args.ax + b), _mm512_mul_pd(sj, dx)));
+                _mm512_storeu_pd(args.ay + b, _mm512_sub_pd(_mm512_loadu_pd(args.ay + b), _mm512_mul_pd(sj, dy)));
+                _mm512_storeu_pd(args.az + b, _mm512_sub_pd(_mm512_loadu_pd(args.az + b), _mm512_mul_pd(sj, dz)));
+            }
+            _mm512_storeu_pd(args.ax + a, axi);
+            _mm512_storeu_pd(args.ay + a, ayi);
+            _mm512_storeu_pd(args.az + a, azi);
+        }
+    }
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+#if GRAV_NEON
+static void forcesNeon(const EnsembleForceArgs &args, size_t begin, size_t end)
+{
+    const size_t n = args.bodies;
+    const size_t s = args.stride;
+    const float64x2_t eps2 = vdupq_n_f64(args.softening2);
+    const float64x2_t minDist2 = vdupq_n_f64(MIN_DIST2);
+    for (size_t m = begin; m < end; m += 2)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            vst1q_f64(args.ax + i * s + m, vdupq_n_f64(0.0));
+            vst1q_f64(args.ay + i * s + m, vdupq_n_f64(0.0));
+            vst1q_f64(args.az + i * s + m, vdupq_n_f64(0.0));
+        }
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            const size_t a = i * s + m;
+            const float64x2_t xi = vld1q_f64(args.x + a);
+            const float64x2_t yi = vld1q_f64(args.y + a);
+            const float64x2_t zi = vld1q_f64(args.z + a);
+            const float64x2_t gmi = vld1q_f64(args.gm + a);
+            float64x2_t axi = vld1q_f64(args.ax + a);
+            float64x2_t ayi = vld1q_f64(args.ay + a);
+            float64x2_t azi = vld1q_f64(args.az + a);
+            for (size_t j = i + 1; j < n; ++j)
+            {
+                const size_t b = j * s + m;
+                float64x2_t dx = vsubq_f64(vld1q_f64(args.x + b), xi);
+                float64x2_t dy = vsubq_f64(vld1q_f64(args.y + b), yi);
+                float64x2_t dz = vsubq_f64(vld1q_f64(args.z + b), zi);
+                float64x2_t r2 = vaddq_f64(vaddq_f64(vmulq_f64(dx, dx), vmulq_f64(dy, dy)), vmulq_f64(dz, dz));
+                float64x2_t invR = vdivq_f64(vdupq_n_f64(1.0), vsqrtq_f64(vaddq_f64(r2, eps2)));
+                float64x2_t invR3 = vmulq_f64(invR, vmulq_f64(invR, invR));
+                invR3 = vreinterpretq_f64_u64(vandq_u64(vreinterpretq_u64_f64(invR3), vcgtq_f64(r2, minDist2)));
+
+                float64x2_t si = vmulq_f64(vld1q_f64(args.gm + b), invR3);
+                float64x2_t sj = vmulq_f64(gmi, invR3);
+                axi = vaddq_f64(axi, vmulq_f64(si, dx));
+                ayi = vaddq_f64(ayi, vmulq_f64(si, dy));
+                azi = vaddq_f64(azi, vmulq_f64(si, dz));
+                vst1q_f64(args.ax + b, vsubq_f64(vld1q_f64(args.ax + b), vmulq_f64(sj, dx)));
+                vst1q_f64(args.ay + b, vsubq_f64(vld1q_f64(args.ay + b), vmulq_f64(sj, dy)));
+                vst1q_f64(args.az + b, vsubq_f64(vld1q_f64(args.az + b), vmulq_f64(sj, dz)));
+            }
+            vst1q_f64(args.ax + a, axi);
+            vst1q_f64(args.ay + a, ayi);
+            vst1q_f64(args.az + a, azi);
+        }
+    }
+}
+#endif
+
+static EnsembleForceFn selectEnsembleKernel(KernelIsa isa)
+{
+    switch (isa)
+    {
+#if GRAV_X86
+    case ISA_AVX512:
+        return forcesAvx512;
+    case ISA_AVX2:
+        return forcesAvx2;
+#endif
+#if GRAV_NEON
+    case ISA_NEON:
+        return forcesNeon;
+#endif
+    default:
+        return forcesScalar;
+    }
+}
+
+// Rotate v by angle about the unit vector axis (Rodrigues' formula)
+static void rotate(double v[3], const double axis[3], double angle)
+{
+    const double c = cos(angle), s = sin(angle);
+    const double dot = axis[0] * v[0] + axis[1] * v[1] + axis[2] * v[2];
+    const double cross[3] = {axis[1] * v[2] - axis[2] * v[1], axis[2] * v[0] - axis[0] * v[2],
+                             axis[0] * v[1] - axis[1] * v[0]};
+    for (int k = 0; k < 3; ++k)
+        v[k] = v[k] * c + cross[k] * s + axis[k] * dot * (1.0 - c);
+}
+
+void makeSweep(const BodyStore &base, const SweepSettings &settings, std::vector<BodyStore> &members,
+               std::vector<SweepMember> &parameters)
+{
+    members.assign(settings.members, base);
+    parameters.assign(settings.members, SweepMember());
+    if (base.Size() == 0)
+        return;
+
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    const double maxTilt = settings.inclinationJitter * M_PI / 180.0;
+    for (size_t m = 0; m < settings.members; ++m)
+    {
+        // Each member draws from its own stream, so member m is the same
+        // whatever the sweep size
+        std::seed_seq seeds{settings.seed, (unsigned)m};
+        std::mt19937 rng(seeds);
+        BodyStore &bodies = members[m];
+        const double p0[3] = {bodies.x[0], bodies.y[0], bodies.z[0]};
+        const double v0[3] = {bodies.vx[0], bodies.vy[0], bodies.vz[0]};
+
+        for (size_t i = 1; i < bodies.Size(); ++i)
+        {
+            if (settings.massJitter > 0.0)
+                bodies.mass[i] *= 1.0 + settings.massJitter * (2.0 * unit(rng) - 1.0);
+            if (maxTilt > 0.0)
+            {
+                // Tilt about a random line of nodes through body 0
+                double node = 2.0 * M_PI * unit(rng);
+                double tilt = maxTilt * (2.0 * unit(rng) - 1.0);
+                const double axis[3] = {cos(node), sin(node), 0.0};
+                double r[3] = {bodies.x[i] - p0[0], bodies.y[i] - p0[1], bodies.z[i] - p0[2]};
+                double v[3] = {bodies.vx[i] - v0[0], bodies.vy[i] - v0[1], bodies.vz[i] - v0[2]};
+                rotate(r, axis, tilt);
+                rotate(v, axis, tilt);
+                bodies.x[i] = (float)(p0[0] + r[0]);
+                bodies.y[i] = (float)(p0[1] + r[1]);
+                bodies.z[i] = (float)(p0[2] + r[2]);
+                bodies.vx[i] = (float)(v0[0] + v[0]);
+                bodies.vy[i] = (float)(v0[1] + v[1]);
+                bodies.vz[i] = (float)(v0[2] + v[2]);
+            }
+        }
+
+        if (settings.perturberMass > 0.0)
+        {
+            // Parabolic orbit about body 0 from a random direction: at
+            // distance d the speed is sqrt(2 mu / d), and the angular
+            // momentum sqrt(2 mu q) fixes its tangential part
+            double q = settings.perturberPeriapsisMin +
+                       (settings.perturberPeriapsisMax - settings.perturberPeriapsisMin) * unit(rng);
+            double d = settings.perturberDistance;
+            double mu = FORCE_SCALE * (bodies.mass[0] + settings.perturberMass);
+            double cosTheta = 2.0 * unit(rng) - 1.0;
+            double sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+            double phi = 2.0 * M_PI * unit(rng);
+            const double radial[3] = {sinTheta * cos(phi), sinTheta * sin(phi), cosTheta};
+            const double east[3] = {-sin(phi), cos(phi), 0.0};
+            const double north[3] = {-cosTheta * cos(phi), -cosTheta * sin(phi), sinTheta};
+            double heading = 2.0 * M_PI * unit(rng);
+
+            double speed2 = 2.0 * mu / d;
+            double vt = sqrt(2.0 * mu * q) / d;
+            double vr = -sqrt(std::max(0.0, speed2 - vt * vt));
+            double p[3], v[3];
+            for (int k = 0; k < 3; ++k)
+            {
+                double tangent = east[k] * cos(heading) + north[k] * sin(heading);
+                p[k] = p0[k] + radial[k] * d;
+                v[k] = v0[k] + radial[k] * vr + tangent * vt;
+            }
+            bodies.Add((float)p[0], (float)p[1], (float)p[2], (float)v[0], (float)v[1], (float)v[2],
+                       settings.perturberMass, {{0.9f, 0.35f, 0.3f, 1.0f}});
+            parameters[m].perturberPeriapsis = q;
+        }
+    }
+}
+
+bool parsePerturberSpec(const char *spec, SweepSettings &settings)
+{
+    double mass, qMin, qMax, distance;
+    if (std::sscanf(spec, "%lf:%lf:%lf:%lf", &mass, &qMin, &qMax, &distance) != 4 || mass <= 0.0 || qMin < 0.0 ||
+        qMax < qMin || distance <= qMax)
+        return false;
+    settings.perturberMass = mass;
+    settings.perturberPeriapsisMin = qMin;
+    settings.perturberPeriapsisMax = qMax;
+    settings.perturberDistance = distance;
+    return true;
+}
+
+bool Ensemble::Load(const std::vector<BodyStore> &members)
+{
+    if (members.empty())
+    {
+        fprintf(stderr, "Ensemble has no members\n");
+        return false;
+    }
+    const size_t n = members[0].Size();
+    for (size_t m = 1; m < members.size(); ++m)
+    {
+        if (members[m].Size() != n)
+        {
+            fprintf(stderr, "Ensemble member %zu has %zu bodies, member 0 has %zu\n", m, members[m].Size(), n);
+            return false;
+        }
+    }
+
+    memberCount = members.size();
+    bodyCount = n;
+    stride = (memberCount + BLOCK - 1) / BLOCK * BLOCK;
+    AlignedVector<double> *columns[] = {&x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az, &gm};
+    for (AlignedVector<double> *column : columns)
+        column->assign(n * stride, 0.0);
+
+    // Padding lanes repeat member 0 so they stay finite; nothing reads them back
+    for (size_t m = 0; m < stride; ++m)
+    {
+        const BodyStore &bodies = members[m < memberCount ? m : 0];
+        for (size_t i = 0; i < n; ++i)
+        {
+            const size_t k = i * stride + m;
+            x[k] = bodies.x[i];
+            y[k] = bodies.y[i];
+            z[k] = bodies.z[i];
+            vx[k] = bodies.vx[i];
+            vy[k] = bodies.vy[i];
+            vz[k] = bodies.vz[i];
+            gm[k] = FORCE_SCALE * bodies.mass[i];
+        }
+    }
+
+    layout = members[0];
+    haveForces = false;
+    haveReferences = false;
+    diagnostics.assign(memberCount, EnsembleDiagnostics());
+    references.resize(memberCount);
+    bound.assign(bodyCount * stride, 0);
+    memberSteps = 0;
+    return true;
+}
+
+void Ensemble::Advance(double timestep, unsigned long long steps)
+{
+    PROFILE_SCOPE("ensemble");
+    if (memberCount == 0 || steps == 0)
+        return;
+
+    const EnsembleForceArgs args = {x.data(), y.data(), z.data(), gm.data(), ax.data(), ay.data(), az.data(),
+                                    bodyCount, stride, (double)softening * softening};
+    const EnsembleForceFn forces = selectEnsembleKernel(isa);
+    const double halfStep = 0.5 * timestep;
+    const bool needForces = !haveForces;
+
+    // Each block runs every step before the next block starts; the block's
+    // columns are a few kilobytes, so they stay in L1 throughout
+    auto run = [&](size_t blockBegin, size_t blockEnd)
+    {
+        for (size_t block = blockBegin; block < blockEnd; ++block)
+        {
+            const size_t begin = block * BLOCK;
+            const size_t end = begin + BLOCK;
+            if (needForces)
+                forces(args, begin, end);
+
+            for (unsigned long long step = 0; step < steps; ++step)
+            {
+                for (size_t i = 0; i < bodyCount; ++i)
+                {
+                    const size_t row = i * stride;
+                    for (size_t m = begin; m < end; ++m)
+                    {
+                        vx[row + m] += ax[row + m] * halfStep;
+                        vy[row + m] += ay[row + m] * halfStep;
+                        vz[row + m] += az[row + m] * halfStep;
+                        x[row + m] += vx[row + m] * timestep;
+                        y[row + m] += vy[row + m] * timestep;
+                        z[row + m] += vz[row + m] * timestep;
+                    }
+                }
+                forces(args, begin, end);
+                for (size_t i = 0; i < bodyCount; ++i)
+                {
+                    const size_t row = i * stride;
+                    for (size_t m = begin; m < end; ++m)
+                    {
+                        vx[row + m] += ax[row + m] * halfStep;
+                        vy[row + m] += ay[row + m] * halfStep;
+                        vz[row + m] += az[row + m] * halfStep;
+                    }
+                }
+            }
+        }
+    };
+
+    const size_t blocks = stride / BLOCK;
+    if (pool)
+        pool->ParallelFor(blocks, 1, run);
+    else
+        run(0, blocks);
+
+    haveForces = true;
+    memberSteps += (unsigned long long)memberCount * steps;
+}
+
+void Ensemble::MeasureMember(size_t member, EnsembleDiagnostics &out)
+{
+    // Positions and velocities are in pixels: one factor of DISTANCE_SCALE
+    // each turns kinetic energy and angular momentum into SI; gm_j m_i / r
+    // needs DISTANCE_SCALE^2 as well since gm = G m / DISTANCE_SCALE^3
+    const double scale2 = DISTANCE_SCALE * DISTANCE_SCALE;
+    const double softening2 = (double)softening * softening;
+    double kinetic = 0.0, potential = 0.0, angularScale = 0.0;
+    double angular[3] = {0.0, 0.0, 0.0};
+    size_t escaped = 0;
+
+    const size_t b0 = member;
+    for (size_t i = 0; i < bodyCount; ++i)
+    {
+        const size_t a = i * stride + member;
+        const double m = gm[a] / FORCE_SCALE;
+        kinetic += 0.5 * m * (vx[a] * vx[a] + vy[a] * vy[a] + vz[a] * vz[a]);
+        const double l[3] = {y[a] * vz[a] - z[a] * vy[a], z[a] * vx[a] - x[a] * vz[a], x[a] * vy[a] - y[a] * vx[a]};
+        for (int k = 0; k < 3; ++k)
+            angular[k] += m * l[k];
+        angularScale += m * sqrt(l[0] * l[0] + l[1] * l[1] + l[2] * l[2]);
+
+        for (size_t j = i + 1; j < bodyCount; ++j)
+        {
+            const size_t b = j * stride + member;
+            double dx = x[b] - x[a], dy = y[b] - y[a], dz = z[b] - z[a];
+            double r2 = dx * dx + dy * dy + dz * dz;
+            if (r2 > MIN_DIST2)
+                potential -= m * gm[b] / sqrt(r2 + softening2);
+        }
+
+        // Two-body energy about body 0
+        if (i > 0)
+        {
+            double dx = x[a] - x[b0], dy = y[a] - y[b0], dz = z[a] - z[b0];
+            double dvx = vx[a] - vx[b0], dvy = vy[a] - vy[b0], dvz = vz[a] - vz[b0];
+            double r = sqrt(dx * dx + dy * dy + dz * dz);
+            double specific = 0.5 * (dvx * dvx + dvy * dvy + dvz * dvz) - (gm[b0] + gm[a]) / r;
+            bool unbound = r > 0.0 && specific > 0.0;
+            // Only bodies that started out bound can escape; a flyby never was
+            if (!haveReferences)
+                bound[a] = !unbound;
+            else if (bound[a] && unbound)
+                ++escaped;
+        }
+    }
+
+    Reference &reference = references[member];
+    out.energy = (kinetic + potential) * scale2;
+    out.escaped = escaped;
+    for (int k = 0; k < 3; ++k)
+        angular[k] *= scale2;
+    angularScale *= scale2;
+    if (!haveReferences)
+    {
+        reference.energy = out.energy;
+        for (int k = 0; k < 3; ++k)
+            reference.angular[k] = angular[k];
+        reference.angularScale = angularScale;
+    }
+
+    out.energyDrift = reference.energy != 0.0 ? fabs(out.energy - reference.energy) / fabs(reference.energy) : 0.0;
+    out.maxEnergyDrift = std::max(out.maxEnergyDrift, out.energyDrift);
+    double dl[3] = {angular[0] - reference.angular[0], angular[1] - reference.angular[1],
+                    angular[2] - reference.angular[2]};
+    out.angularMomentumDrift = reference.angularScale > 0.0
+                                   ? sqrt(dl[0] * dl[0] + dl[1] * dl[1] + dl[2] * dl[2]) / reference.angularScale
+                                   : 0.0;
+}
+
+void Ensemble::Measure()
+{
+    PROFILE_SCOPE("ensemble diagnostics");
+    auto measure = [&](size_t begin, size_t end)
+    {
+        for (size_t m = begin; m < end; ++m)
+            MeasureMember(m, diagnostics[m]);
+    };
+    if (pool)
+        pool->ParallelFor(memberCount, 64, measure);
+    else
+        measure(0, memberCount);
+    haveReferences = true;
+}
+
+void Ensemble::Unpack(size_t member, BodyStore &out) const
+{
+    out = layout;
+    for (size_t i = 0; i < bodyCount; ++i)
+    {
+        const size_t k = i * stride + member;
+        out.x[i] = (float)x[k];
+        out.y[i] = (float)y[k];
+        out.z[i] = (float)z[k];
+        out.vx[i] = (float)vx[k];
+        out.vy[i] = (float)vy[k];
+        out.vz[i] = (float)vz[k];
+        out.mass[i] = gm[k] / FORCE_SCALE;
+    }
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "bodies.h"
+#include "direct_kernel.h"
+#include "thread_pool.h"
+
+// How the members of a parameter sweep differ from the base system
+struct SweepSettings
+{
+    size_t members = 1000;
+    double massJitter = 0.0;            // every body but body 0 has its mass scaled by a factor in [1 - x, 1 + x]
+    double inclinationJitter = 0.0;     // degrees: every orbit around body 0 is tilted by up to this much
+    double perturberMass = 0.0;         // kg; above zero every member gets a parabolic flyby of this mass
+    double perturberPeriapsisMin = 0.0; // pixels from body 0, drawn uniformly per member
+    double perturberPeriapsisMax = 0.0;
+    double perturberDistance = 0.0;     // pixels from body 0 where the flyby starts
+    unsigned seed = 1;
+};
+
+// Per-member parameters drawn by makeSweep(), for the report
+struct SweepMember
+{
+    double perturberPeriapsis = 0.0; // pixels, 0 without a perturber
+};
+
+// Copies of base varied as settings asks; every member has the same bodies
+// in the same order (the perturber, when there is one, last)
+void makeSweep(const BodyStore &base, const SweepSettings &settings, std::vector<BodyStore> &members,
+               std::vector<SweepMember> &parameters);
+
+// Command-line perturber spec "MASS:QMIN:QMAX:DISTANCE" (kg, then pixels)
+bool parsePerturberSpec(const char *spec, SweepSettings &settings);
+
+// Conserved quantities of one member and how far they have drifted
+struct EnsembleDiagnostics
+{
+    double energy = 0.0;               // J
+    double energyDrift = 0.0;          // |E - E0| / |E0|
+    double maxEnergyDrift = 0.0;       // largest energyDrift measured so far
+    double angularMomentumDrift = 0.0; // |L - L0| / sum m |r x v|
+    size_t escaped = 0;                // bodies bound to body 0 at the reference that no longer are
+};
+
+// Many small independent systems stepped together.
+//
+// Members are packed batch-major: every column holds one body's value for
+// all members side by side, so one SIMD lane works on one member and a
+// 9-body system fills vectors as well as a 9000-body one would. Members
+// are padded to a whole number of vectors with copies of the first.
+//
+// State is double precision (positions in pixels, velocities in pixels per
+// second) and members advance with kick-drift-kick leapfrog. A task takes
+// a block of members through every requested step while its block stays
+// in L1, so throughput scales with both vector width and cores.
+class Ensemble
+{
+public:
+    ThreadPool *pool = nullptr; // member blocks run here when set
+    KernelIsa isa = detectKernelIsa();
+    float softening = 0.0f; // Plummer softening length (pixels)
+
+    // Pack members, which must all have the same number of bodies; false
+    // (with a message) if they do not
+    bool Load(const std::vector<BodyStore> &members);
+
+    // Advance every member by steps leapfrog steps of timestep seconds
+    void Advance(double timestep, unsigned long long steps);
+
+    // Recompute the per-member diagnostics; the first call after Load()
+    // sets the reference the drifts are taken against
+    void Measure();
+
+    const std::vector<EnsembleDiagnostics> &Diagnostics() const { return diagnostics; }
+
+    // Copy one member back out (positions and velocities rounded to float)
+    void Unpack(size_t member, BodyStore &out) const;
+
+    size_t Members() const { return memberCount; }
+    size_t Bodies() const { return bodyCount; }
+
+    // Number of member-steps performed so far
+    unsigned long long memberSteps = 0;
+
+private:
+    struct Reference
+    {
+        double energy;
+        double angular[3];
+        double angularScale;
+    };
+
+    void MeasureMember(size_t member, EnsembleDiagnostics &out);
+
+    size_t memberCount = 0;
+    size_t bodyCount = 0;
+    size_t stride = 0; // members padded to whole blocks
+
+    // Column[body * stride + member]
+    AlignedVector<double> x, y, z, vx, vy, vz, ax, ay, az;
+    AlignedVector<double> gm; // FORCE_SCALE * mass
+    BodyStore layout;         // the first member, for Unpack()
+
+    bool haveForces = false;
+    std::vector<EnsembleDiagnostics> diagnostics;
+    std::vector<Reference> references;
+    std::vector<unsigned char> bound; // [body * stride + member]: bound to body 0 at the reference
+    bool haveReferences = false;
+};
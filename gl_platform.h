@@ -0,0 +1,14 @@
+#pragma once
+
+// OpenGL headers for the system framework on macOS and Mesa on Linux (GL 1.5
+// buffer objects are core there but only prototyped through glext.h)
+#ifdef __APPLE__
+#define GL_SILENCE_DEPRECATION
+#include <OpenGL/gl.h>
+#include <OpenGL/glu.h>
+#else
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <GL/glu.h>
+#endif
@@ -0,0 +1,755 @@
+// Headless batch runner: loads a scenario, runs physics only and writes the
+// final state. Shares the simulation code with the viewer but links no
+// windowing or GL library, so it builds and runs on display-less servers.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "bodies.h"
+#include "checkpoint.h"
+#include "collisions.h"
+#include "diagnostics.h"
+#include "domain.h"
+#include "ensemble.h"
+#include "integrators.h"
+#include "physics.h"
+#include "profiler.h"
+#include "scenario.h"
+#include "thread_pool.h"
+#include "trajectory.h"
+#include "transport.h"
+#include "units.h"
+
+static void printUsage(const char *argv0)
+{
+    std::printf("Usage: %s [options]\n", argv0);
+    std::printf("  --scenario FILE      text or binary scenario to load (default: built-in solar system)\n");
+    std::printf("  --elements FILE      orbital elements to load instead of a scenario\n");
+    std::printf("  --belt N:INNER:OUTER add N massless test particles orbiting body 0 between INNER and\n");
+    std::printf("                       OUTER pixels\n");
+    std::printf("  --steps N            number of steps to run (default: 1000 unless --time-budget is given)\n");
+    std::printf("  --time-budget SEC    stop after this much wall-clock time\n");
+    std::printf("  --dt SEC             simulated seconds per step (default: one year)\n");
+    std::printf("  --solver NAME        direct | simd | barnes-hut (default: barnes-hut)\n");
+    std::printf("  --theta X            Barnes-Hut opening angle (default: 0.5)\n");
+    std::printf("  --softening PX       Plummer softening length in pixels (default: 0)\n");
+    std::printf("  --precision NAME     single | mixed: positions kept relative to an origin that follows\n");
+    std::printf("                       the system, and compensated sums for the simd solver\n");
+    std::printf("                       (default: single)\n");
+    std::printf("  --reproducible on|off\n");
+    std::printf("                       simd solver gives the same bits on every instruction set, for\n");
+    std::printf("                       comparing runs across machines; forces cost 35-60%% more\n");
+    std::printf("                       (default: off; results never depend on --threads either way)\n");
+    std::printf("  --integrator NAME    euler | leapfrog | yoshida4 | wisdom-holman | block (default: leapfrog)\n");
+    std::printf("  --collisions on|off  merge bodies that touch (default: off)\n");
+    std::printf("  --threads N          worker threads (default: all cores)\n");
+    std::printf("  --checkpoint FILE    write restartable checkpoints to FILE in the background\n");
+    std::printf("  --checkpoint-every N steps between checkpoints (default: 1000)\n");
+    std::printf("  --restart FILE       resume bit for bit from a checkpoint; its solver, integrator and\n");
+    std::printf("                       timestep replace the command-line ones\n");
+    std::printf("  --trajectory FILE    stream compressed trajectories to FILE\n");
+    std::printf("  --trajectory-every K record every K-th step (default: 10)\n");
+    std::printf("  --trajectory-stride S\n");
+    std::printf("                       record every S-th body (default: 1)\n");
+    std::printf("  --trajectory-quantum PX\n");
+    std::printf("                       position resolution in pixels (default: 0.001)\n");
+    std::printf("  --trajectory-full wait|drop\n");
+    std::printf("                       when the writer falls behind, stall the run or drop frames\n");
+    std::printf("                       (default: wait, so every frame is kept)\n");
+    std::printf("  --diagnostics N      print energy, momentum and virial ratio every N steps\n");
+    std::printf("  --energy-tolerance X warn when the relative energy drift exceeds X (default: 1e-3)\n");
+    std::printf("  --profile-trace FILE write a Chrome trace and print a per-step phase summary\n");
+    std::printf("                       (profiling builds only: make PROFILE=1)\n");
+    std::printf("  --output FILE        write the final state (binary if FILE ends in .grav, else text)\n");
+    std::printf("Ensemble sweeps (leapfrog, exact double-precision forces, one SIMD lane per member):\n");
+    std::printf("  --ensemble N         run N varied copies of the loaded system side by side\n");
+    std::printf("  --sweep-mass X       scale each body's mass by a random factor in [1 - X, 1 + X]\n");
+    std::printf("  --sweep-inclination DEG\n");
+    std::printf("                       tilt each orbit around body 0 by up to DEG degrees\n");
+    std::printf("  --perturber MASS:QMIN:QMAX:DIST\n");
+    std::printf("                       add a parabolic flyby of MASS kg starting DIST pixels from body 0,\n");
+    std::printf("                       periapsis drawn between QMIN and QMAX pixels\n");
+    std::printf("  --sweep-seed N       random seed for the sweep (default: 1)\n");
+    std::printf("  --ensemble-report FILE\n");
+    std::printf("                       write per-member diagnostics as CSV\n");
+    std::printf("Multi-process runs (space is split between processes connected by local sockets):\n");
+    std::printf("  --ranks N            run as N processes, each with --threads threads (default: the cores\n");
+    std::printf("                       shared out between them)\n");
+    std::printf("  --rebalance-every N  steps between load checks, 0 never moves bodies again (default: 10)\n");
+    std::printf("  --imbalance-tolerance X\n");
+    std::printf("                       rebalance when the busiest process does X more work than the mean\n");
+    std::printf("                       (default: 0.1)\n");
+}
+
+static double median(std::vector<double> values)
+{
+    if (values.empty())
+        return 0.0;
+    std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+    return values[values.size() / 2];
+}
+
+static void printEnsembleDiagnostics(const Ensemble &ensemble, double simTime)
+{
+    std::vector<double> drifts;
+    size_t escapes = 0;
+    double worst = 0.0;
+    for (const EnsembleDiagnostics &member : ensemble.Diagnostics())
+    {
+        drifts.push_back(member.energyDrift);
+        worst = std::max(worst, member.energyDrift);
+        escapes += member.escaped > 0;
+    }
+    std::printf("t = %.3f years: energy drift median %.2e, max %.2e; %zu members with escaped bodies\n",
+                simTime / SECONDS_PER_YEAR, median(drifts), worst, escapes);
+}
+
+static bool writeEnsembleReport(const char *path, const Ensemble &ensemble, const std::vector<SweepMember> &parameters)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+    {
+        fprintf(stderr, "Could not write %s\n", path);
+        return false;
+    }
+    fprintf(file, "member,perturber_periapsis_px,energy_J,energy_drift,max_energy_drift,angular_momentum_drift,"
+                  "escaped\n");
+    for (size_t m = 0; m < ensemble.Members(); ++m)
+    {
+        const EnsembleDiagnostics &d = ensemble.Diagnostics()[m];
+        fprintf(file, "%zu,%.6g,%.9e,%.3e,%.3e,%.3e,%zu\n", m, parameters[m].perturberPeriapsis, d.energy,
+                d.energyDrift, d.maxEnergyDrift, d.angularMomentumDrift, d.escaped);
+    }
+    return fclose(file) == 0;
+}
+
+// Steps every member of the sweep together and reports on them; steps,
+// timeBudget and diagnosticsEvery mean what they do for a single run
+static int runEnsemble(const BodyStore &base, const SweepSettings &sweep, double timestep, long long steps,
+                       double timeBudget, long long diagnosticsEvery, float softening, unsigned threadCount,
+                       const char *reportPath)
+{
+    typedef std::chrono::steady_clock Clock;
+    std::vector<BodyStore> members;
+    std::vector<SweepMember> parameters;
+    makeSweep(base, sweep, members, parameters);
+
+    ThreadPool pool(threadCount);
+    Ensemble ensemble;
+    ensemble.pool = &pool;
+    ensemble.softening = softening;
+    if (!ensemble.Load(members))
+        return -1;
+    members.clear();
+    ensemble.Measure();
+
+    std::printf("Ensemble: %zu members of %zu bodies, kernel: %s, threads: %u\n", ensemble.Members(),
+                ensemble.Bodies(), kernelIsaName(ensemble.isa), pool.ThreadCount());
+    if (diagnosticsEvery > 0)
+        printEnsembleDiagnostics(ensemble, 0.0);
+
+    // Members run in chunks so the budget and the diagnostics get a look in
+    const long long chunk = diagnosticsEvery > 0 ? diagnosticsEvery : 100;
+    Clock::time_point start = Clock::now();
+    long long step = 0;
+    double elapsed = 0.0;
+    while (steps <= 0 || step < steps)
+    {
+        if (timeBudget > 0.0 && elapsed >= timeBudget)
+            break;
+        long long count = steps > 0 ? std::min(chunk, steps - step) : chunk;
+        ensemble.Advance(timestep, (unsigned long long)count);
+        step += count;
+        if (diagnosticsEvery > 0 && step % diagnosticsEvery == 0)
+        {
+            ensemble.Measure();
+            printEnsembleDiagnostics(ensemble, step * timestep);
+        }
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    if (diagnosticsEvery <= 0 || step % diagnosticsEvery != 0)
+    {
+        ensemble.Measure();
+        printEnsembleDiagnostics(ensemble, step * timestep);
+    }
+
+    std::printf("Steps: %lld, simulated: %.3f years, wall: %.3f s\n", step, step * timestep / SECONDS_PER_YEAR, elapsed);
+    if (elapsed > 0.0)
+        std::printf("Throughput: %.3g member-steps/s\n", ensemble.memberSteps / elapsed);
+
+    if (reportPath && !writeEnsembleReport(reportPath, ensemble, parameters))
+        return -1;
+    return 0;
+}
+
+// Sums of conserved quantities over every rank
+static void combineConservation(Transport &transport, Conservation &sum)
+{
+    double values[16] = {sum.kinetic,     sum.potential,   sum.momentum[0], sum.momentum[1],     sum.momentum[2],
+                         sum.angular[0],  sum.angular[1],  sum.angular[2],  sum.momentumScale, sum.angularScale,
+                         sum.force[0],    sum.force[1],    sum.force[2],    sum.torque[0],       sum.torque[1],
+                         sum.torque[2]};
+    if (!allReduce(transport, values, 16, REDUCE_SUM))
+        return; // the next exchange fails too and stops the run
+    sum.kinetic = values[0];
+    sum.potential = values[1];
+    for (int k = 0; k < 3; ++k)
+    {
+        sum.momentum[k] = values[2 + k];
+        sum.angular[k] = values[5 + k];
+    }
+    sum.momentumScale = values[8];
+    sum.angularScale = values[9];
+    for (int k = 0; k < 3; ++k)
+    {
+        sum.force[k] = values[10 + k];
+        sum.torque[k] = values[13 + k];
+    }
+}
+
+// Splits bodies between ranks processes and steps them together; rank 0
+// reports and writes outputPath. Every option means what it does for a
+// single process.
+static int runDistributed(BodyStore &bodies, const ForceSettings &forceSettings, IntegratorType integratorType,
+                          double timestep, long long steps, long long diagnosticsEvery, double energyTolerance,
+                          unsigned threadCount, int ranks, const DomainSettings &domainSettings,
+                          const char *outputPath, std::chrono::steady_clock::time_point loadStart)
+{
+    typedef std::chrono::steady_clock Clock;
+    SocketTransport transport;
+    if (!transport.Launch(ranks))
+        return -1;
+    const int rank = transport.Rank();
+    const bool report = rank == 0;
+
+    // Each rank starts from an even slice; the first split moves the bodies
+    // to their regions
+    BodyStore local;
+    const size_t first = bodies.Size() * rank / ranks;
+    {
+        const size_t last = bodies.Size() * (rank + 1) / ranks;
+        local.Resize(last - first);
+        std::copy(bodies.x.begin() + first, bodies.x.begin() + last, local.x.begin());
+        std::copy(bodies.y.begin() + first, bodies.y.begin() + last, local.y.begin());
+        std::copy(bodies.z.begin() + first, bodies.z.begin() + last, local.z.begin());
+        std::copy(bodies.vx.begin() + first, bodies.vx.begin() + last, local.vx.begin());
+        std::copy(bodies.vy.begin() + first, bodies.vy.begin() + last, local.vy.begin());
+        std::copy(bodies.vz.begin() + first, bodies.vz.begin() + last, local.vz.begin());
+        std::copy(bodies.mass.begin() + first, bodies.mass.begin() + last, local.mass.begin());
+        std::copy(bodies.density.begin() + first, bodies.density.begin() + last, local.density.begin());
+        std::copy(bodies.hue.begin() + first, bodies.hue.begin() + last, local.hue.begin());
+        std::copy(bodies.type.begin() + first, bodies.type.begin() + last, local.type.begin());
+        local.origin = bodies.origin;
+        bodies.Clear();
+    }
+
+    DomainDecomposition domain(transport);
+    domain.settings = domainSettings;
+    bool ok = domain.Adopt(local, first);
+
+    ThreadPool pool(threadCount > 0 ? threadCount : std::max(1u, std::thread::hardware_concurrency() / ranks));
+    GravitySolver gravity;
+    gravity.settings = forceSettings;
+    gravity.pool = &pool;
+    gravity.remote = &domain;
+    std::unique_ptr<Integrator> integrator = createIntegrator(integratorType);
+
+    ConservationMonitor conservation;
+    conservation.energyTolerance = energyTolerance;
+    conservation.combine = [&transport](Conservation &sum) { combineConservation(transport, sum); };
+    if (ok && diagnosticsEvery > 0)
+    {
+        ConservationMonitor::Prepare(gravity);
+        conservation.Measure(local, gravity, *integrator, 0.0);
+        if (report)
+            conservation.Print(stdout);
+    }
+
+    double counts[2] = {(double)local.Size(), (double)std::count(local.mass.begin(), local.mass.end(), 0.0)};
+    ok = ok && allReduce(transport, counts, 2, REDUCE_SUM);
+    if (ok && report)
+    {
+        std::printf("Loaded in %.3f s\n", std::chrono::duration<double>(Clock::now() - loadStart).count());
+        std::printf("Bodies: %.0f (%.0f test particles), solver: %s (%s, %s%s), integrator: %s, ranks: %d, "
+                    "threads per rank: %u\n",
+                    counts[0], counts[1], forceSolverName(forceSettings.solver), kernelIsaName(forceSettings.isa),
+                    forcePrecisionName(forceSettings.precision), forceSettings.reproducible ? ", reproducible" : "",
+                    integratorName(integratorType), ranks, pool.ThreadCount());
+    }
+
+    Clock::time_point start = Clock::now();
+    long long step = 0;
+    double simTime = 0.0;
+    while (ok && step < steps)
+    {
+        Clock::time_point stepStart = Clock::now();
+        {
+            PROFILE_SCOPE("step");
+            integrator->Step(local, gravity, timestep);
+        }
+        // Every rank moves its origin by the same shift, so exchanged offsets stay comparable
+        recenterBodies(local, forceSettings, [&transport](double sums[4])
+                       {
+                           if (!allReduce(transport, sums, 4, REDUCE_SUM))
+                               sums[3] = 0.0; // stay put; the next exchange fails too and stops the run
+                       });
+        const double seconds = std::chrono::duration<double>(Clock::now() - stepStart).count();
+        simTime += timestep;
+        ++step;
+
+        // Measured before any rebalance, while the potentials still match
+        // the order of the bodies
+        if (diagnosticsEvery > 0 && (integrator->ForcesAtStepEnd() || step % diagnosticsEvery == 0))
+        {
+            conservation.Measure(local, gravity, *integrator, simTime);
+            if (report)
+            {
+                conservation.CheckAlarms();
+                if (step % diagnosticsEvery == 0)
+                    conservation.Print(stdout);
+            }
+        }
+        if (domain.AfterStep(local, seconds))
+            integrator->Reset(); // cached forces are in the old order
+        ok = !domain.Failed();
+    }
+    const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    if (ok && diagnosticsEvery > 0)
+    {
+        if (step % diagnosticsEvery != 0)
+        {
+            conservation.Measure(local, gravity, *integrator, simTime);
+            if (report)
+                conservation.Print(stdout);
+        }
+        if (report)
+            std::printf("Largest energy drift: %.3g\n", conservation.MaxEnergyDrift());
+    }
+
+    double evaluations = (double)gravity.evaluations;
+    double exchange = domain.ExchangeSeconds();
+    ok = ok && allReduce(transport, &evaluations, 1, REDUCE_SUM) && allReduce(transport, &exchange, 1, REDUCE_MAX);
+    if (ok && report)
+    {
+        std::printf("Domains: %d ranks, %u rebalances, last imbalance %.1f%%, exchange up to %.3f s per rank\n",
+                    ranks, domain.Rebalances(), 100.0 * domain.Imbalance(), exchange);
+        std::printf("Steps: %lld, simulated: %.3f years, wall: %.3f s\n", step, step * timestep / SECONDS_PER_YEAR,
+                    elapsed);
+        if (elapsed > 0.0)
+            std::printf("Throughput: %.1f steps/s, %.3g body-force evaluations/s\n", step / elapsed,
+                        evaluations / elapsed);
+    }
+
+    if (ok && outputPath)
+    {
+        ok = domain.Gather(local, bodies);
+        if (ok && report)
+            ok = saveScenario(outputPath, bodies);
+    }
+
+    if (report && !transport.Join())
+    {
+        fprintf(stderr, "A rank failed\n");
+        ok = false;
+    }
+    return ok ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *scenarioPath = nullptr;
+    const char *elementsPath = nullptr;
+    const char *outputPath = nullptr;
+    const char *checkpointPath = nullptr;
+    const char *restartPath = nullptr;
+    const char *trajectoryPath = nullptr;
+    const char *tracePath = nullptr;
+    long long diagnosticsEvery = 0;
+    bool collide = false;
+    size_t beltCount = 0;
+    float beltInner = 0.0f, beltOuter = 0.0f;
+    double energyTolerance = 1e-3;
+    SweepSettings sweep;
+    sweep.members = 0;
+    const char *reportPath = nullptr;
+    int ranks = 1;
+    DomainSettings domainSettings;
+    TrajectorySettings trajectorySettings;
+    trajectorySettings.dropWhenFull = false; // batch output is for analysis, so keep every frame
+    long long checkpointEvery = 1000;
+    long long steps = 0;
+    double timeBudget = 0.0;
+    double timestep = SECONDS_PER_YEAR;
+    unsigned threadCount = 0;
+    ForceSettings forceSettings;
+    IntegratorType integratorType = LEAPFROG_KDK;
+
+    for (int a = 1; a < argc; ++a)
+    {
+        const char *arg = argv[a];
+        if (std::strcmp(arg, "--help") == 0 || std::strcmp(arg, "-h") == 0)
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        if (a + 1 >= argc)
+        {
+            fprintf(stderr, "Missing value for %s\n", arg);
+            return -1;
+        }
+
+        const char *value = argv[++a];
+        if (std::strcmp(arg, "--scenario") == 0)
+            scenarioPath = value;
+        else if (std::strcmp(arg, "--elements") == 0)
+            elementsPath = value;
+        else if (std::strcmp(arg, "--output") == 0)
+            outputPath = value;
+        else if (std::strcmp(arg, "--checkpoint") == 0)
+            checkpointPath = value;
+        else if (std::strcmp(arg, "--checkpoint-every") == 0)
+            checkpointEvery = std::atoll(value);
+        else if (std::strcmp(arg, "--restart") == 0)
+            restartPath = value;
+        else if (std::strcmp(arg, "--belt") == 0)
+        {
+            if (!parseBeltSpec(value, beltCount, beltInner, beltOuter))
+            {
+                fprintf(stderr, "--belt takes N:INNER:OUTER, not %s\n", value);
+                return -1;
+            }
+        }
+        else if (std::strcmp(arg, "--collisions") == 0)
+        {
+            if (std::strcmp(value, "on") != 0 && std::strcmp(value, "off") != 0)
+            {
+                fprintf(stderr, "--collisions takes on or off, not %s\n", value);
+                return -1;
+            }
+            collide = std::strcmp(value, "on") == 0;
+        }
+        else if (std::strcmp(arg, "--ensemble") == 0)
+            sweep.members = (size_t)std::atoll(value);
+        else if (std::strcmp(arg, "--sweep-mass") == 0)
+            sweep.massJitter = std::atof(value);
+        else if (std::strcmp(arg, "--sweep-inclination") == 0)
+            sweep.inclinationJitter = std::atof(value);
+        else if (std::strcmp(arg, "--sweep-seed") == 0)
+            sweep.seed = (unsigned)std::atoi(value);
+        else if (std::strcmp(arg, "--perturber") == 0)
+        {
+            if (!parsePerturberSpec(value, sweep))
+            {
+                fprintf(stderr, "--perturber takes MASS:QMIN:QMAX:DIST with QMIN <= QMAX < DIST, not %s\n", value);
+                return -1;
+            }
+        }
+        else if (std::strcmp(arg, "--ensemble-report") == 0)
+            reportPath = value;
+        else if (std::strcmp(arg, "--ranks") == 0)
+            ranks = std::atoi(value);
+        else if (std::strcmp(arg, "--rebalance-every") == 0)
+            domainSettings.rebalanceEvery = (unsigned)std::atoi(value);
+        else if (std::strcmp(arg, "--imbalance-tolerance") == 0)
+            domainSettings.imbalanceTolerance = std::atof(value);
+        else if (std::strcmp(arg, "--diagnostics") == 0)
+            diagnosticsEvery = std::atoll(value);
+        else if (std::strcmp(arg, "--energy-tolerance") == 0)
+            energyTolerance = std::atof(value);
+        else if (std::strcmp(arg, "--profile-trace") == 0)
+            tracePath = value;
+        else if (std::strcmp(arg, "--trajectory") == 0)
+            trajectoryPath = value;
+        else if (std::strcmp(arg, "--trajectory-every") == 0)
+            trajectorySettings.every = (unsigned)std::atoi(value);
+        else if (std::strcmp(arg, "--trajectory-stride") == 0)
+            trajectorySettings.stride = (unsigned)std::atoi(value);
+        else if (std::strcmp(arg, "--trajectory-quantum") == 0)
+            trajectorySettings.positionQuantum = (float)std::atof(value);
+        else if (std::strcmp(arg, "--trajectory-full") == 0)
+        {
+            if (std::strcmp(value, "wait") != 0 && std::strcmp(value, "drop") != 0)
+            {
+                fprintf(stderr, "--trajectory-full takes wait or drop, not %s\n", value);
+                return -1;
+            }
+            trajectorySettings.dropWhenFull = std::strcmp(value, "drop") == 0;
+        }
+        else if (std::strcmp(arg, "--steps") == 0)
+            steps = std::atoll(value);
+        else if (std::strcmp(arg, "--time-budget") == 0)
+            timeBudget = std::atof(value);
+        else if (std::strcmp(arg, "--dt") == 0)
+            timestep = std::atof(value);
+        else if (std::strcmp(arg, "--theta") == 0)
+            forceSettings.theta = (float)std::atof(value);
+        else if (std::strcmp(arg, "--softening") == 0)
+            forceSettings.softening = (float)std::atof(value);
+        else if (std::strcmp(arg, "--threads") == 0)
+            threadCount = (unsigned)std::atoi(value);
+        else if (std::strcmp(arg, "--solver") == 0)
+        {
+            if (!parseForceSolver(value, forceSettings.solver))
+            {
+                fprintf(stderr, "Unknown solver %s\n", value);
+                return -1;
+            }
+        }
+        else if (std::strcmp(arg, "--precision") == 0)
+        {
+            if (!parseForcePrecision(value, forceSettings.precision))
+            {
+                fprintf(stderr, "Unknown precision %s\n", value);
+                return -1;
+            }
+        }
+        else if (std::strcmp(arg, "--reproducible") == 0)
+        {
+            if (std::strcmp(value, "on") != 0 && std::strcmp(value, "off") != 0)
+            {
+                fprintf(stderr, "--reproducible takes on or off, not %s\n", value);
+                return -1;
+            }
+            forceSettings.reproducible = std::strcmp(value, "on") == 0;
+        }
+        else if (std::strcmp(arg, "--integrator") == 0)
+        {
+            if (!parseIntegratorType(value, integratorType))
+            {
+                fprintf(stderr, "Unknown integrator %s\n", value);
+                return -1;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", arg);
+            printUsage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (tracePath && !profileEnabled())
+    {
+        fprintf(stderr, "--profile-trace needs a profiling build (make PROFILE=1)\n");
+        return -1;
+    }
+    if (steps <= 0 && timeBudget <= 0.0)
+        steps = 1000;
+    if (sweep.members > 0 && (restartPath || checkpointPath || trajectoryPath || outputPath || collide))
+    {
+        fprintf(stderr, "--ensemble cannot be combined with --restart, --checkpoint, --trajectory, --output or "
+                        "--collisions\n");
+        return -1;
+    }
+    if (ranks < 1)
+    {
+        fprintf(stderr, "--ranks takes a positive count, not %d\n", ranks);
+        return -1;
+    }
+    if (ranks > 1 && (restartPath || checkpointPath || trajectoryPath || tracePath || collide || sweep.members > 0 ||
+                      timeBudget > 0.0 || integratorType == WISDOM_HOLMAN || integratorType == BLOCK_TIMESTEP))
+    {
+        fprintf(stderr, "--ranks cannot be combined with --restart, --checkpoint, --trajectory, --profile-trace, "
+                        "--collisions, --ensemble, --time-budget or the wisdom-holman and block integrators\n");
+        return -1;
+    }
+
+    BodyStore bodies;
+    Checkpoint checkpoint;
+    double simTime = 0.0;
+    uint64_t firstStep = 0;
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point loadStart = Clock::now();
+    if (restartPath)
+    {
+        if (!loadCheckpoint(restartPath, checkpoint))
+            return -1;
+        std::swap(bodies, checkpoint.bodies);
+        simTime = checkpoint.simTime;
+        firstStep = checkpoint.step;
+        timestep = checkpoint.timestep;
+        forceSettings = checkpoint.forces;
+        integratorType = checkpoint.integrator;
+    }
+    else if (elementsPath)
+    {
+        if (!loadOrbitalElements(elementsPath, bodies))
+            return -1;
+    }
+    else if (scenarioPath)
+    {
+        if (!loadScenario(scenarioPath, bodies))
+            return -1;
+    }
+    else
+    {
+        loadSolarSystem(bodies);
+    }
+    if (restartPath && beltCount > 0)
+        fprintf(stderr, "--belt is ignored when resuming; the checkpoint has its own bodies\n");
+    else
+        addTestParticleBelt(bodies, beltCount, beltInner, beltOuter);
+
+    if (sweep.members > 0)
+        return runEnsemble(bodies, sweep, timestep, steps, timeBudget, diagnosticsEvery, forceSettings.softening,
+                           threadCount, reportPath);
+    if (ranks > 1)
+        return runDistributed(bodies, forceSettings, integratorType, timestep, steps, diagnosticsEvery, energyTolerance,
+                              threadCount, ranks, domainSettings, outputPath, loadStart);
+
+    std::unique_ptr<Integrator> integrator;
+    if (restartPath)
+    {
+        integrator = restoreIntegrator(checkpoint);
+        forceSettings.isa = checkpoint.forces.isa; // falls back if this host lacks the saved kernel
+    }
+    else
+    {
+        integrator = createIntegrator(integratorType);
+    }
+
+    ThreadPool pool(threadCount);
+    GravitySolver gravity;
+    gravity.settings = forceSettings;
+    gravity.pool = &pool;
+
+    CollisionSolver collisions;
+    collisions.pool = &pool;
+    collisions.softening = forceSettings.softening;
+
+    std::unique_ptr<CheckpointWriter> checkpoints;
+    if (checkpointPath)
+        checkpoints.reset(new CheckpointWriter(checkpointPath));
+
+    // Potentials come out of the force pass; integrators whose last pass is
+    // not at the final positions are only measured every diagnosticsEvery steps
+    ConservationMonitor conservation;
+    conservation.energyTolerance = energyTolerance;
+    if (diagnosticsEvery > 0)
+    {
+        ConservationMonitor::Prepare(gravity);
+        conservation.Measure(bodies, gravity, *integrator, simTime);
+        conservation.Print(stdout);
+    }
+
+    std::unique_ptr<TrajectoryWriter> trajectory;
+    if (trajectoryPath)
+    {
+        trajectory.reset(new TrajectoryWriter(trajectoryPath, bodies, timestep, trajectorySettings));
+        if (!trajectory->IsOpen())
+            return -1;
+        trajectory->Record(bodies, simTime, firstStep);
+    }
+
+    std::printf("Loaded in %.3f s\n", std::chrono::duration<double>(Clock::now() - loadStart).count());
+    if (restartPath)
+        std::printf("Resumed at step %llu, %.3f years\n", (unsigned long long)firstStep, simTime / SECONDS_PER_YEAR);
+    size_t testParticles = (size_t)std::count(bodies.mass.begin(), bodies.mass.end(), 0.0);
+    std::printf("Bodies: %zu (%zu test particles), solver: %s (%s, %s%s), integrator: %s, threads: %u\n",
+                bodies.Size(), testParticles, forceSolverName(forceSettings.solver), kernelIsaName(forceSettings.isa),
+                forcePrecisionName(forceSettings.precision), forceSettings.reproducible ? ", reproducible" : "",
+                integratorName(integratorType), pool.ThreadCount());
+
+    PROFILE_THREAD("main");
+    if (tracePath)
+        profileStartTrace();
+
+    Clock::time_point start = Clock::now();
+    long long step = 0;
+    double elapsed = 0.0;
+    while (steps <= 0 || step < steps)
+    {
+        if (timeBudget > 0.0 && elapsed >= timeBudget)
+            break;
+
+        {
+            PROFILE_SCOPE("step");
+            integrator->Step(bodies, gravity, timestep);
+        }
+        simTime += timestep;
+        ++step;
+        recenterBodies(bodies, gravity.settings);
+
+        size_t merged = collide ? collisions.Resolve(bodies, timestep) : 0;
+        if (merged > 0)
+        {
+            std::printf("t = %.3f years: %zu absorbed, %zu bodies left\n", simTime / SECONDS_PER_YEAR, merged,
+                        bodies.Size());
+            integrator->Reset(); // cached forces belong to bodies that are gone
+            if (trajectory)
+                trajectory->Remap(collisions.Remap());
+            conservation.Absorb(collisions.Losses());
+        }
+
+        // The step loop only pays for a memory copy; the writer thread does the I/O
+        if (checkpoints && checkpointEvery > 0 && (firstStep + step) % checkpointEvery == 0)
+        {
+            captureCheckpoint(checkpoint, bodies, gravity, *integrator, simTime, firstStep + step, timestep);
+            checkpoints->Submit(checkpoint);
+        }
+        if (trajectory)
+            trajectory->Record(bodies, simTime, firstStep + step);
+        if (diagnosticsEvery > 0 && (integrator->ForcesAtStepEnd() || step % diagnosticsEvery == 0))
+        {
+            conservation.Measure(bodies, gravity, *integrator, simTime);
+            conservation.CheckAlarms();
+            if (step % diagnosticsEvery == 0)
+                conservation.Print(stdout);
+        }
+        if (tracePath)
+            profileEndFrame();
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    if (checkpoints)
+    {
+        captureCheckpoint(checkpoint, bodies, gravity, *integrator, simTime, firstStep + step, timestep);
+        checkpoints->Submit(checkpoint);
+        checkpoints->Flush();
+    }
+
+    if (trajectory)
+    {
+        trajectory->Close();
+        std::printf("Trajectory: %llu frames written, %llu dropped\n", trajectory->FramesWritten(),
+                    trajectory->Dropped());
+    }
+
+    if (diagnosticsEvery > 0)
+    {
+        if (step % diagnosticsEvery != 0)
+        {
+            conservation.Measure(bodies, gravity, *integrator, simTime);
+            conservation.Print(stdout);
+        }
+        std::printf("Largest energy drift: %.3g\n", conservation.MaxEnergyDrift());
+    }
+
+    if (collide)
+        std::printf("Collisions: %llu bodies absorbed, %zu left\n", collisions.absorbed, bodies.Size());
+
+    std::printf("Steps: %lld, simulated: %.3f years, wall: %.3f s\n", step, step * timestep / SECONDS_PER_YEAR, elapsed);
+    if (elapsed > 0.0)
+        std::printf("Throughput: %.1f steps/s, %.3g body-force evaluations/s\n", step / elapsed,
+                    gravity.evaluations / elapsed);
+
+    if (tracePath)
+    {
+        profileEndFrame();
+        profilePrintSummary(stdout);
+        if (!profileWriteTrace(tracePath))
+            return -1;
+    }
+
+    if (outputPath && !saveScenario(outputPath, bodies))
+        return -1;
+
+    return 0;
+}
@@ -0,0 +1,657 @@
+#include "integrators.h"
+#include "units.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// Orbits per task in the Wisdom-Holman Kepler drift; each is an iterative solve
+static const size_t KEPLER_GRAIN = 256;
+
+const char *integratorName(IntegratorType type)
+{
+    switch (type)
+    {
+    case LEAPFROG_KDK:
+        return "Leapfrog (KDK)";
+    case YOSHIDA4:
+        return "Yoshida 4th order";
+    case WISDOM_HOLMAN:
+        return "Wisdom-Holman";
+    case BLOCK_TIMESTEP:
+        return "Block timesteps";
+    default:
+        return "Symplectic Euler";
+    }
+}
+
+bool parseIntegratorType(const char *name, IntegratorType &type)
+{
+    static const char *const names[] = {"euler", "leapfrog", "yoshida4", "wisdom-holman", "block"};
+    for (int i = 0; i <= BLOCK_TIMESTEP; ++i)
+    {
+        if (std::strcmp(name, names[i]) == 0)
+        {
+            type = (IntegratorType)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Integrator state blobs are plain little-endian dumps of the cached fields,
+// each vector prefixed by its element count
+class StateWriter
+{
+public:
+    explicit StateWriter(std::vector<char> &buffer) : out(buffer) { out.clear(); }
+
+    template <typename T>
+    void Write(const T &value)
+    {
+        const char *bytes = reinterpret_cast<const char *>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    template <typename T>
+    void WriteVector(const std::vector<T> &values)
+    {
+        Write((uint64_t)values.size());
+        const char *bytes = reinterpret_cast<const char *>(values.data());
+        out.insert(out.end(), bytes, bytes + values.size() * sizeof(T));
+    }
+
+private:
+    std::vector<char> &out;
+};
+
+class StateReader
+{
+public:
+    explicit StateReader(const std::vector<char> &buffer) : data(buffer.data()), left(buffer.size()) {}
+
+    template <typename T>
+    bool Read(T &value)
+    {
+        if (left < sizeof(T))
+            return false;
+        std::memcpy(&value, data, sizeof(T));
+        data += sizeof(T);
+        left -= sizeof(T);
+        return true;
+    }
+
+    template <typename T>
+    bool ReadVector(std::vector<T> &values)
+    {
+        uint64_t count;
+        if (!Read(count) || count > left / sizeof(T))
+            return false;
+        values.resize((size_t)count);
+        std::memcpy(values.data(), data, (size_t)count * sizeof(T));
+        data += count * sizeof(T);
+        left -= count * sizeof(T);
+        return true;
+    }
+
+    bool Done() const { return left == 0; }
+
+private:
+    const char *data;
+    size_t left;
+};
+
+class SymplecticEulerIntegrator : public Integrator
+{
+public:
+    IntegratorType Type() const { return SYMPLECTIC_EULER; }
+
+    void Step(BodyStore &bodies, GravitySolver &gravity, double timestep)
+    {
+        gravity.Compute(bodies, accels);
+        kickBodies(bodies, accels, timestep, gravity.pool);
+        driftBodies(bodies, timestep, gravity.pool);
+    }
+
+private:
+    std::vector<std::array<float, 3>> accels;
+};
+
+class LeapfrogIntegrator : public Integrator
+{
+public:
+    IntegratorType Type() const { return LEAPFROG_KDK; }
+
+    void Step(BodyStore &bodies, GravitySolver &gravity, double timestep)
+    {
+        // The closing kick's forces are the next step's opening forces
+        if (!haveAccels || accels.size() != bodies.Size())
+            gravity.Compute(bodies, accels);
+
+        kickBodies(bodies, accels, timestep * 0.5, gravity.pool);
+        driftBodies(bodies, timestep, gravity.pool);
+        gravity.Compute(bodies, accels);
+        kickBodies(bodies, accels, timestep * 0.5, gravity.pool);
+        haveAccels = true;
+    }
+
+    void Reset() { haveAccels = false; }
+    bool ForcesAtStepEnd() const { return true; }
+
+    void SaveState(std::vector<char> &out) const
+    {
+        StateWriter writer(out);
+        writer.Write((uint8_t)haveAccels);
+        writer.WriteVector(accels);
+    }
+
+    bool LoadState(const std::vector<char> &state)
+    {
+        StateReader reader(state);
+        uint8_t cached;
+        if (!reader.Read(cached) || !reader.ReadVector(accels) || !reader.Done())
+            return false;
+        haveAccels = cached != 0;
+        return true;
+    }
+
+private:
+    std::vector<std::array<float, 3>> accels;
+    bool haveAccels = false;
+};
+
+class Yoshida4Integrator : public Integrator
+{
+public:
+    IntegratorType Type() const { return YOSHIDA4; }
+
+    void Step(BodyStore &bodies, GravitySolver &gravity, double timestep)
+    {
+        // Yoshida (1990) triple-jump coefficients
+        const double cbrt2 = cbrt(2.0);
+        const double w1 = 1.0 / (2.0 - cbrt2);
+        const double w0 = -cbrt2 / (2.0 - cbrt2);
+        const double drift[4] = {w1 * 0.5, (w0 + w1) * 0.5, (w0 + w1) * 0.5, w1 * 0.5};
+        const double kick[3] = {w1, w0, w1};
+
+        for (int stage = 0; stage < 3; ++stage)
+        {
+            driftBodies(bodies, drift[stage] * timestep, gravity.pool);
+            gravity.Compute(bodies, accels);
+            kickBodies(bodies, accels, kick[stage] * timestep, gravity.pool);
+        }
+        driftBodies(bodies, drift[3] * timestep, gravity.pool);
+    }
+
+private:
+    std::vector<std::array<float, 3>> accels;
+};
+
+// Wisdom-Holman map in democratic heliocentric coordinates (Duncan, Levison
+// & Lee 1998): heliocentric positions, barycentric velocities. Each step is
+//   interaction kick (dt/2), Sun jump (dt/2), Kepler drift (dt),
+//   Sun jump (dt/2), interaction kick (dt/2)
+// where the Kepler drift is solved exactly around body 0. Interaction forces
+// come from the regular solver with the Sun's mass switched off.
+class WisdomHolmanIntegrator : public Integrator
+{
+public:
+    IntegratorType Type() const { return WISDOM_HOLMAN; }
+
+    void Step(BodyStore &bodies, GravitySolver &gravity, double timestep)
+    {
+        size_t n = bodies.Size();
+        if (n < 2 || bodies.mass[0] <= 0.0)
+        {
+            // Nothing dominates; fall back to a plain leapfrog step
+            fallback.Step(bodies, gravity, timestep);
+            return;
+        }
+
+        ToDemocraticHeliocentric(bodies);
+
+        const double mu = FORCE_SCALE * bodies.mass[0];
+        const double halfStep = timestep * 0.5;
+
+        InteractionKick(bodies, gravity, halfStep);
+        SunJump(halfStep);
+        // Every orbit is solved on its own, so belts of test particles spread over the pool
+        auto drift = [&](size_t begin, size_t end)
+        {
+            for (size_t i = std::max<size_t>(begin, 1); i < end; ++i)
+            {
+                double *r = &q[i * 3];
+                double *v = &p[i * 3];
+                if (!keplerDrift(r, v, mu, timestep))
+                {
+                    // Unbound or singular orbit the solver cannot handle: drift straight
+                    r[0] += v[0] * timestep;
+                    r[1] += v[1] * timestep;
+                    r[2] += v[2] * timestep;
+                }
+            }
+        };
+        if (gravity.pool)
+            gravity.pool->ParallelFor(n, KEPLER_GRAIN, drift);
+        else
+            drift(0, n);
+        SunJump(halfStep);
+        InteractionKick(bodies, gravity, halfStep);
+
+        FromDemocraticHeliocentric(bodies, timestep);
+    }
+
+    void Reset() { fallback.Reset(); }
+
+    // Coordinates are rebuilt from the bodies every step; only the fallback caches forces
+    void SaveState(std::vector<char> &out) const { fallback.SaveState(out); }
+    bool LoadState(const std::vector<char> &state) { return state.empty() || fallback.LoadState(state); }
+
+private:
+    void ToDemocraticHeliocentric(const BodyStore &bodies)
+    {
+        size_t n = bodies.Size();
+        q.assign(n * 3, 0.0);
+        p.assign(n * 3, 0.0);
+
+        totalMass = 0.0;
+        double com[3] = {0.0, 0.0, 0.0};
+        double vcm[3] = {0.0, 0.0, 0.0};
+        for (size_t i = 0; i < n; ++i)
+        {
+            double m = bodies.mass[i];
+            totalMass += m;
+            com[0] += m * bodies.x[i];
+            com[1] += m * bodies.y[i];
+            com[2] += m * bodies.z[i];
+            vcm[0] += m * bodies.vx[i];
+            vcm[1] += m * bodies.vy[i];
+            vcm[2] += m * bodies.vz[i];
+        }
+        for (int k = 0; k < 3; ++k)
+        {
+            centerOfMass[k] = com[k] / totalMass;
+            centerOfMassVelocity[k] = vcm[k] / totalMass;
+        }
+
+        for (size_t i = 1; i < n; ++i)
+        {
+            q[i * 3 + 0] = (double)bodies.x[i] - bodies.x[0];
+            q[i * 3 + 1] = (double)bodies.y[i] - bodies.y[0];
+            q[i * 3 + 2] = (double)bodies.z[i] - bodies.z[0];
+            p[i * 3 + 0] = bodies.vx[i] - centerOfMassVelocity[0];
+            p[i * 3 + 1] = bodies.vy[i] - centerOfMassVelocity[1];
+            p[i * 3 + 2] = bodies.vz[i] - centerOfMassVelocity[2];
+        }
+        masses.assign(bodies.mass.begin(), bodies.mass.end());
+    }
+
+    void FromDemocraticHeliocentric(BodyStore &bodies, double timestep)
+    {
+        size_t n = bodies.Size();
+
+        // The barycenter moves uniformly; the Sun sits where it balances the planets
+        double sunPos[3], sunVel[3] = {0.0, 0.0, 0.0};
+        double weighted[3] = {0.0, 0.0, 0.0};
+        for (size_t i = 1; i < n; ++i)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                weighted[k] += masses[i] * q[i * 3 + k];
+                sunVel[k] -= masses[i] * p[i * 3 + k];
+            }
+        }
+        for (int k = 0; k < 3; ++k)
+        {
+            sunPos[k] = centerOfMass[k] + centerOfMassVelocity[k] * timestep - weighted[k] / totalMass;
+            sunVel[k] = sunVel[k] / masses[0] + centerOfMassVelocity[k];
+        }
+
+        bodies.x[0] = (float)sunPos[0];
+        bodies.y[0] = (float)sunPos[1];
+        bodies.z[0] = (float)sunPos[2];
+        bodies.vx[0] = (float)sunVel[0];
+        bodies.vy[0] = (float)sunVel[1];
+        bodies.vz[0] = (float)sunVel[2];
+        for (size_t i = 1; i < n; ++i)
+        {
+            bodies.x[i] = (float)(sunPos[0] + q[i * 3 + 0]);
+            bodies.y[i] = (float)(sunPos[1] + q[i * 3 + 1]);
+            bodies.z[i] = (float)(sunPos[2] + q[i * 3 + 2]);
+            bodies.vx[i] = (float)(p[i * 3 + 0] + centerOfMassVelocity[0]);
+            bodies.vy[i] = (float)(p[i * 3 + 1] + centerOfMassVelocity[1]);
+            bodies.vz[i] = (float)(p[i * 3 + 2] + centerOfMassVelocity[2]);
+        }
+    }
+
+    // Planet-planet forces only: place the heliocentric positions in the
+    // store and evaluate with the Sun's mass temporarily zeroed
+    void InteractionKick(BodyStore &bodies, GravitySolver &gravity, double dt)
+    {
+        size_t n = bodies.Size();
+        bodies.x[0] = bodies.y[0] = bodies.z[0] = 0.0f;
+        for (size_t i = 1; i < n; ++i)
+        {
+            bodies.x[i] = (float)q[i * 3 + 0];
+            bodies.y[i] = (float)q[i * 3 + 1];
+            bodies.z[i] = (float)q[i * 3 + 2];
+        }
+
+        double sunMass = bodies.mass[0];
+        bodies.mass[0] = 0.0;
+        gravity.Compute(bodies, accels);
+        bodies.mass[0] = sunMass;
+
+        for (size_t i = 1; i < n; ++i)
+        {
+            p[i * 3 + 0] += accels[i][0] * dt;
+            p[i * 3 + 1] += accels[i][1] * dt;
+            p[i * 3 + 2] += accels[i][2] * dt;
+        }
+    }
+
+    // Heliocentric positions shift with the Sun's recoil: dq = dt * sum(m_j v_j) / m_0
+    void SunJump(double dt)
+    {
+        size_t n = masses.size();
+        double momentum[3] = {0.0, 0.0, 0.0};
+        for (size_t i = 1; i < n; ++i)
+        {
+            for (int k = 0; k < 3; ++k)
+                momentum[k] += masses[i] * p[i * 3 + k];
+        }
+        for (size_t i = 1; i < n; ++i)
+        {
+            for (int k = 0; k < 3; ++k)
+                q[i * 3 + k] += dt * momentum[k] / masses[0];
+        }
+    }
+
+    std::vector<double> q; // heliocentric positions (pixels)
+    std::vector<double> p; // barycentric velocities (pixels / s)
+    std::vector<double> masses;
+    double totalMass = 0.0;
+    double centerOfMass[3];
+    double centerOfMassVelocity[3];
+    std::vector<std::array<float, 3>> accels;
+    LeapfrogIntegrator fallback;
+};
+
+// Hierarchical block timesteps (Aarseth 1985; Makino 1991) on a KDK leapfrog.
+//
+// Each body has a level L and steps by timestep / 2^L. Time inside one
+// Step() is counted in integer ticks of timestep / 2^maxLevel, so every
+// body's step boundary lands exactly on a tick and all bodies are
+// synchronized again at the end of Step(). Positions of every body are
+// drifted between consecutive block boundaries (cheap, O(n)), but forces are
+// only recomputed for the active block whose step ends at that boundary.
+class BlockTimestepIntegrator : public Integrator
+{
+public:
+    explicit BlockTimestepIntegrator(const BlockTimestepSettings &blockSettings) : settings(blockSettings) {}
+
+    IntegratorType Type() const { return BLOCK_TIMESTEP; }
+    bool ForcesAtStepEnd() const { return true; } // every body closes its step in the last pass
+
+    void Reset() { initialized = false; }
+
+    void SaveState(std::vector<char> &out) const
+    {
+        StateWriter writer(out);
+        writer.Write((uint32_t)settings.criterion);
+        writer.Write(settings.eta);
+        writer.Write((int32_t)settings.maxLevel);
+        writer.Write((uint8_t)initialized);
+        writer.WriteVector(accels);
+        writer.WriteVector(jerks);
+        writer.WriteVector(haveJerk);
+        writer.WriteVector(levels);
+    }
+
+    bool LoadState(const std::vector<char> &state)
+    {
+        StateReader reader(state);
+        uint32_t criterion;
+        int32_t maxLevel;
+        uint8_t cached;
+        if (!reader.Read(criterion) || !reader.Read(settings.eta) || !reader.Read(maxLevel) || !reader.Read(cached) ||
+            !reader.ReadVector(accels) || !reader.ReadVector(jerks) || !reader.ReadVector(haveJerk) ||
+            !reader.ReadVector(levels) || !reader.Done())
+            return false;
+        settings.criterion = (TimestepCriterion)criterion;
+        settings.maxLevel = maxLevel;
+        initialized = cached != 0;
+        return true;
+    }
+
+    void Step(BodyStore &bodies, GravitySolver &gravity, double timestep)
+    {
+        size_t n = bodies.Size();
+        const int maxLevel = std::max(0, std::min(settings.maxLevel, 30));
+        const uint64_t totalTicks = (uint64_t)1 << maxLevel;
+        const double tick = timestep / (double)totalTicks;
+
+        if (!initialized || accels.size() != n || levels.size() != n)
+        {
+            gravity.Compute(bodies, accels);
+            jerks.assign(n, {{0.0, 0.0, 0.0}});
+            haveJerk.assign(n, 0);
+            levels.assign(n, 0);
+            initialized = true;
+        }
+        nextTick.resize(n);
+
+        // Everyone is synchronized at the start: pick steps and open with a half kick
+        for (size_t i = 0; i < n; ++i)
+        {
+            levels[i] = ChooseLevel(bodies, i, timestep, maxLevel, 0);
+            OpenStep(bodies, i, timestep);
+            nextTick[i] = totalTicks >> levels[i];
+        }
+
+        uint64_t now = 0;
+        while (now < totalTicks)
+        {
+            uint64_t next = totalTicks;
+            for (size_t i = 0; i < n; ++i)
+                next = std::min(next, nextTick[i]);
+
+            driftBodies(bodies, (double)(next - now) * tick, gravity.pool);
+            now = next;
+
+            active.clear();
+            previous.clear();
+            for (size_t i = 0; i < n; ++i)
+            {
+                if (nextTick[i] == now)
+                {
+                    active.push_back((uint32_t)i);
+                    previous.push_back(accels[i]);
+                }
+            }
+
+            gravity.ComputeSubset(bodies, active, accels);
+
+            for (size_t k = 0; k < active.size(); ++k)
+            {
+                size_t i = active[k];
+                double dt = timestep / (double)((uint64_t)1 << levels[i]);
+
+                for (int c = 0; c < 3; ++c)
+                    jerks[i][c] = (accels[i][c] - previous[k][c]) / dt;
+                haveJerk[i] = 1;
+
+                // Close the finished step, then open the next one unless we are done
+                bodies.vx[i] += (float)(accels[i][0] * dt * 0.5);
+                bodies.vy[i] += (float)(accels[i][1] * dt * 0.5);
+                bodies.vz[i] += (float)(accels[i][2] * dt * 0.5);
+
+                if (now < totalTicks)
+                {
+                    levels[i] = ChooseLevel(bodies, i, timestep, maxLevel, now);
+                    OpenStep(bodies, i, timestep);
+                    nextTick[i] = now + (totalTicks >> levels[i]);
+                }
+            }
+        }
+    }
+
+private:
+    int ChooseLevel(const BodyStore &bodies, size_t i, double timestep, int maxLevel, uint64_t now) const
+    {
+        double ax = accels[i][0], ay = accels[i][1], az = accels[i][2];
+        double a = sqrt(ax * ax + ay * ay + az * az);
+
+        double wanted = timestep;
+        if (settings.criterion == JERK_CRITERION && haveJerk[i])
+        {
+            double j = sqrt(jerks[i][0] * jerks[i][0] + jerks[i][1] * jerks[i][1] + jerks[i][2] * jerks[i][2]);
+            if (j > 0.0)
+                wanted = settings.eta * a / j;
+        }
+        else if (a > 0.0)
+        {
+            wanted = settings.eta * sqrt(bodies.Radius(i) / a);
+        }
+
+        int level = 0;
+        while (level < maxLevel && timestep / (double)((uint64_t)1 << level) > wanted)
+            ++level;
+
+        // Steps may shrink at any boundary, but only grow one level at a time
+        // and only where the larger step stays aligned to the block grid
+        int current = levels[i];
+        if (level < current)
+        {
+            level = current - 1;
+            uint64_t ticks = ((uint64_t)1 << maxLevel) >> level;
+            if (now % ticks != 0)
+                level = current;
+        }
+        return level;
+    }
+
+    void OpenStep(BodyStore &bodies, size_t i, double timestep)
+    {
+        double dt = timestep / (double)((uint64_t)1 << levels[i]);
+        bodies.vx[i] += (float)(accels[i][0] * dt * 0.5);
+        bodies.vy[i] += (float)(accels[i][1] * dt * 0.5);
+        bodies.vz[i] += (float)(accels[i][2] * dt * 0.5);
+    }
+
+    BlockTimestepSettings settings;
+    bool initialized = false;
+    std::vector<std::array<float, 3>> accels;
+    std::vector<std::array<double, 3>> jerks;
+    std::vector<char> haveJerk;
+    std::vector<int> levels;
+    std::vector<uint64_t> nextTick;
+    std::vector<uint32_t> active;
+    std::vector<std::array<float, 3>> previous;
+};
+
+std::unique_ptr<Integrator> createIntegrator(IntegratorType type, const BlockTimestepSettings &blockSettings)
+{
+    switch (type)
+    {
+    case LEAPFROG_KDK:
+        return std::unique_ptr<Integrator>(new LeapfrogIntegrator());
+    case YOSHIDA4:
+        return std::unique_ptr<Integrator>(new Yoshida4Integrator());
+    case WISDOM_HOLMAN:
+        return std::unique_ptr<Integrator>(new WisdomHolmanIntegrator());
+    case BLOCK_TIMESTEP:
+        return std::unique_ptr<Integrator>(new BlockTimestepIntegrator(blockSettings));
+    default:
+        return std::unique_ptr<Integrator>(new SymplecticEulerIntegrator());
+    }
+}
+
+// Stumpff functions c2(z) and c3(z), with series near zero to avoid cancellation
+static void stumpff(double z, double &c2, double &c3)
+{
+    if (z > 1e-4)
+    {
+        double s = sqrt(z);
+        c2 = (1.0 - cos(s)) / z;
+        c3 = (s - sin(s)) / (z * s);
+    }
+    else if (z < -1e-4)
+    {
+        double s = sqrt(-z);
+        c2 = (cosh(s) - 1.0) / -z;
+        c3 = (sinh(s) - s) / (-z * s);
+    }
+    else
+    {
+        c2 = 0.5 - z / 24.0 + z * z / 720.0;
+        c3 = 1.0 / 6.0 - z / 120.0 + z * z / 5040.0;
+    }
+}
+
+bool keplerDrift(double r[3], double v[3], double mu, double dt)
+{
+    double r0 = sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+    if (r0 <= 0.0 || mu <= 0.0)
+        return false;
+
+    double v2 = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+    double sqrtMu = sqrt(mu);
+    double rdotv = r[0] * v[0] + r[1] * v[1] + r[2] * v[2];
+    double alpha = 2.0 / r0 - v2 / mu; // 1 / semi-major axis
+    double sigma0 = rdotv / sqrtMu;
+
+    // Solve the universal Kepler equation for chi with Laguerre-Conway iterations
+    double chi = sqrtMu * dt / r0;
+    if (alpha > 0.0)
+        chi = sqrtMu * dt * alpha;
+
+    const double n = 5.0;
+    bool converged = false;
+    double c2 = 0.5, c3 = 1.0 / 6.0;
+    for (int iteration = 0; iteration < 50; ++iteration)
+    {
+        double chi2 = chi * chi;
+        double z = alpha * chi2;
+        stumpff(z, c2, c3);
+
+        double f = sigma0 * chi2 * c2 + (1.0 - alpha * r0) * chi2 * chi * c3 + r0 * chi - sqrtMu * dt;
+        double df = sigma0 * chi * (1.0 - z * c3) + (1.0 - alpha * r0) * chi2 * c2 + r0;
+        double ddf = sigma0 * (1.0 - z * c2) + (1.0 - alpha * r0) * chi * (1.0 - z * c3);
+
+        double disc = fabs((n - 1.0) * (n - 1.0) * df * df - n * (n - 1.0) * f * ddf);
+        double denom = df + (df >= 0.0 ? 1.0 : -1.0) * sqrt(disc);
+        if (denom == 0.0)
+            break;
+
+        double delta = n * f / denom;
+        chi -= delta;
+        if (fabs(delta) <= 1e-13 * std::max(1.0, fabs(chi)))
+        {
+            converged = true;
+            break;
+        }
+    }
+    if (!converged || !std::isfinite(chi))
+        return false;
+
+    double chi2 = chi * chi;
+    stumpff(alpha * chi2, c2, c3);
+
+    // Lagrange coefficients
+    double f = 1.0 - chi2 / r0 * c2;
+    double g = dt - chi2 * chi / sqrtMu * c3;
+    double newR[3] = {f * r[0] + g * v[0], f * r[1] + g * v[1], f * r[2] + g * v[2]};
+    double r1 = sqrt(newR[0] * newR[0] + newR[1] * newR[1] + newR[2] * newR[2]);
+    double fdot = sqrtMu / (r1 * r0) * (alpha * chi2 * chi * c3 - chi);
+    double gdot = 1.0 - chi2 / r1 * c2;
+
+    for (int k = 0; k < 3; ++k)
+    {
+        double vk = fdot * r[k] + gdot * v[k];
+        r[k] = newR[k];
+        v[k] = vk;
+    }
+    return true;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "bodies.h"
+#include "physics.h"
+
+enum IntegratorType
+{
+    SYMPLECTIC_EULER, // first order: kick then drift (the original update)
+    LEAPFROG_KDK,     // second order kick-drift-kick, one force evaluation per step
+    YOSHIDA4,         // fourth order composition of leapfrogs, three force evaluations per step
+    WISDOM_HOLMAN,    // mixed-variable map around body 0 (the Sun), one force evaluation per step
+    BLOCK_TIMESTEP    // leapfrog with individual power-of-two steps per body
+};
+
+// How the block timestep integrator picks each body's step
+enum TimestepCriterion
+{
+    ACCELERATION_CRITERION, // dt = eta * sqrt(radius / |a|)
+    JERK_CRITERION          // dt = eta * |a| / |da/dt|, jerk estimated from successive forces
+};
+
+struct BlockTimestepSettings
+{
+    TimestepCriterion criterion = JERK_CRITERION;
+    double eta = 0.03; // accuracy parameter, smaller is more accurate
+    int maxLevel = 10; // the finest step is timestep / 2^maxLevel
+};
+
+const char *integratorName(IntegratorType type);
+
+// Command-line names: "euler", "leapfrog", "yoshida4", "wisdom-holman", "block"
+bool parseIntegratorType(const char *name, IntegratorType &type);
+
+// Advances a BodyStore by one step, pulling forces from a GravitySolver.
+// Integrators may cache forces between steps; call Reset() whenever bodies
+// are added, removed or moved outside of Step().
+class Integrator
+{
+public:
+    virtual ~Integrator() {}
+
+    virtual IntegratorType Type() const = 0;
+    virtual void Step(BodyStore &bodies, GravitySolver &gravity, double timestep) = 0;
+    virtual void Reset() {}
+
+    // True if the last force pass of Step() sees the positions Step() leaves
+    // behind, so potentials tracked by the solver describe the final state
+    virtual bool ForcesAtStepEnd() const { return false; }
+
+    // Cached state carried between steps (forces, per-body levels), as an
+    // opaque blob for checkpoints. An integrator that loads a saved blob
+    // continues bit for bit where the saved one stopped.
+    virtual void SaveState(std::vector<char> &out) const { out.clear(); }
+    virtual bool LoadState(const std::vector<char> &state) { return state.empty(); }
+};
+
+std::unique_ptr<Integrator> createIntegrator(IntegratorType type,
+                                             const BlockTimestepSettings &blockSettings = BlockTimestepSettings());
+
+// Advance a two-body orbit (position r, velocity v relative to the central
+// body with gravitational parameter mu) by dt using universal variables.
+// Returns false if the solver did not converge, leaving r and v untouched.
+bool keplerDrift(double r[3], double v[3], double mu, double dt);
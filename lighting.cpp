@@ -0,0 +1,58 @@
+#include "lighting.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Advanced lighting calculation with much brighter lighting
+float calculateLightIntensity(const float lightPos[3], const float objectPos[3],
+                              const std::vector<std::array<float, 4>> &blackHoles)
+{
+    float dx = lightPos[0] - objectPos[0];
+    float dy = lightPos[1] - objectPos[1];
+    float dz = lightPos[2] - objectPos[2];
+    float distanceToLight = sqrt(dx * dx + dy * dy + dz * dz);
+
+    if (distanceToLight < 1.0f)
+        return 1.0f; // At light source
+
+    // Much brighter base intensity with slower falloff
+    float baseIntensity = 0.8f + (200000.0f / (distanceToLight + 100.0f));
+    baseIntensity = std::min(1.0f, baseIntensity); // Cap at 1.0
+
+    // Check light absorption by black holes (only strong shadows very close to black holes)
+    for (const auto &blackHole : blackHoles)
+    {
+        float bhx = blackHole[0] - objectPos[0];
+        float bhy = blackHole[1] - objectPos[1];
+        float bhz = blackHole[2] - objectPos[2];
+        float distanceToBlackHole = sqrt(bhx * bhx + bhy * bhy + bhz * bhz);
+
+        // Event horizon radius (simplified)
+        float eventHorizonRadius = blackHole[3]; // Stored as 4th element
+
+        // Only cast shadows if very close to black hole
+        if (distanceToBlackHole < eventHorizonRadius * 2.0f)
+        {
+            // Check if black hole is between light and object
+            float lightToBH_x = blackHole[0] - lightPos[0];
+            float lightToBH_y = blackHole[1] - lightPos[1];
+            float lightToBH_z = blackHole[2] - lightPos[2];
+            float lightToObj_x = objectPos[0] - lightPos[0];
+            float lightToObj_y = objectPos[1] - lightPos[1];
+            float lightToObj_z = objectPos[2] - lightPos[2];
+
+            float dotProduct = lightToBH_x * lightToObj_x + lightToBH_y * lightToObj_y + lightToBH_z * lightToObj_z;
+            float lightToObj_mag = sqrt(lightToObj_x * lightToObj_x + lightToObj_y * lightToObj_y + lightToObj_z * lightToObj_z);
+            float lightToBH_mag = sqrt(lightToBH_x * lightToBH_x + lightToBH_y * lightToBH_y + lightToBH_z * lightToBH_z);
+
+            if (dotProduct > 0 && lightToBH_mag < lightToObj_mag)
+            {
+                // Black hole is between light and object - reduce shadow effect
+                float shadowStrength = 1.0f - (distanceToBlackHole / (eventHorizonRadius * 2.0f));
+                baseIntensity *= (1.0f - shadowStrength * 0.4f); // Reduced shadow strength
+            }
+        }
+    }
+
+    return std::max(0.4f, baseIntensity); // Much higher minimum ambient light
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+// Brightness (0.4 to 1) of a planet at objectPos lit from lightPos, with
+// shadows from nearby black holes; each black hole is x, y, z, radius
+float calculateLightIntensity(const float lightPos[3], const float objectPos[3],
+                              const std::vector<std::array<float, 4>> &blackHoles);
@@ -1,27 +1,33 @@
-#define GL_SILENCE_DEPRECATION
+#include "gl_platform.h"
 #include <GLFW/glfw3.h>
-#include <OpenGL/gl.h>
-#include <OpenGL/glu.h>
 #include <stdio.h>
+#include <cstdlib>
+#include <cstring>
 #include <cmath>
 #include <vector>
 #include <array>
 #include <iostream>
 #include <algorithm>
+#include <memory>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp> // for radians()
+#include "bodies.h"
+#include "curvature_field.h"
+#include "integrators.h"
+#include "lighting.h"
+#include "mesh_cache.h"
+#include "physics.h"
+#include "profiler.h"
+#include "scenario.h"
+#include "simulation.h"
+#include "thread_pool.h"
+#include "trajectory_player.h"
+#include "units.h"
+#include "view_frustum.h"
 
 const int WINDOW_WIDTH = 800 * 1.5;
 const int WINDOW_HEIGHT = 600 * 1.5;
 
-// Use a scaled distance system:
-// Scale all planet distances so Neptune fits around 90% of window width.
-const double REAL_NEPTUNE_DISTANCE_M = 4.495e12;            // meters (4.495 billion km)
-const float MAX_ORBIT_RADIUS_PIXELS = WINDOW_WIDTH * 0.45f; // max radius for Neptune orbit in pixels
-
-// Calculate a scale factor so Neptune’s orbit fits on screen
-const double DISTANCE_SCALE = REAL_NEPTUNE_DISTANCE_M / MAX_ORBIT_RADIUS_PIXELS; // meters per pixel
-
 // Global camera variables
 float cameraDistance = 1000.0f;
 float cameraAngleX = 115.0f; // pitch (degrees) - top/down
@@ -38,13 +44,22 @@ const float GRID_SPACING = 50.0f;                          // Distance between g
 const float GRID_SPACING_3D = 20.0f;                       // Distance between grid points for 3D
 const float GRID_EXTENT = GRID_SIZE * GRID_SPACING / 2.0f; // Half the grid size
 
-// Celestial object types
-enum CelestialType
-{
-    PLANET,
-    STAR,
-    BLACK_HOLE
-};
+// Gravity solver settings (B cycles the solvers, [ and ] change the Barnes-Hut opening angle)
+ForceSettings forceSettings;
+
+// Time integrator (I cycles Euler / leapfrog / Yoshida / Wisdom-Holman / block timesteps)
+IntegratorType integratorType = LEAPFROG_KDK;
+
+// Physics runs on its own thread; key presses queue changes on it (-/= change the step rate)
+SimulationThread *simulation = nullptr;
+
+// Set instead of simulation when playing back a recorded trajectory (--replay FILE):
+// space pauses, ,/. scrub, -/= change playback speed
+TrajectoryPlayer *replay = nullptr;
+
+// P prints a per-phase frame time summary every couple of seconds (builds with make PROFILE=1)
+bool showProfile = false;
+const double PROFILE_SUMMARY_INTERVAL = 2.0;
 
 // --- helpers for vector math (small, inline) ---
 static inline void vec3_normalize(float v[3])
@@ -100,226 +115,89 @@ static inline void computeRolledUpVector(const float forward[3], float rollRadia
     vec3_normalize(outUp);
 }
 
-// Advanced lighting calculation with much brighter lighting
-float calculateLightIntensity(const std::vector<float> &lightPos, const std::vector<float> &objectPos,
-                              const std::vector<std::vector<float>> &blackHoles)
-{
-    float dx = lightPos[0] - objectPos[0];
-    float dy = lightPos[1] - objectPos[1];
-    float dz = lightPos[2] - objectPos[2];
-    float distanceToLight = sqrt(dx * dx + dy * dy + dz * dz);
-
-    if (distanceToLight < 1.0f)
-        return 1.0f; // At light source
-
-    // Much brighter base intensity with slower falloff
-    float baseIntensity = 0.8f + (200000.0f / (distanceToLight + 100.0f));
-    baseIntensity = std::min(1.0f, baseIntensity); // Cap at 1.0
-
-    // Check light absorption by black holes (only strong shadows very close to black holes)
-    for (const auto &blackHole : blackHoles)
-    {
-        float bhx = blackHole[0] - objectPos[0];
-        float bhy = blackHole[1] - objectPos[1];
-        float bhz = blackHole[2] - objectPos[2];
-        float distanceToBlackHole = sqrt(bhx * bhx + bhy * bhy + bhz * bhz);
-
-        // Event horizon radius (simplified)
-        float eventHorizonRadius = blackHole[3]; // Stored as 4th element
-
-        // Only cast shadows if very close to black hole
-        if (distanceToBlackHole < eventHorizonRadius * 2.0f)
-        {
-            // Check if black hole is between light and object
-            float lightToBH_x = blackHole[0] - lightPos[0];
-            float lightToBH_y = blackHole[1] - lightPos[1];
-            float lightToBH_z = blackHole[2] - lightPos[2];
-            float lightToObj_x = objectPos[0] - lightPos[0];
-            float lightToObj_y = objectPos[1] - lightPos[1];
-            float lightToObj_z = objectPos[2] - lightPos[2];
-
-            float dotProduct = lightToBH_x * lightToObj_x + lightToBH_y * lightToObj_y + lightToBH_z * lightToObj_z;
-            float lightToObj_mag = sqrt(lightToObj_x * lightToObj_x + lightToObj_y * lightToObj_y + lightToObj_z * lightToObj_z);
-            float lightToBH_mag = sqrt(lightToBH_x * lightToBH_x + lightToBH_y * lightToBH_y + lightToBH_z * lightToBH_z);
-
-            if (dotProduct > 0 && lightToBH_mag < lightToObj_mag)
-            {
-                // Black hole is between light and object - reduce shadow effect
-                float shadowStrength = 1.0f - (distanceToBlackHole / (eventHorizonRadius * 2.0f));
-                baseIntensity *= (1.0f - shadowStrength * 0.4f); // Reduced shadow strength
-            }
-        }
-    }
-
-    return std::max(0.4f, baseIntensity); // Much higher minimum ambient light
-}
-
+// Thin handle onto one body in the BodyStore, used by the drawing code
 class CelestialObject
 {
 private:
-    std::vector<float> position = {0, 0, 0}; // 3D position (pixels)
-    std::vector<float> velocity = {0, 0, 0}; // 3D velocity (pixels per second)
+    const BodyStore &bodies;
+    size_t index;
 
 public:
-    std::vector<float> hue = {1.0f, 1.0f, 1.0f, 1.0f};
-    double mass;             // kg
-    double density = 1400.0; // kg/m^3 approx for planets
-    CelestialType type;
-
-    CelestialObject(std::vector<float> initPosition, std::vector<float> initVelocity, double mass,
-                    std::vector<float> color, CelestialType objectType = PLANET)
-        : position(initPosition), velocity(initVelocity), mass(mass), hue(color), type(objectType) {}
-
-    void UpdatePos(double timestep)
-    {
-        position[0] += velocity[0] * timestep;
-        position[1] += velocity[1] * timestep;
-        position[2] += velocity[2] * timestep;
-    }
+    CelestialObject(const BodyStore &store, size_t bodyIndex) : bodies(store), index(bodyIndex) {}
 
-    std::vector<float> GetCoord() const
+    // Where the body is drawn: its offset plus the store's origin
+    std::array<float, 3> GetCoord() const
     {
-        return position;
+        const std::array<double, 3> r = bodies.Position(index);
+        return {{(float)r[0], (float)r[1], (float)r[2]}};
     }
 
-    std::vector<float> GetVelocity() const
+    std::array<float, 3> GetVelocity() const
     {
-        return velocity;
-    }
-
-    void SetVelocity(const std::vector<float> &v)
-    {
-        velocity = v;
+        return {{bodies.vx[index], bodies.vy[index], bodies.vz[index]}};
     }
 
     float GetRadius() const
     {
-        if (type == BLACK_HOLE)
-        {
-            // Schwarzschild radius for black hole event horizon
-            const double c = 299792458.0; // speed of light
-            const double G = 6.67430e-11;
-            double schwarzschildRadius = (2.0 * G * mass) / (c * c);
-            return (float)(schwarzschildRadius / DISTANCE_SCALE * 1000000); // Scale for visibility
-        }
-
-        double volume = mass / density;
-        double radiusMeters = pow((3.0 * volume) / (4.0 * M_PI), 1.0 / 3.0);
-
-        const double SUN_SCALE_FACTOR = 5e6;
-        const double PLANET_SCALE_FACTOR = 1e6;
-
-        double radiusPixels;
-        if (mass > 1e29 || type == STAR)
-        {
-            radiusPixels = radiusMeters / SUN_SCALE_FACTOR;
-            const double MAX_SUN_RADIUS = 250.0;
-            if (radiusPixels > MAX_SUN_RADIUS)
-                radiusPixels = MAX_SUN_RADIUS;
-        }
-        else
-        {
-            radiusPixels = radiusMeters / PLANET_SCALE_FACTOR;
-            const double MIN_PLANET_RADIUS = 6.0;
-            if (radiusPixels < MIN_PLANET_RADIUS)
-                radiusPixels = MIN_PLANET_RADIUS;
-        }
-
-        return (float)radiusPixels;
+        return bodies.Radius(index);
     }
 
-    void DrawAccretionDisk(float innerRadius, float outerRadius) const
+    void DrawAccretionDisk(const MeshCache &meshes) const
     {
         glDisable(GL_LIGHTING); // Disable lighting for the glowing disk
         glEnable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-        int segments = 64;
-        int rings = 16;
-
-        for (int ring = 0; ring < rings; ++ring)
-        {
-            float r1 = innerRadius + (outerRadius - innerRadius) * ring / rings;
-            float r2 = innerRadius + (outerRadius - innerRadius) * (ring + 1) / rings;
-
-            // Color gradient from hot inner (white/yellow) to cooler outer (red/orange)
-            float intensity = 1.0f - (float)ring / rings;
-            glColor4f(1.0f, 0.6f + 0.4f * intensity, 0.2f * intensity, 0.3f + 0.4f * intensity);
-
-            glBegin(GL_TRIANGLE_STRIP);
-            for (int i = 0; i <= segments; ++i)
-            {
-                float angle = 2.0f * M_PI * i / segments;
-                float x1 = r1 * cosf(angle);
-                float z1 = r1 * sinf(angle);
-                float x2 = r2 * cosf(angle);
-                float z2 = r2 * sinf(angle);
-
-                glVertex3f(x1, 0, z1);
-                glVertex3f(x2, 0, z2);
-            }
-            glEnd();
-        }
+        meshes.DrawAccretionDisk();
 
         glDisable(GL_BLEND);
         glEnable(GL_LIGHTING);
     }
 
-    void DrawSphere(float radius, int slices, int stacks, const std::vector<float> &lightPos,
-                    const std::vector<std::vector<float>> &blackHoles) const
+    // Surface colour, including lighting and black hole shadows for planets
+    std::array<float, 4> GetColor(const float lightPos[3], const std::vector<std::array<float, 4>> &blackHoles) const
     {
-        glPushMatrix();
-        glTranslatef(position[0], position[1], position[2]);
-
-        // Calculate lighting intensity based on light sources and black hole shadows
-        if (type == STAR)
+        const std::array<float, 4> &hue = bodies.hue[index];
+        switch (bodies.type[index])
         {
-            // Stars emit their own light - disable lighting temporarily
-            glDisable(GL_LIGHTING);
-            glColor4f(hue[0], hue[1], hue[2], hue[3]);
-        }
-        else if (type == BLACK_HOLE)
+        case STAR:
+            return hue;
+        case BLACK_HOLE:
+            return {{0.0f, 0.0f, 0.0f, 1.0f}}; // pure black sphere
+        default:
         {
-            // Black holes absorb light - draw as pure black sphere
-            glDisable(GL_LIGHTING);
-            glColor4f(0.0f, 0.0f, 0.0f, 1.0f);
+            const std::array<float, 3> position = GetCoord();
+            float lightIntensity = calculateLightIntensity(lightPos, position.data(), blackHoles);
+            return {{hue[0] * lightIntensity, hue[1] * lightIntensity, hue[2] * lightIntensity, hue[3]}};
         }
-        else
-        {
-            // Planets receive lighting
-            float lightIntensity = calculateLightIntensity(lightPos, position, blackHoles);
-            glColor4f(hue[0] * lightIntensity, hue[1] * lightIntensity, hue[2] * lightIntensity, hue[3]);
         }
+    }
 
-        // Draw sphere using triangles
-        for (int i = 0; i < stacks; ++i)
-        {
-            float lat1 = M_PI * (-0.5f + (float)i / stacks);
-            float lat2 = M_PI * (-0.5f + (float)(i + 1) / stacks);
-
-            glBegin(GL_TRIANGLE_STRIP);
-            for (int j = 0; j <= slices; ++j)
-            {
-                float lng = 2 * M_PI * (float)j / slices;
-
-                float x1 = cosf(lat1) * cosf(lng);
-                float y1 = sinf(lat1);
-                float z1 = cosf(lat1) * sinf(lng);
+    void DrawSphere(const MeshCache &meshes, int lod, float radius, const float lightPos[3],
+                    const std::vector<std::array<float, 4>> &blackHoles) const
+    {
+        const CelestialType type = bodies.type[index];
 
-                float x2 = cosf(lat2) * cosf(lng);
-                float y2 = sinf(lat2);
-                float z2 = cosf(lat2) * sinf(lng);
+        glPushMatrix();
+        const std::array<float, 3> position = GetCoord();
+        glTranslatef(position[0], position[1], position[2]);
 
-                glVertex3f(x1 * radius, y1 * radius, z1 * radius);
-                glVertex3f(x2 * radius, y2 * radius, z2 * radius);
-            }
-            glEnd();
+        // Stars emit their own light and black holes absorb it - disable lighting temporarily
+        if (type == STAR || type == BLACK_HOLE)
+        {
+            glDisable(GL_LIGHTING);
         }
+        const std::array<float, 4> color = GetColor(lightPos, blackHoles);
+        glColor4f(color[0], color[1], color[2], color[3]);
+
+        // Unit meshes live in GPU buffers; scale them to this body
+        glScalef(radius, radius, radius);
+        meshes.DrawSphere(lod);
 
-        // Draw accretion disk for black holes
+        // Draw accretion disk for black holes (3 to 8 radii)
         if (type == BLACK_HOLE)
         {
-            DrawAccretionDisk(radius * 3.0f, radius * 8.0f);
+            DrawAccretionDisk(meshes);
         }
 
         if (type == STAR || type == BLACK_HOLE)
@@ -330,69 +208,29 @@ public:
         glPopMatrix();
     }
 
-    void Draw(const std::vector<float> &lightPos, const std::vector<std::vector<float>> &blackHoles) const
+    void Draw(const MeshCache &meshes, int lod, const float lightPos[3],
+              const std::vector<std::array<float, 4>> &blackHoles) const
     {
         float radius = GetRadius();
-        DrawSphere(radius, 20, 16, lightPos, blackHoles);
-    }
-
-    // Add acceleration to the velocity (ax,ay,az are in pixels/s^2; timestep in seconds)
-    void accelerate(double ax, double ay, double az, double timestep)
-    {
-        velocity[0] += (float)(ax * timestep);
-        velocity[1] += (float)(ay * timestep);
-        velocity[2] += (float)(az * timestep);
+        DrawSphere(meshes, lod, radius, lightPos, blackHoles);
     }
 
-    // Overloaded for backward compatibility with 2D acceleration
-    void accelerate(double ax, double ay, double timestep)
+    // Sub-pixel bodies are batched into one point draw instead of a sphere
+    void AppendPoint(std::vector<float> &positions, std::vector<float> &colors, const float lightPos[3],
+                     const std::vector<std::array<float, 4>> &blackHoles) const
     {
-        velocity[0] += (float)(ax * timestep);
-        velocity[1] += (float)(ay * timestep);
+        // At this size a black hole's accretion disk is all that shows
+        const std::array<float, 4> color =
+            IsBlackHole() ? std::array<float, 4>{{1.0f, 0.8f, 0.1f, 0.7f}} : GetColor(lightPos, blackHoles);
+        const std::array<float, 3> position = GetCoord();
+        positions.insert(positions.end(), position.begin(), position.end());
+        colors.insert(colors.end(), color.begin(), color.end());
     }
 
-    bool IsBlackHole() const { return type == BLACK_HOLE; }
-    bool IsStar() const { return type == STAR; }
+    bool IsBlackHole() const { return bodies.type[index] == BLACK_HOLE; }
+    bool IsStar() const { return bodies.type[index] == STAR; }
 };
 
-double orbitalVelocity(double G, double centralMass, double distanceMeters)
-{
-    return sqrt(G * centralMass / distanceMeters);
-}
-
-// Calculate space-time curvature at a point due to all massive objects
-float calculateSpaceTimeCurvature(float x, float y, float z, const CelestialObject &sun, const std::vector<CelestialObject> &objects)
-{
-    float totalCurvature = 0.0f;
-
-    // Curvature from sun
-    auto sunPos = sun.GetCoord();
-    float dx = x - sunPos[0];
-    float dy = y - sunPos[1];
-    float dz = z - sunPos[2];
-    float distToSun = sqrt(dx * dx + dy * dy + dz * dz);
-    if (distToSun > 1.0f)
-    {
-        totalCurvature += sun.mass / (distToSun * distToSun) * 1e-25f;
-    }
-
-    // Curvature from other massive objects
-    for (const auto &obj : objects)
-    {
-        auto pos = obj.GetCoord();
-        float dx2 = x - pos[0];
-        float dy2 = y - pos[1];
-        float dz2 = z - pos[2];
-        float distToObj = sqrt(dx2 * dx2 + dy2 * dy2 + dz2 * dz2);
-        if (distToObj > 1.0f && obj.mass > sun.mass * 0.01)
-        {
-            totalCurvature += obj.mass / (distToObj * distToObj) * 1e-25f;
-        }
-    }
-
-    return totalCurvature;
-}
-
 // Keyboard callback for camera controls and grid toggle
 void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods)
 {
@@ -408,6 +246,90 @@ void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods
             grid3D = !grid3D;
             std::printf("Grid mode: %s\n", grid3D ? "3D" : "2D");
             break;
+        case GLFW_KEY_B:
+            if (!simulation)
+                break;
+            // Cycle Barnes-Hut -> direct sum (reference) -> direct sum (SIMD)
+            forceSettings.solver = (forceSettings.solver == BARNES_HUT)   ? DIRECT_SUM
+                                   : (forceSettings.solver == DIRECT_SUM) ? DIRECT_SIMD
+                                                                          : BARNES_HUT;
+            simulation->SetForceSettings(forceSettings);
+            std::printf("Force solver: %s\n", forceSolverName(forceSettings.solver));
+            break;
+        case GLFW_KEY_I:
+            if (!simulation)
+                break;
+            integratorType = (IntegratorType)((integratorType + 1) % (BLOCK_TIMESTEP + 1));
+            simulation->SetIntegrator(integratorType);
+            std::printf("Integrator: %s\n", integratorName(integratorType));
+            break;
+        case GLFW_KEY_LEFT_BRACKET:
+            if (!simulation)
+                break;
+            forceSettings.theta = std::max(0.0f, forceSettings.theta - 0.1f);
+            simulation->SetForceSettings(forceSettings);
+            std::printf("Barnes-Hut theta: %.1f\n", forceSettings.theta);
+            break;
+        case GLFW_KEY_RIGHT_BRACKET:
+            if (!simulation)
+                break;
+            forceSettings.theta = std::min(2.0f, forceSettings.theta + 0.1f);
+            simulation->SetForceSettings(forceSettings);
+            std::printf("Barnes-Hut theta: %.1f\n", forceSettings.theta);
+            break;
+        case GLFW_KEY_P:
+            if (!profileEnabled())
+            {
+                std::printf("Profiler not built in (make PROFILE=1)\n");
+                break;
+            }
+            showProfile = !showProfile;
+            std::printf("Frame profile: %s\n", showProfile ? "ON" : "OFF");
+            break;
+        case GLFW_KEY_C:
+        {
+            if (!simulation)
+                break;
+            const SimSnapshot &latest = simulation->Latest();
+            if (!latest.hasConservation)
+            {
+                std::printf("Conservation diagnostics off (--diagnostics)\n");
+                break;
+            }
+            std::printf("t = %.3f years: E = %.6e J (drift %.2e), 2K/|W| = %.4f\n",
+                        latest.conservation.time / SECONDS_PER_YEAR, latest.conservation.Energy(),
+                        latest.energyDrift, latest.conservation.VirialRatio());
+            break;
+        }
+        case GLFW_KEY_SPACE:
+            if (replay)
+            {
+                if (replay->Paused() && replay->Time() >= replay->EndTime())
+                    replay->Seek(replay->StartTime()); // replay from the top
+                replay->SetPaused(!replay->Paused());
+                std::printf("Replay: %s\n", replay->Paused() ? "paused" : "playing");
+            }
+            break;
+        case GLFW_KEY_MINUS:
+            if (replay)
+            {
+                replay->SetSpeed(replay->Speed() * 0.5);
+                std::printf("Replay speed: %.3g years per second\n", replay->Speed() / SECONDS_PER_YEAR);
+                break;
+            }
+            simulation->SetStepRate(std::max(1.0, simulation->StepRate() * 0.5));
+            std::printf("Physics steps per second: %.0f\n", simulation->StepRate());
+            break;
+        case GLFW_KEY_EQUAL:
+            if (replay)
+            {
+                replay->SetSpeed(replay->Speed() * 2.0);
+                std::printf("Replay speed: %.3g years per second\n", replay->Speed() / SECONDS_PER_YEAR);
+                break;
+            }
+            simulation->SetStepRate(std::min(65536.0, simulation->StepRate() * 2.0));
+            std::printf("Physics steps per second: %.0f\n", simulation->StepRate());
+            break;
         }
     }
 
@@ -439,6 +361,16 @@ void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods
         case GLFW_KEY_E:
             cameraDistance += 50.0f;
             break;
+        case GLFW_KEY_COMMA:
+        case GLFW_KEY_PERIOD:
+            // Scrub by 1% of the recording per press (held keys repeat)
+            if (replay)
+            {
+                double step = (replay->EndTime() - replay->StartTime()) * 0.01;
+                replay->Seek(replay->Time() + (key == GLFW_KEY_COMMA ? -step : step));
+                std::printf("Replay time: %.3f years\n", replay->Time() / SECONDS_PER_YEAR);
+            }
+            break;
         }
 
         // Clamp camera distance
@@ -449,8 +381,82 @@ void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods
     }
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
+    // Worker threads for force evaluation and grid curvature (--threads N, default: all cores)
+    // and physics steps per wall-clock second (--sim-rate HZ, 0 = as fast as possible).
+    // --scenario FILE or --elements FILE replace the built-in solar system.
+    // --checkpoint FILE saves the run every --checkpoint-every steps and on exit,
+    // --restart FILE resumes one.
+    // --replay FILE plays a recorded trajectory back instead of simulating; bodies take
+    // their look from the scenario (--scenario / --elements, default: solar system).
+    // --profile-trace FILE writes a Chrome trace of the run on exit (profiling builds only).
+    // --diagnostics tracks energy and momentum conservation, warning past --energy-tolerance X.
+    // --collisions merges bodies that touch.
+    // --belt N:INNER:OUTER adds N massless test particles orbiting the Sun between INNER and OUTER pixels.
+    // --precision mixed keeps positions relative to an origin that follows the system and
+    // gives the SIMD solver compensated sums.
+    // --reproducible makes the SIMD solver give the same bits on every instruction set, at
+    // 35-60% more per force pair; results never depend on the thread count without it.
+    unsigned threadCount = 0;
+    double stepRate = 60.0;
+    const char *scenarioPath = nullptr;
+    const char *elementsPath = nullptr;
+    const char *checkpointPath = nullptr;
+    const char *restartPath = nullptr;
+    const char *replayPath = nullptr;
+    const char *tracePath = nullptr;
+    unsigned long long checkpointEvery = 1000;
+    bool diagnostics = false;
+    bool collisions = false;
+    size_t beltCount = 0;
+    float beltInner = 0.0f, beltOuter = 0.0f;
+    double energyTolerance = 1e-3;
+    for (int a = 1; a < argc; ++a)
+    {
+        if (std::strcmp(argv[a], "--threads") == 0 && a + 1 < argc)
+            threadCount = (unsigned)std::atoi(argv[++a]);
+        else if (std::strcmp(argv[a], "--sim-rate") == 0 && a + 1 < argc)
+            stepRate = std::atof(argv[++a]);
+        else if (std::strcmp(argv[a], "--scenario") == 0 && a + 1 < argc)
+            scenarioPath = argv[++a];
+        else if (std::strcmp(argv[a], "--elements") == 0 && a + 1 < argc)
+            elementsPath = argv[++a];
+        else if (std::strcmp(argv[a], "--checkpoint") == 0 && a + 1 < argc)
+            checkpointPath = argv[++a];
+        else if (std::strcmp(argv[a], "--checkpoint-every") == 0 && a + 1 < argc)
+            checkpointEvery = std::strtoull(argv[++a], nullptr, 10);
+        else if (std::strcmp(argv[a], "--restart") == 0 && a + 1 < argc)
+            restartPath = argv[++a];
+        else if (std::strcmp(argv[a], "--replay") == 0 && a + 1 < argc)
+            replayPath = argv[++a];
+        else if (std::strcmp(argv[a], "--profile-trace") == 0 && a + 1 < argc)
+            tracePath = argv[++a];
+        else if (std::strcmp(argv[a], "--belt") == 0 && a + 1 < argc)
+        {
+            if (!parseBeltSpec(argv[++a], beltCount, beltInner, beltOuter))
+                fprintf(stderr, "--belt takes N:INNER:OUTER, ignoring %s\n", argv[a]);
+        }
+        else if (std::strcmp(argv[a], "--precision") == 0 && a + 1 < argc)
+        {
+            if (!parseForcePrecision(argv[++a], forceSettings.precision))
+                fprintf(stderr, "--precision takes single or mixed, ignoring %s\n", argv[a]);
+        }
+        else if (std::strcmp(argv[a], "--reproducible") == 0)
+            forceSettings.reproducible = true;
+        else if (std::strcmp(argv[a], "--collisions") == 0)
+            collisions = true;
+        else if (std::strcmp(argv[a], "--diagnostics") == 0)
+            diagnostics = true;
+        else if (std::strcmp(argv[a], "--energy-tolerance") == 0 && a + 1 < argc)
+            energyTolerance = std::atof(argv[++a]);
+    }
+
+    // The simulation and render threads each get a pool: ParallelFor calls
+    // on a shared pool would serialize and make a frame wait for a force pass
+    ThreadPool physicsPool(threadCount);
+    ThreadPool pool(threadCount);
+
     if (!glfwInit())
     {
         fprintf(stderr, "Failed to initialize GLFW\n");
@@ -499,89 +505,73 @@ int main(void)
 
     glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
 
-    const double G = 6.67430e-11;                       // gravitational constant (m^3 kg^-1 s^-2)
-    const double TIME_STEP = 3600.0 * 24 * 365.24;
+    // Sphere and accretion disk meshes, uploaded once
+    MeshCache meshes;
+    meshes.Build();
 
-    double sunMass = 1.989e30;
+    const double TIME_STEP = SECONDS_PER_YEAR;
 
-    // Create vector of celestial objects; push the Sun first so we can reference it (index 0)
-    std::vector<CelestialObject> celestialObjects;
-    std::vector<std::vector<float>> blackHolePositions; // Track black hole positions for lighting
+    // Initial bodies; the Sun is body 0 so we can reference it
+    BodyStore initialBodies;
+    std::vector<std::array<float, 4>> blackHolePositions; // Track black hole positions for lighting
 
-    // Create Sun as a moving STAR object (initially at origin, zero velocity)
-    CelestialObject sunObj({0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}, sunMass, {1.0f, 1.0f, 0.0f, 1.0f}, STAR);
-    float sunRadius = sunObj.GetRadius();
-    celestialObjects.push_back(sunObj);
-
-    struct CelestialInfo
+    bool loaded = true;
+    Checkpoint restart;
+    if (restartPath)
     {
-        double distanceKm;
-        double mass;
-        std::vector<float> color;
-        CelestialType type;
-    };
-
-    std::vector<CelestialInfo> celestialInfos = {
-        {57.9e6, 3.285e23, {0.6f, 0.6f, 0.6f, 1.0f}, PLANET},   // Mercury
-        {108.2e6, 4.867e24, {1.0f, 0.5f, 0.0f, 1.0f}, PLANET},  // Venus
-        {149.6e6, 5.972e24, {0.0f, 0.5f, 1.0f, 1.0f}, PLANET},  // Earth
-        {227.9e6, 6.39e23, {1.0f, 0.2f, 0.2f, 1.0f}, PLANET},   // Mars
-        {778.5e6, 1.898e27, {1.0f, 0.7f, 0.4f, 1.0f}, PLANET},  // Jupiter
-        {1.433e9, 5.683e26, {1.0f, 1.0f, 0.7f, 1.0f}, PLANET},  // Saturn
-        {2.8725e9, 8.681e25, {0.5f, 1.0f, 1.0f, 1.0f}, PLANET}, // Uranus
-        {4.495e9, 1.024e26, {0.2f, 0.4f, 1.0f, 1.0f}, PLANET},  // Neptune
-        // Add a black hole beyond Neptune
-        // {6.0e9, sunMass * 0.5, {0.0f, 0.0f, 0.0f, 1.0f}, BLACK_HOLE} // Black hole
-
-    };
-
-    // Sort objects ascending by distance (optional)
-    std::sort(celestialInfos.begin(), celestialInfos.end(),
-              [](const CelestialInfo &a, const CelestialInfo &b)
-              {
-                  return a.distanceKm < b.distanceKm;
-              });
-
-    float lastOrbitRadius = sunRadius + 20.0f;
-    int objectIndex = 0;
-    for (const auto &c : celestialInfos)
+        loaded = loadCheckpoint(restartPath, restart);
+        if (loaded)
+            initialBodies = restart.bodies;
+    }
+    else if (elementsPath)
+        loaded = loadOrbitalElements(elementsPath, initialBodies);
+    else if (scenarioPath)
+        loaded = loadScenario(scenarioPath, initialBodies);
+    else
+        loadSolarSystem(initialBodies);
+    if (loaded && !restartPath)
+        addTestParticleBelt(initialBodies, beltCount, beltInner, beltOuter);
+
+    if (loaded && initialBodies.Size() == 0)
     {
-        double distanceMeters = c.distanceKm * 1000.0;
-        float distancePixels = (float)(distanceMeters / DISTANCE_SCALE);
-
-        CelestialObject tempObject({0, 0, 0}, {0, 0, 0}, c.mass, c.color, c.type);
-        float objectRadiusPixels = tempObject.GetRadius();
-
-        float minOrbitRadius = lastOrbitRadius + objectRadiusPixels + 10.0f;
-        if (distancePixels < minOrbitRadius)
-            distancePixels = minOrbitRadius;
-
-        lastOrbitRadius = distancePixels;
-
-        // Use initial orbital speed around the Sun (approximation)
-        double distanceForVelocityMeters = distancePixels * DISTANCE_SCALE;
-        double velMag = orbitalVelocity(G, sunMass, distanceForVelocityMeters);
-        double velPixels = velMag / DISTANCE_SCALE;
-
-        // Add slight orbital inclinations for visual interest (in radians)
-        float inclination = (objectIndex * 5.0f) * M_PI / 180.0f; // 0-45 degrees
-        float startAngle = objectIndex * 40.0f * M_PI / 180.0f;   // Spread objects around
-
-        // Calculate 3D position
-        float posX = distancePixels * cosf(startAngle) * cosf(inclination);
-        float posY = distancePixels * sinf(startAngle) * cosf(inclination);
-        float posZ = distancePixels * sinf(inclination);
-
-        // Calculate 3D velocity (perpendicular to position vector to approximate circular orbit)
-        float velX = -posY * (float)velPixels / distancePixels;
-        float velY = posX * (float)velPixels / distancePixels;
-        float velZ = 0.0f; // Keep orbital motion mostly in XY plane
-
-        CelestialObject newObject({posX, posY, posZ}, {velX, velY, velZ}, c.mass, c.color, c.type);
-        celestialObjects.push_back(newObject);
+        fprintf(stderr, "Scenario has no bodies\n");
+        loaded = false;
+    }
+    TrajectoryPlayer player;
+    if (loaded && replayPath)
+        loaded = player.Open(replayPath, initialBodies);
+    if (!loaded)
+    {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return -1;
+    }
+    const size_t sunIndex = 0;
 
-        objectIndex++;
+    SimulationThread sim(initialBodies, &physicsPool);
+    sim.SetTimestep(TIME_STEP);
+    sim.SetStepRate(stepRate);
+    if (restartPath)
+    {
+        sim.Restore(restart);
+        forceSettings = restart.forces;
+        integratorType = restart.integrator;
+    }
+    else
+    {
+        sim.SetForceSettings(forceSettings);
+        sim.SetIntegrator(integratorType);
     }
+    if (checkpointPath)
+        sim.EnableCheckpoints(checkpointPath, checkpointEvery);
+    if (diagnostics)
+        sim.EnableDiagnostics(energyTolerance);
+    if (collisions)
+        sim.EnableCollisions();
+    if (replayPath)
+        replay = &player;
+    else
+        simulation = &sim;
 
     std::printf("\n3D Solar System Controls:\n");
     std::printf("W/S: Pitch up/down\n");
@@ -589,57 +579,101 @@ int main(void)
     std::printf("Left/Right arrows: Yaw left/right (optional)\n");
     std::printf("Q/E: Zoom in/out\n");
     std::printf("G: Toggle space-time grid\n");
-    std::printf("T: Toggle 2D/3D grid mode\n\n");
+    std::printf("T: Toggle 2D/3D grid mode\n");
+    std::printf("B: Cycle Barnes-Hut / direct-sum / SIMD direct-sum gravity (SIMD: %s)\n",
+                kernelIsaName(forceSettings.isa));
+    std::printf("[/]: Decrease/increase Barnes-Hut opening angle\n");
+    std::printf("I: Cycle integrator (current: %s)\n", integratorName(integratorType));
+    std::printf("-/=: Halve/double physics steps per second (current: %.0f)\n", stepRate);
+    std::printf("C: Print energy conservation%s\n", diagnostics ? "" : " (--diagnostics)");
+    std::printf("P: Toggle frame profile summary%s\n", profileEnabled() ? "" : " (make PROFILE=1)");
+    std::printf("Physics threads: %u\n\n", physicsPool.ThreadCount());
+    if (replay)
+    {
+        std::printf("Replaying %s: %zu frames, %.3f to %.3f years\n", replayPath, replay->FrameCount(),
+                    replay->StartTime() / SECONDS_PER_YEAR, replay->EndTime() / SECONDS_PER_YEAR);
+        std::printf("Space: pause/play, ,/.: scrub, -/=: halve/double playback speed\n\n");
+    }
+
+    CurvatureField curvatureField; // space-time grid, re-evaluated only when bodies move
+    ViewFrustum frustum;
+    std::vector<float> pointPositions, pointColors; // bodies too small on screen for a sphere
+
+    PROFILE_THREAD("main");
+    if (tracePath)
+        profileStartTrace();
+    if (!replay)
+        sim.Start();
+    double lastFrameTime = glfwGetTime();
+    double lastProfileTime = lastFrameTime;
+    unsigned long long absorbedReported = 0;
 
     // MAIN LOOP
     while (!glfwWindowShouldClose(window))
     {
+        PROFILE_SCOPE("frame");
+        double frameTime = glfwGetTime();
+        double frameSeconds = frameTime - lastFrameTime;
+        lastFrameTime = frameTime;
+
+        // Newest state from the simulation thread, or the replay interpolated to
+        // the playhead; it stays fixed for this frame
+        if (replay)
+            replay->Advance(frameSeconds);
+        const SimSnapshot *latest = replay ? nullptr : &sim.Latest();
+        const BodyStore &bodies = latest ? latest->bodies : replay->Bodies(&pool);
+        if (latest && latest->absorbed > absorbedReported)
+        {
+            std::printf("Collisions: %llu bodies absorbed, %zu left\n", latest->absorbed, bodies.Size());
+            absorbedReported = latest->absorbed;
+        }
+
         int windowWidth, windowHeight;
         glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
 
-        glViewport(0, 0, windowWidth, windowHeight);
-
-        // Set up 3D perspective projection
-        glMatrixMode(GL_PROJECTION);
-        glLoadIdentity();
-        gluPerspective(45.0, (double)windowWidth / windowHeight, 1.0, 10000.0);
-
-        // Set up 3D camera with modelview matrix
-        glMatrixMode(GL_MODELVIEW);
-        glLoadIdentity();
-
-        // Calculate camera position based on spherical coordinates (pitch/yaw) and distance
-        float pitchRad = cameraAngleX * M_PI / 180.0f;
-        float yawRad = cameraAngleY * M_PI / 180.0f;
-        float rollRad = cameraAngleZ * M_PI / 180.0f;
-
-        // spherical to cartesian (radius, pitch, yaw)
-        float cameraX = cameraDistance * sinf(pitchRad) * cosf(yawRad);
-        float cameraY = cameraDistance * cosf(pitchRad);
-        float cameraZ = cameraDistance * sinf(pitchRad) * sinf(yawRad);
-
-        // compute forward vector (from eye to center)
-        float forward[3] = {-cameraX, -cameraY, -cameraZ};
-        vec3_normalize(forward);
-
-        // compute up vector by rotating global up around forward by rollRad
-        float upVec[3];
-        computeRolledUpVector(forward, rollRad, upVec);
+        {
+            PROFILE_SCOPE("camera setup");
+            glViewport(0, 0, windowWidth, windowHeight);
+
+            // Set up 3D perspective projection
+            glMatrixMode(GL_PROJECTION);
+            glLoadIdentity();
+            gluPerspective(45.0, (double)windowWidth / windowHeight, 1.0, 10000.0);
+
+            // Set up 3D camera with modelview matrix
+            glMatrixMode(GL_MODELVIEW);
+            glLoadIdentity();
+
+            // Calculate camera position based on spherical coordinates (pitch/yaw) and distance
+            float pitchRad = cameraAngleX * M_PI / 180.0f;
+            float yawRad = cameraAngleY * M_PI / 180.0f;
+            float rollRad = cameraAngleZ * M_PI / 180.0f;
+
+            // spherical to cartesian (radius, pitch, yaw)
+            float cameraX = cameraDistance * sinf(pitchRad) * cosf(yawRad);
+            float cameraY = cameraDistance * cosf(pitchRad);
+            float cameraZ = cameraDistance * sinf(pitchRad) * sinf(yawRad);
+
+            // compute forward vector (from eye to center)
+            float forward[3] = {-cameraX, -cameraY, -cameraZ};
+            vec3_normalize(forward);
+
+            // compute up vector by rotating global up around forward by rollRad
+            float upVec[3];
+            computeRolledUpVector(forward, rollRad, upVec);
+
+            // Detach camera from sun, orbit fixed origin (0,0,0)
+            gluLookAt(cameraX, cameraY, cameraZ, // eye position
+                      0.0f, 0.0f, 0.0f,          // look at origin
+                      upVec[0], upVec[1], upVec[2]);
+
+            glClearColor(0.05f, 0.05f, 0.1f, 1.0f); // Dark space color
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        }
 
         // Determine Sun's current position (we put Sun at index 0)
-        std::vector<float> sunPos = celestialObjects[0].GetCoord();
+        const std::array<float, 3> sunPos = CelestialObject(bodies, sunIndex).GetCoord();
 
-        float camX = cameraDistance * sinf(glm::radians(cameraAngleY)) * cosf(glm::radians(cameraAngleX));
-        float camY = cameraDistance * sinf(glm::radians(cameraAngleX));
-        float camZ = cameraDistance * cosf(glm::radians(cameraAngleY)) * cosf(glm::radians(cameraAngleX));
-
-        // Detach camera from sun, orbit fixed origin (0,0,0)
-        gluLookAt(cameraX, cameraY, cameraZ, // eye position
-                  0.0f, 0.0f, 0.0f,          // look at origin
-                  upVec[0], upVec[1], upVec[2]);
-
-        glClearColor(0.05f, 0.05f, 0.1f, 1.0f); // Dark space color
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         // Update light position (at sun)
         float lightPos[] = {sunPos[0], sunPos[1], sunPos[2], 1.0f};
@@ -647,197 +681,99 @@ int main(void)
 
         // Update black hole positions for dynamic lighting
         blackHolePositions.clear();
-        for (const auto &obj : celestialObjects)
+        for (size_t i = 0; i < bodies.Size(); ++i)
         {
-            if (obj.IsBlackHole())
+            if (bodies.type[i] == BLACK_HOLE)
             {
-                auto pos = obj.GetCoord();
-                blackHolePositions.push_back({pos[0], pos[1], pos[2], obj.GetRadius()});
+                const std::array<float, 3> position = CelestialObject(bodies, i).GetCoord();
+                blackHolePositions.push_back({{position[0], position[1], position[2], bodies.Radius(i)}});
             }
         }
 
         // Draw space-time grid if enabled
         if (showGrid)
         {
+            PROFILE_SCOPE("grid");
             glDisable(GL_LIGHTING);
             glColor4f(0.3f, 0.6f, 0.9f, 0.4f); // Blue/cyan grid color
             glEnable(GL_BLEND);
             glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-            if (grid3D)
-            {
-                // Draw reduced 3D grid
-                glBegin(GL_LINES);
-                for (int i = 0; i < GRID_SIZE_3D; ++i)
-                {
-                    for (int j = 0; j < GRID_SIZE_3D; ++j)
-                    {
-                        for (int k = 0; k < GRID_SIZE_3D; ++k)
-                        {
-                            float x = (i - GRID_SIZE_3D / 2) * GRID_SPACING_3D * 2.0f; // Wider spacing for 3D
-                            float y = (j - GRID_SIZE_3D / 2) * GRID_SPACING_3D * 2.0f;
-                            float z = (k - GRID_SIZE_3D / 2) * GRID_SPACING_3D * 2.0f;
-
-                            // Calculate space-time curvature
-                            float curvature = calculateSpaceTimeCurvature(x, y, z, celestialObjects[0], celestialObjects);
-                            float displacement = curvature * 50.0f;
-
-                            // Draw lines to adjacent grid points with curvature displacement
-                            // Only draw every other line to reduce clutter
-                            if (i < GRID_SIZE_3D - 1 && (i + j + k) % 2 == 0)
-                            {
-                                float x2 = x + GRID_SPACING_3D * 2.0f;
-                                float curvature2 = calculateSpaceTimeCurvature(x2, y, z, celestialObjects[0], celestialObjects);
-                                float displacement2 = curvature2 * 50.0f;
-
-                                glVertex3f(x, y - displacement, z);
-                                glVertex3f(x2, y - displacement2, z);
-                            }
-
-                            if (j < GRID_SIZE_3D - 1 && (i + j + k) % 2 == 0)
-                            {
-                                float y2 = y + GRID_SPACING_3D * 2.0f;
-                                float curvature2 = calculateSpaceTimeCurvature(x, y2, z, celestialObjects[0], celestialObjects);
-                                float displacement2 = curvature2 * 50.0f;
-
-                                glVertex3f(x, y - displacement, z);
-                                glVertex3f(x, y2 - displacement2, z);
-                            }
-
-                            // Add Z-direction lines but even more sparsely
-                            if (k < GRID_SIZE_3D - 1 && (i + j + k) % 3 == 0)
-                            {
-                                float z2 = z + GRID_SPACING_3D * 2.0f;
-                                float curvature2 = calculateSpaceTimeCurvature(x, y, z2, celestialObjects[0], celestialObjects);
-                                float displacement2 = curvature2 * 500.0f;
-
-                                glVertex3f(x, y - displacement, z);
-                                glVertex3f(x, y - displacement2, z2);
-                            }
-                        }
-                    }
-                }
-                glEnd();
-            }
-            else
+            // Curvature is evaluated on the pool, and only when a massive body has moved
+            GridLayout layout = grid3D ? GridLayout{true, GRID_SIZE_3D, GRID_SPACING_3D}
+                                       : GridLayout{false, GRID_SIZE, GRID_SPACING};
+            curvatureField.Update(bodies, layout, &pool);
+
+            const std::vector<float> &gridVertices = curvatureField.Vertices();
+            if (!gridVertices.empty())
             {
-                // Draw 2D grid (XY plane)
-                glBegin(GL_LINES);
-                for (int i = 0; i < GRID_SIZE; ++i)
-                {
-                    for (int j = 0; j < GRID_SIZE; ++j)
-                    {
-                        float x = (i - GRID_SIZE / 2) * GRID_SPACING;
-                        float y = (j - GRID_SIZE / 2) * GRID_SPACING;
-                        float z = -200.0f; // Fixed Z plane below the solar system
-
-                        // Calculate space-time curvature
-                        float curvature = calculateSpaceTimeCurvature(x, y, 0, celestialObjects[0], celestialObjects);
-                        float displacement = curvature * 500.0f;
-
-                        // Draw lines to adjacent grid points with curvature displacement
-                        if (i < GRID_SIZE - 1)
-                        {
-                            float x2 = x + GRID_SPACING;
-                            float curvature2 = calculateSpaceTimeCurvature(x2, y, 0, celestialObjects[0], celestialObjects);
-                            float displacement2 = curvature2 * 500.0f;
-
-                            glVertex3f(x, y, z - displacement);
-                            glVertex3f(x2, y, z - displacement2);
-                        }
-
-                        if (j < GRID_SIZE - 1)
-                        {
-                            float y2 = y + GRID_SPACING;
-                            float curvature2 = calculateSpaceTimeCurvature(x, y2, 0, celestialObjects[0], celestialObjects);
-                            float displacement2 = curvature2 * 500.0f;
-
-                            glVertex3f(x, y, z - displacement);
-                            glVertex3f(x, y2, z - displacement2);
-                        }
-                    }
-                }
-                glEnd();
+                glEnableClientState(GL_VERTEX_ARRAY);
+                glVertexPointer(3, GL_FLOAT, 0, gridVertices.data());
+                glDrawArrays(GL_LINES, 0, (GLsizei)(gridVertices.size() / 3));
+                glDisableClientState(GL_VERTEX_ARRAY);
             }
 
             glDisable(GL_BLEND);
             glEnable(GL_LIGHTING);
         }
 
-        // --------------- N-BODY PHYSICS UPDATE ---------------
-        // Compute accelerations (pixels / s^2) for every object from every other object
-        size_t n = celestialObjects.size();
-        std::vector<std::array<float, 3>> accels(n);
-        for (size_t i = 0; i < n; ++i)
-        {
-            accels[i] = {0.0f, 0.0f, 0.0f};
-        }
+        // Cull bodies against the frustum gluPerspective/gluLookAt set up and
+        // pick a sphere detail level from each one's size on screen
+        float projection[16], modelview[16];
+        glGetFloatv(GL_PROJECTION_MATRIX, projection);
+        glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+        frustum.Extract(projection, modelview, windowHeight);
 
-        for (size_t i = 0; i < n; ++i)
+        // Draw objects (physics advances on the simulation thread)
         {
-            auto pos_i = celestialObjects[i].GetCoord();
-            for (size_t j = 0; j < n; ++j)
+            PROFILE_SCOPE("bodies");
+            pointPositions.clear();
+            pointColors.clear();
+            for (size_t i = 0; i < bodies.Size(); ++i)
             {
-                if (i == j)
+                CelestialObject object(bodies, i);
+                const std::array<float, 3> position = object.GetCoord();
+                float radius = object.GetRadius();
+                float extent = object.IsBlackHole() ? radius * 8.0f : radius; // accretion disk reaches 8 radii
+                if (!frustum.SphereVisible(position[0], position[1], position[2], extent))
                     continue;
 
-                auto pos_j = celestialObjects[j].GetCoord();
-                float dx = pos_j[0] - pos_i[0];
-                float dy = pos_j[1] - pos_i[1];
-                float dz = pos_j[2] - pos_i[2];
-                double dist_pixels = sqrt(dx * dx + dy * dy + dz * dz);
-
-                if (dist_pixels < 1e-3)
-                    continue; // avoid singularity / self
-
-                // Convert pixel distance -> meters
-                double dist_meters = dist_pixels * DISTANCE_SCALE;
-
-                // Acceleration contribution from object j: a = G * m_j / r^2 (m/s^2)
-                double a_m_s2 = G * celestialObjects[j].mass / (dist_meters * dist_meters);
-
-                // Convert acceleration to pixels/s^2 for our simulation coordinates:
-                double a_pixels_s2 = a_m_s2 / DISTANCE_SCALE;
-
-                // direction unit vector (from i -> j)
-                double dir_x = dx / dist_pixels;
-                double dir_y = dy / dist_pixels;
-                double dir_z = dz / dist_pixels;
-
-                accels[i][0] += (float)(dir_x * a_pixels_s2);
-                accels[i][1] += (float)(dir_y * a_pixels_s2);
-                accels[i][2] += (float)(dir_z * a_pixels_s2);
+                int lod = MeshCache::SphereLod(frustum.ProjectedRadius(position[0], position[1], position[2], extent));
+                if (lod < MeshCache::SPHERE_LODS)
+                    object.Draw(meshes, lod, sunPos.data(), blackHolePositions);
+                else
+                    object.AppendPoint(pointPositions, pointColors, sunPos.data(), blackHolePositions);
             }
+            MeshCache::DrawPoints(pointPositions, pointColors, 2.0f);
         }
 
-        // Apply accelerations to velocities
-        for (size_t i = 0; i < n; ++i)
+        // Swap buffers and poll events
         {
-            celestialObjects[i].accelerate(accels[i][0], accels[i][1], accels[i][2], TIME_STEP);
+            PROFILE_SCOPE("swap buffers");
+            glfwSwapBuffers(window);
         }
-
-        // Update positions and draw objects
-        for (auto &object : celestialObjects)
         {
-            object.UpdatePos(TIME_STEP);
-            object.Draw(sunPos, blackHolePositions);
+            PROFILE_SCOPE("poll events");
+            glfwPollEvents();
         }
 
-        // Update black hole positions for lighting (recompute because objects moved)
-        blackHolePositions.clear();
-        for (const auto &obj : celestialObjects)
+        profileEndFrame();
+        if (showProfile && frameTime - lastProfileTime >= PROFILE_SUMMARY_INTERVAL)
         {
-            if (obj.IsBlackHole())
-            {
-                auto pos = obj.GetCoord();
-                blackHolePositions.push_back({pos[0], pos[1], pos[2], obj.GetRadius()});
-            }
+            profilePrintSummary(stdout);
+            lastProfileTime = frameTime;
         }
+    }
 
-        // Swap buffers and poll events
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+    sim.Stop();
+    simulation = nullptr;
+    replay = nullptr;
+    if (tracePath)
+    {
+        profileEndFrame(); // the simulation thread's last steps
+        profileWriteTrace(tracePath);
     }
+    meshes.Release(); // while the context is still current
 
     glfwDestroyWindow(window);
     glfwTerminate();
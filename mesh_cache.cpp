@@ -0,0 +1,201 @@
+#include "mesh_cache.h"
+
+#include <cmath>
+#include <vector>
+
+static const int SPHERE_SLICES[MeshCache::SPHERE_LODS] = {20, 12, 8};
+static const int SPHERE_STACKS[MeshCache::SPHERE_LODS] = {16, 10, 6};
+
+// Smallest on-screen radius (pixels) for each sphere level
+static const float SPHERE_LOD_MIN_PIXELS[MeshCache::SPHERE_LODS] = {24.0f, 6.0f, 1.0f};
+
+static const int DISK_SEGMENTS = 64;
+static const int DISK_RINGS = 16;
+static const float DISK_INNER_RADIUS = 3.0f;
+static const float DISK_OUTER_RADIUS = 8.0f;
+
+// Indices of a triangle strip over vertices first..first+count-1 as separate
+// triangles, keeping the strip's alternating winding so face culling is unchanged
+static void appendStrip(std::vector<GLuint> &indices, GLuint first, GLuint count)
+{
+    for (GLuint t = 0; t + 2 < count; ++t)
+    {
+        GLuint a = first + t, b = first + t + 1, c = first + t + 2;
+        if (t % 2 == 0)
+        {
+            indices.push_back(a);
+            indices.push_back(b);
+        }
+        else
+        {
+            indices.push_back(b);
+            indices.push_back(a);
+        }
+        indices.push_back(c);
+    }
+}
+
+static GLuint uploadBuffer(GLenum target, const void *data, size_t bytes)
+{
+    GLuint buffer = 0;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(target, buffer);
+    glBufferData(target, (GLsizeiptr)bytes, data, GL_STATIC_DRAW);
+    glBindBuffer(target, 0);
+    return buffer;
+}
+
+void MeshCache::Build()
+{
+    Release();
+
+    for (int lod = 0; lod < SPHERE_LODS; ++lod)
+    {
+        const int slices = SPHERE_SLICES[lod];
+        const int stacks = SPHERE_STACKS[lod];
+
+        // One strip per stack, alternating between latitude i and i + 1
+        std::vector<float> vertices;
+        std::vector<GLuint> indices;
+        for (int i = 0; i < stacks; ++i)
+        {
+            float lat1 = M_PI * (-0.5f + (float)i / stacks);
+            float lat2 = M_PI * (-0.5f + (float)(i + 1) / stacks);
+
+            GLuint first = (GLuint)(vertices.size() / 3);
+            for (int j = 0; j <= slices; ++j)
+            {
+                float lng = 2 * M_PI * (float)j / slices;
+
+                vertices.push_back(cosf(lat1) * cosf(lng));
+                vertices.push_back(sinf(lat1));
+                vertices.push_back(cosf(lat1) * sinf(lng));
+
+                vertices.push_back(cosf(lat2) * cosf(lng));
+                vertices.push_back(sinf(lat2));
+                vertices.push_back(cosf(lat2) * sinf(lng));
+            }
+            appendStrip(indices, first, (GLuint)(2 * (slices + 1)));
+        }
+
+        Mesh &mesh = spheres[lod];
+        mesh.vertexBuffer = uploadBuffer(GL_ARRAY_BUFFER, vertices.data(), vertices.size() * sizeof(float));
+        mesh.indexBuffer = uploadBuffer(GL_ELEMENT_ARRAY_BUFFER, indices.data(), indices.size() * sizeof(GLuint));
+        mesh.indexCount = (GLsizei)indices.size();
+    }
+
+    // One strip per ring; rings carry their own colour so vertices are not shared
+    std::vector<float> vertices;
+    std::vector<float> colors;
+    std::vector<GLuint> indices;
+    for (int ring = 0; ring < DISK_RINGS; ++ring)
+    {
+        float r1 = DISK_INNER_RADIUS + (DISK_OUTER_RADIUS - DISK_INNER_RADIUS) * ring / DISK_RINGS;
+        float r2 = DISK_INNER_RADIUS + (DISK_OUTER_RADIUS - DISK_INNER_RADIUS) * (ring + 1) / DISK_RINGS;
+
+        // Colour gradient from hot inner (white/yellow) to cooler outer (red/orange)
+        float intensity = 1.0f - (float)ring / DISK_RINGS;
+        const float color[4] = {1.0f, 0.6f + 0.4f * intensity, 0.2f * intensity, 0.3f + 0.4f * intensity};
+
+        GLuint first = (GLuint)(vertices.size() / 3);
+        for (int i = 0; i <= DISK_SEGMENTS; ++i)
+        {
+            float angle = 2.0f * M_PI * i / DISK_SEGMENTS;
+            const float strip[6] = {r1 * cosf(angle), 0.0f, r1 * sinf(angle), r2 * cosf(angle), 0.0f, r2 * sinf(angle)};
+            vertices.insert(vertices.end(), strip, strip + 6);
+            colors.insert(colors.end(), color, color + 4);
+            colors.insert(colors.end(), color, color + 4);
+        }
+        appendStrip(indices, first, (GLuint)(2 * (DISK_SEGMENTS + 1)));
+    }
+
+    disk.vertexBuffer = uploadBuffer(GL_ARRAY_BUFFER, vertices.data(), vertices.size() * sizeof(float));
+    disk.colorBuffer = uploadBuffer(GL_ARRAY_BUFFER, colors.data(), colors.size() * sizeof(float));
+    disk.indexBuffer = uploadBuffer(GL_ELEMENT_ARRAY_BUFFER, indices.data(), indices.size() * sizeof(GLuint));
+    disk.indexCount = (GLsizei)indices.size();
+}
+
+void MeshCache::ReleaseMesh(Mesh &mesh)
+{
+    GLuint buffers[3] = {mesh.vertexBuffer, mesh.colorBuffer, mesh.indexBuffer};
+    for (GLuint buffer : buffers)
+    {
+        if (buffer)
+            glDeleteBuffers(1, &buffer);
+    }
+    mesh = Mesh();
+}
+
+void MeshCache::Release()
+{
+    for (Mesh &mesh : spheres)
+        ReleaseMesh(mesh);
+    ReleaseMesh(disk);
+}
+
+void MeshCache::Draw(const Mesh &mesh)
+{
+    if (mesh.indexCount == 0)
+        return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBuffer);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 0, nullptr);
+
+    if (mesh.colorBuffer)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.colorBuffer);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glColorPointer(4, GL_FLOAT, 0, nullptr);
+    }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBuffer);
+    glDrawElements(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT, nullptr);
+
+    if (mesh.colorBuffer)
+        glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void MeshCache::DrawSphere(int lod) const
+{
+    if (lod < 0)
+        lod = 0;
+    if (lod >= SPHERE_LODS)
+        lod = SPHERE_LODS - 1;
+    Draw(spheres[lod]);
+}
+
+void MeshCache::DrawAccretionDisk() const
+{
+    Draw(disk);
+}
+
+int MeshCache::SphereLod(float pixelRadius)
+{
+    for (int lod = 0; lod < SPHERE_LODS; ++lod)
+    {
+        if (pixelRadius >= SPHERE_LOD_MIN_PIXELS[lod])
+            return lod;
+    }
+    return SPHERE_LODS;
+}
+
+void MeshCache::DrawPoints(const std::vector<float> &positions, const std::vector<float> &colors, float size)
+{
+    if (positions.empty())
+        return;
+
+    glDisable(GL_LIGHTING);
+    glPointSize(size);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 0, positions.data());
+    glColorPointer(4, GL_FLOAT, 0, colors.data());
+    glDrawArrays(GL_POINTS, 0, (GLsizei)(positions.size() / 3));
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glEnable(GL_LIGHTING);
+}
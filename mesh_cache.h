@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+
+#include "gl_platform.h"
+
+// Unit meshes for drawing bodies, uploaded once into vertex buffer objects.
+//
+// Drawing a body is a translate/scale plus one glDrawElements from GPU
+// memory: no per-frame trigonometry or immediate-mode vertices. Only GL 1.5
+// buffer objects are used, so this runs on legacy macOS contexts and on
+// Mesa's llvmpipe software renderer alike.
+class MeshCache
+{
+public:
+    // Sphere detail levels, finest first: LOD 0 is the original 20 x 16 sphere
+    static const int SPHERE_LODS = 3;
+
+    // Detail level for a sphere covering pixelRadius pixels on screen;
+    // SPHERE_LODS means it is small enough to draw as a point
+    static int SphereLod(float pixelRadius);
+
+    ~MeshCache() { Release(); }
+
+    // Build every mesh; needs a current GL context
+    void Build();
+    void Release();
+
+    // Unit sphere centred on the origin
+    void DrawSphere(int lod) const;
+
+    // Accretion disk in the XZ plane from 3 to 8 units, coloured hot to cool
+    // with per-vertex alpha; the caller sets up blending
+    void DrawAccretionDisk() const;
+
+    // Unlit points (x, y, z and r, g, b, a per point) in a single draw
+    static void DrawPoints(const std::vector<float> &positions, const std::vector<float> &colors, float size);
+
+private:
+    struct Mesh
+    {
+        GLuint vertexBuffer = 0;
+        GLuint colorBuffer = 0; // 0 when the mesh has no per-vertex colour
+        GLuint indexBuffer = 0;
+        GLsizei indexCount = 0;
+    };
+
+    static void Draw(const Mesh &mesh);
+    static void ReleaseMesh(Mesh &mesh);
+
+    Mesh spheres[SPHERE_LODS];
+    Mesh disk;
+};
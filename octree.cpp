@@ -0,0 +1,333 @@
+#include "octree.h"
+
+#include <algorithm>
+#include <cmath>
+
+void Octree::Build(const float *x, const float *y, const float *z, const double *gm, size_t count)
+{
+    px = x;
+    py = y;
+    pz = z;
+    pgm = gm;
+    bodyTotal = count;
+
+    nodes.clear();
+    bodyIndex.resize(count);
+    scratch.resize(count);
+    if (count == 0)
+        return;
+
+    // Bounding cube of all bodies
+    float minX = x[0], maxX = x[0];
+    float minY = y[0], maxY = y[0];
+    float minZ = z[0], maxZ = z[0];
+    for (size_t i = 0; i < count; ++i)
+    {
+        bodyIndex[i] = (int)i;
+        minX = std::min(minX, x[i]);
+        maxX = std::max(maxX, x[i]);
+        minY = std::min(minY, y[i]);
+        maxY = std::max(maxY, y[i]);
+        minZ = std::min(minZ, z[i]);
+        maxZ = std::max(maxZ, z[i]);
+    }
+    float extent = std::max(maxX - minX, std::max(maxY - minY, maxZ - minZ));
+    float half = extent * 0.5f * 1.0001f + 1e-3f; // pad so bodies on the max face stay inside
+
+    // Roughly 2n/LEAF_CAPACITY cells for well-spread distributions
+    nodes.reserve(count / LEAF_CAPACITY * 2 + 9);
+
+    Node root;
+    root.centerX = (minX + maxX) * 0.5f;
+    root.centerY = (minY + maxY) * 0.5f;
+    root.centerZ = (minZ + maxZ) * 0.5f;
+    root.halfSize = half;
+    nodes.push_back(root);
+
+    BuildNode(0, 0, (int)count, 0);
+}
+
+void Octree::BuildNode(int nodeIndex, int begin, int end, int depth)
+{
+    int count = end - begin;
+    nodes[nodeIndex].bodyCount = count;
+
+    if (count <= LEAF_CAPACITY || depth >= MAX_DEPTH)
+    {
+        double m = 0.0, cx = 0.0, cy = 0.0, cz = 0.0;
+        for (int k = begin; k < end; ++k)
+        {
+            int j = bodyIndex[k];
+            m += pgm[j];
+            cx += pgm[j] * px[j];
+            cy += pgm[j] * py[j];
+            cz += pgm[j] * pz[j];
+        }
+
+        Node &leaf = nodes[nodeIndex];
+        leaf.firstChild = -1;
+        leaf.firstBody = begin;
+        leaf.gm = m;
+        if (m > 0.0)
+        {
+            leaf.comX = cx / m;
+            leaf.comY = cy / m;
+            leaf.comZ = cz / m;
+        }
+        else
+        {
+            leaf.comX = leaf.centerX;
+            leaf.comY = leaf.centerY;
+            leaf.comZ = leaf.centerZ;
+        }
+        return;
+    }
+
+    const float centerX = nodes[nodeIndex].centerX;
+    const float centerY = nodes[nodeIndex].centerY;
+    const float centerZ = nodes[nodeIndex].centerZ;
+    const float childHalf = nodes[nodeIndex].halfSize * 0.5f;
+
+    // Counting sort of this cell's bodies into octants (bit 0 = +x, bit 1 = +y, bit 2 = +z)
+    int octantCount[8] = {0};
+    for (int k = begin; k < end; ++k)
+    {
+        int j = bodyIndex[k];
+        int octant = (px[j] >= centerX ? 1 : 0) | (py[j] >= centerY ? 2 : 0) | (pz[j] >= centerZ ? 4 : 0);
+        octantCount[octant]++;
+    }
+    int octantStart[9];
+    octantStart[0] = begin;
+    for (int o = 0; o < 8; ++o)
+        octantStart[o + 1] = octantStart[o] + octantCount[o];
+
+    int cursor[8];
+    std::copy(octantStart, octantStart + 8, cursor);
+    for (int k = begin; k < end; ++k)
+    {
+        int j = bodyIndex[k];
+        int octant = (px[j] >= centerX ? 1 : 0) | (py[j] >= centerY ? 2 : 0) | (pz[j] >= centerZ ? 4 : 0);
+        scratch[cursor[octant]++] = j;
+    }
+    std::copy(scratch.begin() + begin, scratch.begin() + end, bodyIndex.begin() + begin);
+
+    // Children are stored contiguously so a cell only needs the first index
+    int firstChild = (int)nodes.size();
+    nodes[nodeIndex].firstChild = firstChild;
+    nodes[nodeIndex].firstBody = begin;
+    for (int o = 0; o < 8; ++o)
+    {
+        Node child;
+        child.centerX = centerX + ((o & 1) ? childHalf : -childHalf);
+        child.centerY = centerY + ((o & 2) ? childHalf : -childHalf);
+        child.centerZ = centerZ + ((o & 4) ? childHalf : -childHalf);
+        child.halfSize = childHalf;
+        nodes.push_back(child);
+    }
+
+    double m = 0.0, cx = 0.0, cy = 0.0, cz = 0.0;
+    for (int o = 0; o < 8; ++o)
+    {
+        BuildNode(firstChild + o, octantStart[o], octantStart[o + 1], depth + 1);
+
+        const Node &child = nodes[firstChild + o];
+        m += child.gm;
+        cx += child.gm * child.comX;
+        cy += child.gm * child.comY;
+        cz += child.gm * child.comZ;
+    }
+
+    Node &cell = nodes[nodeIndex];
+    cell.gm = m;
+    if (m > 0.0)
+    {
+        cell.comX = cx / m;
+        cell.comY = cy / m;
+        cell.comZ = cz / m;
+    }
+    else
+    {
+        cell.comX = cell.centerX;
+        cell.comY = cell.centerY;
+        cell.comZ = cell.centerZ;
+    }
+}
+
+void Octree::ComputeAcceleration(size_t i, float theta, double softening2, double out[3], double *potential) const
+{
+    ComputeAccelerationAt(px[i], py[i], pz[i], i, theta, softening2, out, potential);
+}
+
+void Octree::ComputeAccelerationAt(double x, double y, double z, size_t self, float theta, double softening2,
+                                   double out[3], double *potential) const
+{
+    double phi = 0.0;
+    if (softening2 > 0.0)
+    {
+        if (potential)
+            Walk<true, true>(x, y, z, self, theta, softening2, out, phi);
+        else
+            Walk<true, false>(x, y, z, self, theta, softening2, out, phi);
+    }
+    else
+    {
+        if (potential)
+            Walk<false, true>(x, y, z, self, theta, softening2, out, phi);
+        else
+            Walk<false, false>(x, y, z, self, theta, softening2, out, phi);
+    }
+    if (potential)
+        *potential = phi;
+}
+
+template <bool Softened, bool Potential>
+void Octree::Walk(double xi, double yi, double zi, size_t self, float theta, double softening2, double out[3],
+                  double &phi) const
+{
+    out[0] = out[1] = out[2] = 0.0;
+    if (nodes.empty())
+        return;
+
+    const double theta2 = (double)theta * theta;
+
+    // Every opened cell pushes 8 children, so depth * 7 + 8 bounds the stack
+    int stack[8 * (MAX_DEPTH + 1)];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0)
+    {
+        const Node &node = nodes[stack[--top]];
+        if (node.bodyCount == 0)
+            continue;
+
+        if (node.firstChild < 0)
+        {
+            // Leaf: exact pairwise sum over its bodies
+            for (int k = node.firstBody; k < node.firstBody + node.bodyCount; ++k)
+            {
+                int j = bodyIndex[k];
+                if ((size_t)j == self)
+                    continue;
+
+                double dx = px[j] - xi;
+                double dy = py[j] - yi;
+                double dz = pz[j] - zi;
+                double dist2 = dx * dx + dy * dy + dz * dz;
+                if (Softened)
+                    dist2 += softening2;
+                if (dist2 < 1e-6)
+                    continue; // avoid singularity
+
+                double invR = 1.0 / sqrt(dist2);
+                double s = pgm[j] * invR * invR * invR;
+                out[0] += s * dx;
+                out[1] += s * dy;
+                out[2] += s * dz;
+                if (Potential)
+                    phi -= pgm[j] * invR;
+            }
+            continue;
+        }
+
+        double dx = node.comX - xi;
+        double dy = node.comY - yi;
+        double dz = node.comZ - zi;
+        double dist2 = dx * dx + dy * dy + dz * dz;
+        double size = 2.0 * node.halfSize;
+
+        // A cell containing the point itself is always opened
+        bool containsBody = fabs(xi - node.centerX) <= node.halfSize &&
+                            fabs(yi - node.centerY) <= node.halfSize &&
+                            fabs(zi - node.centerZ) <= node.halfSize;
+
+        if (!containsBody && size * size < theta2 * dist2)
+        {
+            // Far enough away: treat the whole cell as a point mass at its center of mass
+            if (Softened)
+                dist2 += softening2;
+            double invR = 1.0 / sqrt(dist2);
+            double s = node.gm * invR * invR * invR;
+            out[0] += s * dx;
+            out[1] += s * dy;
+            out[2] += s * dz;
+            if (Potential)
+                phi -= node.gm * invR;
+        }
+        else
+        {
+            for (int o = 0; o < 8; ++o)
+                stack[top++] = node.firstChild + o;
+        }
+    }
+}
+
+void Octree::ExportEssential(const float lo[3], const float hi[3], float theta, std::vector<PointMass> &out) const
+{
+    if (nodes.empty())
+        return;
+
+    const double theta2 = (double)theta * theta;
+    int stack[8 * (MAX_DEPTH + 1)];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0)
+    {
+        const Node &node = nodes[stack[--top]];
+        if (node.bodyCount == 0)
+            continue;
+
+        if (node.firstChild < 0)
+        {
+            for (int k = node.firstBody; k < node.firstBody + node.bodyCount; ++k)
+            {
+                int j = bodyIndex[k];
+                out.push_back({px[j], py[j], pz[j], pgm[j]});
+            }
+            continue;
+        }
+
+        // Nearest point of the box to the center of mass, and whether the
+        // box reaches into the cell (a walk from there would open it)
+        const double com[3] = {node.comX, node.comY, node.comZ};
+        const double center[3] = {node.centerX, node.centerY, node.centerZ};
+        double dist2 = 0.0;
+        bool overlaps = true;
+        for (int k = 0; k < 3; ++k)
+        {
+            double d = std::max(0.0, std::max((double)lo[k] - com[k], com[k] - (double)hi[k]));
+            dist2 += d * d;
+            overlaps = overlaps && lo[k] <= center[k] + node.halfSize && hi[k] >= center[k] - node.halfSize;
+        }
+        double size = 2.0 * node.halfSize;
+
+        if (!overlaps && size * size < theta2 * dist2)
+            out.push_back({(float)node.comX, (float)node.comY, (float)node.comZ, node.gm});
+        else
+            for (int o = 0; o < 8; ++o)
+                stack[top++] = node.firstChild + o;
+    }
+}
+
+void Octree::ComputeAccelerations(float theta, double softening2, std::vector<std::array<float, 3>> &accels,
+                                  ThreadPool *pool) const
+{
+    accels.resize(bodyTotal);
+    auto walk = [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            double a[3];
+            ComputeAcceleration(i, theta, softening2, a);
+            accels[i] = {(float)a[0], (float)a[1], (float)a[2]};
+        }
+    };
+
+    // Bodies were inserted in index order, so neighbouring rows rarely share
+    // a walk; chunks just need to be large enough to amortize scheduling
+    if (pool)
+        pool->ParallelFor(bodyTotal, 64, walk);
+    else
+        walk(0, bodyTotal);
+}
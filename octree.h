@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+#include "thread_pool.h"
+
+// Barnes-Hut octree for approximate O(n log n) gravity.
+//
+// The tree is rebuilt from scratch every step from flat position/mass arrays.
+// Positions are in pixels and masses come pre-scaled, gm = FORCE_SCALE * m
+// (pixels^3 / s^2), so a walk computes a = gm * r / |r|^3 in pixels / s^2
+// without converting anything.
+class Octree
+{
+public:
+    struct Node
+    {
+        float centerX, centerY, centerZ; // geometric cell center (pixels)
+        float halfSize;                  // half the cell edge length (pixels)
+        double gm;                       // FORCE_SCALE * total mass in the cell
+        double comX, comY, comZ;         // center of mass (pixels)
+        int firstChild;                  // index of the first of 8 children, -1 for a leaf
+        int firstBody;                   // leaf only: offset into bodyIndex
+        int bodyCount;                   // number of bodies under this cell
+    };
+
+    // Leaves hold up to this many bodies before they are split
+    static const int LEAF_CAPACITY = 8;
+    // Hard depth limit so coincident bodies cannot recurse forever
+    static const int MAX_DEPTH = 32;
+
+    void Build(const float *x, const float *y, const float *z, const double *gm, size_t count);
+
+    // Acceleration on body i using opening angle theta (cell size / distance)
+    // and Plummer softening length squared softening2 (pixels^2, 0 disables).
+    // potential, when given, receives -sum gm / r from the same walk.
+    void ComputeAcceleration(size_t i, float theta, double softening2, double out[3],
+                             double *potential = nullptr) const;
+
+    // The same at an arbitrary point, for bodies that are not in the tree
+    // (test particles); self is the point's own index in the tree, or
+    // SIZE_MAX if it has none
+    void ComputeAccelerationAt(double x, double y, double z, size_t self, float theta, double softening2,
+                               double out[3], double *potential = nullptr) const;
+
+    // Fill accels for every body that was passed to Build(); tree walks are
+    // spread over the pool when one is given
+    void ComputeAccelerations(float theta, double softening2, std::vector<std::array<float, 3>> &accels,
+                              ThreadPool *pool = nullptr) const;
+
+    // A source as seen from far away: one body, or a whole cell as a point
+    // mass at its center of mass
+    struct PointMass
+    {
+        float x, y, z; // pixels
+        double gm;
+    };
+
+    // Everything a walk from any point in the box [lo, hi] needs from this
+    // tree, for the locally essential tree of another process that owns the
+    // box: cells that pass the opening test for every point in the box are
+    // appended as point masses, the rest are opened down to their bodies
+    void ExportEssential(const float lo[3], const float hi[3], float theta, std::vector<PointMass> &out) const;
+
+    const std::vector<Node> &Nodes() const { return nodes; }
+
+private:
+    void BuildNode(int nodeIndex, int begin, int end, int depth);
+
+    // The walk itself, instantiated with and without softening and the
+    // potential sum so neither is a branch per interaction
+    template <bool Softened, bool Potential>
+    void Walk(double xi, double yi, double zi, size_t self, float theta, double softening2, double out[3],
+              double &phi) const;
+
+    std::vector<Node> nodes;
+    std::vector<int> bodyIndex; // bodies grouped so every cell owns a contiguous range
+    std::vector<int> scratch;
+
+    const float *px = nullptr;
+    const float *py = nullptr;
+    const float *pz = nullptr;
+    const double *pgm = nullptr;
+    size_t bodyTotal = 0;
+};
@@ -0,0 +1,418 @@
+#include "physics.h"
+#include "profiler.h"
+#include "units.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// Bodies per task in the O(n) kick and drift loops, enough that scheduling
+// stays small next to the memory traffic
+static const size_t STREAM_GRAIN = 16384;
+
+// Pairs closer than 1e-3 pixels are skipped; this is also what skips the
+// body itself when it is among the sources
+static const double MIN_DIST2 = 1e-6;
+
+// Inputs for one pass of the double-precision direct sum, laid out like
+// DirectKernelArgs: gm[j] is FORCE_SCALE * m_j, so the pair loop works in
+// pixels and seconds throughout and converts nothing
+struct DirectSumArgs
+{
+    const float *x, *y, *z; // sources
+    const double *gm;
+    size_t count;
+    const float *targetX, *targetY, *targetZ; // rows, indexed like accels
+    double softening2;
+    std::array<float, 3> *accels;
+    const uint32_t *rows;
+    float *potentials;
+};
+
+// The exact sum, instantiated per softening and potential so neither is
+// a branch inside the pair loop
+template <bool Softened, bool Potential>
+static void directSumRows(const DirectSumArgs &args, size_t begin, size_t end)
+{
+    const double softening2 = args.softening2;
+    for (size_t k = begin; k < end; ++k)
+    {
+        const size_t i = args.rows ? args.rows[k] : k;
+        const double xi = args.targetX[i];
+        const double yi = args.targetY[i];
+        const double zi = args.targetZ[i];
+        double ax = 0.0, ay = 0.0, az = 0.0, phi = 0.0;
+        for (size_t j = 0; j < args.count; ++j)
+        {
+            double dx = args.x[j] - xi;
+            double dy = args.y[j] - yi;
+            double dz = args.z[j] - zi;
+            double r2 = dx * dx + dy * dy + dz * dz;
+            if (r2 < MIN_DIST2)
+                continue;
+
+            // a = G m r / (r^2 + eps^2)^1.5, phi = -G m / (r^2 + eps^2)^0.5
+            double invR = 1.0 / sqrt(Softened ? r2 + softening2 : r2);
+            double s = args.gm[j] * invR * invR * invR;
+            ax += s * dx;
+            ay += s * dy;
+            az += s * dz;
+            if (Potential)
+                phi -= args.gm[j] * invR;
+        }
+        args.accels[i] = {(float)ax, (float)ay, (float)az};
+        if (Potential)
+            args.potentials[i] = (float)phi;
+    }
+}
+
+typedef void (*DirectSumFn)(const DirectSumArgs &args, size_t begin, size_t end);
+
+static DirectSumFn selectDirectSum(bool softened, bool potentials)
+{
+    if (softened)
+        return potentials ? directSumRows<true, true> : directSumRows<true, false>;
+    return potentials ? directSumRows<false, true> : directSumRows<false, false>;
+}
+
+const char *forceSolverName(ForceSolver solver)
+{
+    switch (solver)
+    {
+    case DIRECT_SUM:
+        return "Direct sum";
+    case DIRECT_SIMD:
+        return "Direct sum (SIMD)";
+    default:
+        return "Barnes-Hut";
+    }
+}
+
+bool parseForceSolver(const char *name, ForceSolver &solver)
+{
+    if (std::strcmp(name, "direct") == 0)
+        solver = DIRECT_SUM;
+    else if (std::strcmp(name, "simd") == 0)
+        solver = DIRECT_SIMD;
+    else if (std::strcmp(name, "barnes-hut") == 0)
+        solver = BARNES_HUT;
+    else
+        return false;
+    return true;
+}
+
+const char *forcePrecisionName(ForcePrecision precision)
+{
+    return precision == PRECISION_MIXED ? "mixed" : "single";
+}
+
+bool parseForcePrecision(const char *name, ForcePrecision &precision)
+{
+    if (std::strcmp(name, "single") == 0)
+        precision = PRECISION_SINGLE;
+    else if (std::strcmp(name, "mixed") == 0)
+        precision = PRECISION_MIXED;
+    else
+        return false;
+    return true;
+}
+
+// Mixed precision lets the centre of mass stray this far from the origin
+// (pixels) and then moves the origin in steps of REBASE_GRAIN, a power of
+// two, so rebasing is exact for the bodies near the centre
+static const double REBASE_DISTANCE = 1024.0;
+static const double REBASE_GRAIN = 256.0;
+
+bool recenterBodies(BodyStore &bodies, const ForceSettings &settings,
+                    const std::function<void(double sums[4])> &combine)
+{
+    if (settings.precision != PRECISION_MIXED)
+        return false;
+
+    // In body order, so every thread count sees the same centre
+    double sums[4] = {0.0, 0.0, 0.0, 0.0};
+    for (size_t i = 0; i < bodies.Size(); ++i)
+    {
+        const double m = bodies.mass[i];
+        sums[0] += m * bodies.x[i];
+        sums[1] += m * bodies.y[i];
+        sums[2] += m * bodies.z[i];
+        sums[3] += m;
+    }
+    if (combine)
+        combine(sums);
+    if (!(sums[3] > 0.0))
+        return false;
+
+    std::array<double, 3> shift;
+    bool far = false;
+    for (int k = 0; k < 3; ++k)
+    {
+        const double center = sums[k] / sums[3];
+        far = far || fabs(center) > REBASE_DISTANCE;
+        shift[k] = REBASE_GRAIN * nearbyint(center / REBASE_GRAIN);
+    }
+    if (!far)
+        return false;
+    bodies.Rebase(shift);
+    return true;
+}
+
+void GravitySolver::Compute(const BodyStore &bodies, std::vector<std::array<float, 3>> &accels)
+{
+    accels.resize(bodies.Size());
+    Evaluate(bodies, nullptr, bodies.Size(), accels);
+    if (!trackPotentials)
+        return;
+
+    for (int k = 0; k < 3; ++k)
+        netForce[k] = netTorque[k] = 0.0;
+    for (size_t i = 0; i < bodies.Size(); ++i)
+    {
+        const double m = bodies.mass[i];
+        const std::array<double, 3> r = bodies.Position(i);
+        const double a[3] = {accels[i][0], accels[i][1], accels[i][2]};
+        netForce[0] += m * a[0];
+        netForce[1] += m * a[1];
+        netForce[2] += m * a[2];
+        netTorque[0] += m * (r[1] * a[2] - r[2] * a[1]);
+        netTorque[1] += m * (r[2] * a[0] - r[0] * a[2]);
+        netTorque[2] += m * (r[0] * a[1] - r[1] * a[0]);
+    }
+}
+
+void GravitySolver::ComputeSubset(const BodyStore &bodies, const std::vector<uint32_t> &rows,
+                                  std::vector<std::array<float, 3>> &accels)
+{
+    accels.resize(bodies.Size());
+    Evaluate(bodies, rows.data(), rows.size(), accels);
+}
+
+bool GravitySolver::GatherSources(const BodyStore &bodies)
+{
+    const size_t n = bodies.Size();
+    const size_t remoteCount = remote ? remote->mass.size() : 0;
+    size_t massive = 0;
+    for (size_t i = 0; i < n; ++i)
+        massive += bodies.mass[i] > 0.0;
+    if (massive == n && remoteCount == 0)
+        return false;
+
+    sourceX.resize(massive + remoteCount);
+    sourceY.resize(massive + remoteCount);
+    sourceZ.resize(massive + remoteCount);
+    sourceMass.resize(massive + remoteCount);
+    sourceOf.resize(n);
+    uint32_t k = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (!(bodies.mass[i] > 0.0))
+        {
+            sourceOf[i] = UINT32_MAX;
+            continue;
+        }
+        sourceOf[i] = k;
+        sourceX[k] = bodies.x[i];
+        sourceY[k] = bodies.y[i];
+        sourceZ[k] = bodies.z[i];
+        sourceMass[k] = bodies.mass[i];
+        ++k;
+    }
+    if (remoteCount > 0)
+    {
+        std::copy(remote->x.begin(), remote->x.end(), sourceX.begin() + massive);
+        std::copy(remote->y.begin(), remote->y.end(), sourceY.begin() + massive);
+        std::copy(remote->z.begin(), remote->z.end(), sourceZ.begin() + massive);
+        std::copy(remote->mass.begin(), remote->mass.end(), sourceMass.begin() + massive);
+    }
+    return true;
+}
+
+void GravitySolver::Evaluate(const BodyStore &bodies, const uint32_t *rows, size_t rowCount,
+                             std::vector<std::array<float, 3>> &accels)
+{
+    PROFILE_SCOPE("forces");
+    size_t n = bodies.Size();
+    evaluations += rowCount;
+    // Before the early out: a process with nothing to evaluate still takes
+    // part in the exchange
+    if (remote)
+        remote->Refresh(bodies, settings);
+    if (rowCount == 0)
+        return;
+    if (trackPotentials)
+        potentials.resize(n);
+    float *phi = trackPotentials ? potentials.data() : nullptr;
+
+    // Test particles only feel the sources; when every body has mass the
+    // store is used as it is
+    const bool subset = GatherSources(bodies);
+    const size_t sources = subset ? sourceMass.size() : n;
+    const float *sx = subset ? sourceX.data() : bodies.x.data();
+    const float *sy = subset ? sourceY.data() : bodies.y.data();
+    const float *sz = subset ? sourceZ.data() : bodies.z.data();
+    const double *sm = subset ? sourceMass.data() : bodies.mass.data();
+
+    // Masses are scaled to simulation units once per pass, never per pair
+    gmExact.resize(sources);
+    for (size_t k = 0; k < sources; ++k)
+        gmExact[k] = FORCE_SCALE * sm[k];
+
+    ThreadPool::RangeFn work;
+    size_t grain = directRowGrain(sources);
+    const double softening2 = (double)settings.softening * settings.softening;
+    DirectKernelArgs args;
+    DirectSumArgs exact;
+
+    if (settings.solver == BARNES_HUT)
+    {
+        {
+            PROFILE_SCOPE("octree build");
+            tree.Build(sx, sy, sz, gmExact.data(), sources);
+        }
+        const float theta = settings.theta;
+        grain = 64;
+        work = [&](size_t begin, size_t end)
+        {
+            for (size_t k = begin; k < end; ++k)
+            {
+                size_t i = rows ? rows[k] : k;
+                size_t self = !subset ? i : sourceOf[i] == UINT32_MAX ? SIZE_MAX : sourceOf[i];
+                double a[3], potential;
+                tree.ComputeAccelerationAt(bodies.x[i], bodies.y[i], bodies.z[i], self, theta, softening2, a,
+                                           phi ? &potential : nullptr);
+                accels[i] = {(float)a[0], (float)a[1], (float)a[2]};
+                if (phi)
+                    phi[i] = (float)potential;
+            }
+        };
+    }
+    else if (settings.solver == DIRECT_SIMD)
+    {
+        gm.resize(sources);
+        for (size_t k = 0; k < sources; ++k)
+            gm[k] = (float)gmExact[k];
+
+        args.x = sx;
+        args.y = sy;
+        args.z = sz;
+        args.gm = gm.data();
+        args.count = sources;
+        if (subset)
+        {
+            args.targetX = bodies.x.data();
+            args.targetY = bodies.y.data();
+            args.targetZ = bodies.z.data();
+            args.sourceOf = sourceOf.data();
+        }
+        args.softening2 = settings.softening * settings.softening;
+        args.accels = accels.data();
+        args.rows = rows;
+        args.potentials = phi;
+
+        DirectKernelFn kernel = selectDirectKernel(settings.isa, phi != nullptr,
+                                                   settings.precision == PRECISION_MIXED, settings.reproducible);
+        work = [&args, kernel](size_t begin, size_t end)
+        { kernel(args, begin, end); };
+    }
+    else
+    {
+        exact = {sx, sy, sz, gmExact.data(), sources, bodies.x.data(), bodies.y.data(), bodies.z.data(),
+                 softening2, accels.data(), rows, phi};
+        DirectSumFn sum = selectDirectSum(softening2 > 0.0, phi != nullptr);
+        work = [&exact, sum](size_t begin, size_t end)
+        { sum(exact, begin, end); };
+    }
+
+    // Each row only writes its own accels entry, so rows can run on any thread
+    if (pool)
+        pool->ParallelFor(rowCount, grain, work);
+    else
+        work(0, rowCount);
+}
+
+size_t directRowGrain(size_t count)
+{
+    return count > 0 ? std::max<size_t>(1, 65536 / count) : 1;
+}
+
+void computeDirectAccelerations(const BodyStore &bodies, float softening, std::vector<std::array<float, 3>> &accels,
+                                ThreadPool *pool)
+{
+    size_t n = bodies.Size();
+    accels.resize(n);
+    std::vector<double> gm(n);
+    for (size_t i = 0; i < n; ++i)
+        gm[i] = FORCE_SCALE * bodies.mass[i];
+
+    const double softening2 = (double)softening * softening;
+    const DirectSumArgs args = {bodies.x.data(), bodies.y.data(), bodies.z.data(), gm.data(), n,
+                                bodies.x.data(), bodies.y.data(), bodies.z.data(), softening2,
+                                accels.data(), nullptr, nullptr};
+    DirectSumFn sum = selectDirectSum(softening2 > 0.0, false);
+
+    // Each row only writes accels[i], so rows can run on any thread
+    if (pool)
+        pool->ParallelFor(n, directRowGrain(n), [&](size_t begin, size_t end) { sum(args, begin, end); });
+    else
+        sum(args, 0, n);
+}
+
+void computeBarnesHutAccelerations(const BodyStore &bodies, float theta, float softening, Octree &tree,
+                                   std::vector<std::array<float, 3>> &accels, ThreadPool *pool)
+{
+    std::vector<double> gm(bodies.Size());
+    for (size_t i = 0; i < gm.size(); ++i)
+        gm[i] = FORCE_SCALE * bodies.mass[i];
+    tree.Build(bodies.x.data(), bodies.y.data(), bodies.z.data(), gm.data(), bodies.Size());
+    tree.ComputeAccelerations(theta, (double)softening * softening, accels, pool);
+}
+
+void kickBodies(BodyStore &bodies, const std::vector<std::array<float, 3>> &accels, double timestep,
+                ThreadPool *pool)
+{
+    PROFILE_SCOPE("kick");
+    size_t n = bodies.Size();
+    float *vx = bodies.vx.data();
+    float *vy = bodies.vy.data();
+    float *vz = bodies.vz.data();
+    auto kick = [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            vx[i] += (float)(accels[i][0] * timestep);
+            vy[i] += (float)(accels[i][1] * timestep);
+            vz[i] += (float)(accels[i][2] * timestep);
+        }
+    };
+    if (pool)
+        pool->ParallelFor(n, STREAM_GRAIN, kick);
+    else
+        kick(0, n);
+}
+
+void driftBodies(BodyStore &bodies, double timestep, ThreadPool *pool)
+{
+    PROFILE_SCOPE("drift");
+    size_t n = bodies.Size();
+    float *x = bodies.x.data();
+    float *y = bodies.y.data();
+    float *z = bodies.z.data();
+    const float *vx = bodies.vx.data();
+    const float *vy = bodies.vy.data();
+    const float *vz = bodies.vz.data();
+    auto drift = [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            x[i] += vx[i] * timestep;
+            y[i] += vy[i] * timestep;
+            z[i] += vz[i] * timestep;
+        }
+    };
+    if (pool)
+        pool->ParallelFor(n, STREAM_GRAIN, drift);
+    else
+        drift(0, n);
+}
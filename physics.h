@@ -0,0 +1,144 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "bodies.h"
+#include "direct_kernel.h"
+#include "octree.h"
+#include "thread_pool.h"
+
+// Gravity solver settings
+enum ForceSolver
+{
+    DIRECT_SUM,  // exact O(n^2) pairwise sum in double, kept as the reference
+    DIRECT_SIMD, // exact O(n^2) pairwise sum, vectorized float32 kernel
+    BARNES_HUT   // octree approximation, O(n log n)
+};
+
+// Arithmetic of the SIMD direct sum (the other solvers always work in
+// double) and of the stored positions
+enum ForcePrecision
+{
+    PRECISION_SINGLE, // float32 pairs and sums, positions relative to a fixed origin
+    PRECISION_MIXED   // float32 pairs, Kahan-compensated sums reduced in double,
+                      // positions relative to an origin that follows the system
+};
+
+struct ForceSettings
+{
+    ForceSolver solver = BARNES_HUT;
+    float theta = 0.5f;     // opening angle: cells with size / distance below this are treated as point masses
+    float softening = 0.0f; // Plummer softening length (pixels), 0 for pure Newtonian gravity
+    KernelIsa isa = detectKernelIsa();
+    ForcePrecision precision = PRECISION_SINGLE;
+    bool reproducible = false; // SIMD direct sum gives the same bits on every instruction set, at
+                               // 35-60% more per pair (see selectDirectKernel)
+};
+
+const char *forceSolverName(ForceSolver solver);
+
+// Command-line names: "direct", "simd", "barnes-hut"
+bool parseForceSolver(const char *name, ForceSolver &solver);
+
+const char *forcePrecisionName(ForcePrecision precision);
+
+// Command-line names: "single", "mixed"
+bool parseForcePrecision(const char *name, ForcePrecision &precision);
+
+// Sources that are not in the store being evaluated: in a multi-process run,
+// the bodies or tree cells of every other process's domain
+class RemoteSources
+{
+public:
+    virtual ~RemoteSources() {}
+
+    // Called at the start of every force pass with the bodies about to be
+    // evaluated; fills the columns below. Every process of a run makes the
+    // same passes, so implementations may exchange data with the others.
+    virtual void Refresh(const BodyStore &bodies, const ForceSettings &settings) = 0;
+
+    AlignedVector<float> x, y, z; // pixels
+    AlignedVector<double> mass;   // kg
+};
+
+// Owns the per-step scratch state (octree) for the selected solver
+class GravitySolver
+{
+public:
+    ForceSettings settings;
+    ThreadPool *pool = nullptr; // force rows and tree walks run here when set
+    RemoteSources *remote = nullptr; // when set, its sources pull on every body too
+
+    // When set, every evaluated row also stores its potential phi_i
+    // (pixels^2 / s^2) in potentials, from the same pass as its force
+    bool trackPotentials = false;
+    std::vector<float> potentials;
+
+    // Also with trackPotentials, each Compute() sums the net force sum m a
+    // (kg pixels / s^2) and torque sum m r x a about the absolute origin
+    // over its bodies. Exact pairwise forces leave only rounding in them;
+    // Barnes-Hut's cell approximations do not cancel between bodies.
+    double netForce[3] = {0, 0, 0};
+    double netTorque[3] = {0, 0, 0};
+
+    // Accelerations (pixels / s^2) for every body from every other body.
+    // Massless bodies are test particles: they feel every massive body but
+    // pull on nothing, so each costs O(massive bodies) instead of O(n).
+    // Each row is summed by one task in a fixed order, so the result is
+    // bit-identical for any thread count.
+    void Compute(const BodyStore &bodies, std::vector<std::array<float, 3>> &accels);
+
+    // Accelerations for the listed bodies only; every body still acts as a
+    // source. accels must hold one entry per body and only listed entries change.
+    void ComputeSubset(const BodyStore &bodies, const std::vector<uint32_t> &rows,
+                       std::vector<std::array<float, 3>> &accels);
+
+    // Number of per-body force evaluations performed so far
+    unsigned long long evaluations = 0;
+
+private:
+    void Evaluate(const BodyStore &bodies, const uint32_t *rows, size_t rowCount,
+                  std::vector<std::array<float, 3>> &accels);
+
+    // Copy the bodies with mass, then any remote sources, into the source
+    // columns; false (and nothing copied) when every body has mass and there
+    // are no remote sources, so the store itself is the source list
+    bool GatherSources(const BodyStore &bodies);
+
+    Octree tree;
+    AlignedVector<double> gmExact; // FORCE_SCALE * mass of each source
+    AlignedVector<float> gm;       // the same in float32 for the SIMD kernel
+    AlignedVector<float> sourceX, sourceY, sourceZ;
+    AlignedVector<double> sourceMass;
+    std::vector<uint32_t> sourceOf; // body -> its source index, UINT32_MAX for test particles
+};
+
+// Exact O(n^2) accelerations (pixels / s^2) for every body from every other body
+void computeDirectAccelerations(const BodyStore &bodies, float softening, std::vector<std::array<float, 3>> &accels,
+                                ThreadPool *pool = nullptr);
+
+// Barnes-Hut accelerations; same units as computeDirectAccelerations
+void computeBarnesHutAccelerations(const BodyStore &bodies, float theta, float softening, Octree &tree,
+                                   std::vector<std::array<float, 3>> &accels, ThreadPool *pool = nullptr);
+
+// Rows per chunk so one chunk of an O(n^2) pass covers roughly 64k pairs
+size_t directRowGrain(size_t count);
+
+// With PRECISION_MIXED, move bodies.origin to the centre of mass once that
+// is more than 1024 pixels away, in whole steps of 256 pixels, so the stored
+// offsets keep their float32 resolution however far the system drifts.
+// Call between steps; combine, when set, replaces the sums over this
+// process's bodies (m x, m y, m z, m) with the sums over every process's.
+// True if the origin moved.
+bool recenterBodies(BodyStore &bodies, const ForceSettings &settings,
+                    const std::function<void(double sums[4])> &combine = nullptr);
+
+// Add acceleration to the velocity (accels in pixels/s^2; timestep in seconds)
+void kickBodies(BodyStore &bodies, const std::vector<std::array<float, 3>> &accels, double timestep,
+                ThreadPool *pool = nullptr);
+
+// Advance positions along the current velocity
+void driftBodies(BodyStore &bodies, double timestep, ThreadPool *pool = nullptr);
@@ -0,0 +1,244 @@
+#include "profiler.h"
+
+#ifdef GRAV_PROFILE
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+
+struct ProfileEvent
+{
+    const char *name;
+    int64_t start; // ns since startTime
+    int64_t end;
+};
+
+// Only its own thread appends, so the lock is uncontended except while a
+// frame is being drained
+struct ThreadLog
+{
+    std::mutex lock;
+    std::vector<ProfileEvent> events;
+    std::string name;
+    int id;
+};
+
+struct PhaseStats
+{
+    int64_t total = 0; // ns
+    unsigned long long calls = 0;
+};
+
+// The same literal can live at different addresses in different files
+struct NameLess
+{
+    bool operator()(const char *a, const char *b) const { return std::strcmp(a, b) < 0; }
+};
+
+struct TraceEvent
+{
+    ProfileEvent event;
+    int thread;
+};
+
+// Roughly 100 MB of trace before recording stops
+const size_t MAX_TRACE_EVENTS = 4u << 20;
+
+const Clock::time_point startTime = Clock::now();
+
+std::mutex registryLock;
+std::vector<std::unique_ptr<ThreadLog>> logs; // never shrinks, so thread pointers stay valid
+thread_local ThreadLog *threadLog = nullptr;
+
+// Main loop only
+std::vector<ProfileEvent> drained;
+std::map<const char *, PhaseStats, NameLess> phases;
+unsigned long long frames = 0;
+bool tracing = false;
+std::vector<TraceEvent> trace;
+
+ThreadLog &currentLog()
+{
+    if (!threadLog)
+    {
+        std::lock_guard<std::mutex> guard(registryLock);
+        logs.emplace_back(new ThreadLog());
+        threadLog = logs.back().get();
+        threadLog->id = (int)logs.size() - 1;
+    }
+    return *threadLog;
+}
+
+// Trace names go out verbatim, so keep them JSON-safe
+void writeJsonString(FILE *out, const char *text)
+{
+    fputc('"', out);
+    for (const char *p = text; *p; ++p)
+    {
+        if (*p == '"' || *p == '\\')
+            fputc('\\', out);
+        if ((unsigned char)*p >= 0x20)
+            fputc(*p, out);
+    }
+    fputc('"', out);
+}
+} // namespace
+
+bool profileEnabled()
+{
+    return true;
+}
+
+int64_t profileNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - startTime).count();
+}
+
+void profileRecord(const char *name, int64_t start, int64_t end)
+{
+    ThreadLog &log = currentLog();
+    std::lock_guard<std::mutex> guard(log.lock);
+    log.events.push_back({name, start, end});
+}
+
+void profileThreadName(const char *name)
+{
+    ThreadLog &log = currentLog();
+    std::lock_guard<std::mutex> guard(log.lock);
+    log.name = name;
+}
+
+void profileEndFrame()
+{
+    std::vector<ThreadLog *> snapshot;
+    {
+        std::lock_guard<std::mutex> guard(registryLock);
+        for (auto &log : logs)
+            snapshot.push_back(log.get());
+    }
+
+    for (ThreadLog *log : snapshot)
+    {
+        {
+            std::lock_guard<std::mutex> guard(log->lock);
+            drained.swap(log->events);
+        }
+        for (const ProfileEvent &event : drained)
+        {
+            PhaseStats &stats = phases[event.name];
+            stats.total += event.end - event.start;
+            ++stats.calls;
+            if (tracing && trace.size() < MAX_TRACE_EVENTS)
+                trace.push_back({event, log->id});
+        }
+        drained.clear();
+    }
+    ++frames;
+}
+
+void profilePrintSummary(FILE *out)
+{
+    if (frames == 0)
+        return;
+
+    std::vector<std::pair<const char *, PhaseStats>> sorted(phases.begin(), phases.end());
+    std::sort(sorted.begin(), sorted.end(),
+              [](const std::pair<const char *, PhaseStats> &a, const std::pair<const char *, PhaseStats> &b)
+              { return a.second.total > b.second.total; });
+
+    fprintf(out, "Profile over %llu frames (ms per frame, calls per frame):\n", frames);
+    for (const auto &phase : sorted)
+    {
+        fprintf(out, "  %-24s %10.4f ms %9.1f\n", phase.first, phase.second.total * 1e-6 / frames,
+                (double)phase.second.calls / frames);
+    }
+    phases.clear();
+    frames = 0;
+}
+
+void profileStartTrace()
+{
+    tracing = true;
+    trace.clear();
+}
+
+bool profileWriteTrace(const char *path)
+{
+    FILE *out = fopen(path, "w");
+    if (!out)
+    {
+        fprintf(stderr, "Failed to write trace %s\n", path);
+        return false;
+    }
+
+    // Complete ("X") events with microsecond timestamps, plus thread names
+    fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool first = true;
+    {
+        std::lock_guard<std::mutex> guard(registryLock);
+        for (auto &log : logs)
+        {
+            std::lock_guard<std::mutex> logGuard(log->lock);
+            if (log->name.empty())
+                continue;
+            fprintf(out, "%s{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": ",
+                    first ? "" : ",\n", log->id);
+            writeJsonString(out, log->name.c_str());
+            fprintf(out, "}}");
+            first = false;
+        }
+    }
+    for (const TraceEvent &t : trace)
+    {
+        fprintf(out, "%s{\"ph\": \"X\", \"name\": ", first ? "" : ",\n");
+        writeJsonString(out, t.event.name);
+        fprintf(out, ", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}", t.thread, t.event.start * 1e-3,
+                (t.event.end - t.event.start) * 1e-3);
+        first = false;
+    }
+    fprintf(out, "\n]}\n");
+
+    if (trace.size() >= MAX_TRACE_EVENTS)
+        fprintf(stderr, "Trace stopped after %zu events\n", trace.size());
+    if (fclose(out) != 0)
+    {
+        fprintf(stderr, "Failed to write trace %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+#else
+
+bool profileEnabled()
+{
+    return false;
+}
+
+int64_t profileNow()
+{
+    return 0;
+}
+
+void profileRecord(const char *, int64_t, int64_t) {}
+void profileThreadName(const char *) {}
+void profileEndFrame() {}
+void profilePrintSummary(FILE *) {}
+void profileStartTrace() {}
+
+bool profileWriteTrace(const char *path)
+{
+    fprintf(stderr, "Not writing %s: built without GRAV_PROFILE (make PROFILE=1)\n", path);
+    return false;
+}
+
+#endif
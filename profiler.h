@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+// Scoped phase timers for finding where frame and step time goes.
+//
+// PROFILE_SCOPE("name") times the rest of the enclosing block on the
+// calling thread; names must be string literals. Scopes only exist when
+// built with GRAV_PROFILE (make PROFILE=1); otherwise the macros expand to
+// nothing and the functions below are empty.
+//
+// Each thread appends to its own event log. profileEndFrame(), called once
+// per frame (or step) by the main loop, drains every log into the rolling
+// summary and, while tracing, into the Chrome trace.
+#ifdef GRAV_PROFILE
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_THREAD(name) profileThreadName(name)
+#else
+#define PROFILE_SCOPE(name) \
+    do                      \
+    {                       \
+    } while (0)
+#define PROFILE_THREAD(name) \
+    do                       \
+    {                        \
+    } while (0)
+#endif
+
+// True when scopes are compiled in
+bool profileEnabled();
+
+// Nanoseconds on a steady clock since the profiler started
+int64_t profileNow();
+
+// Log one finished scope on the calling thread
+void profileRecord(const char *name, int64_t start, int64_t end);
+
+// Label the calling thread in traces
+void profileThreadName(const char *name);
+
+// Fold every thread's events since the last call into the summary (and the trace)
+void profileEndFrame();
+
+// Average time per frame of each phase since the last summary, then reset.
+// Worker phases are summed over threads, so they can exceed the frame time.
+void profilePrintSummary(FILE *out);
+
+// Keep events for a Chrome trace (chrome://tracing, Perfetto) from now on,
+// up to a bounded number of events
+void profileStartTrace();
+
+// Write the events kept since profileStartTrace() as trace-event JSON
+bool profileWriteTrace(const char *path);
+
+class ProfileScope
+{
+public:
+    explicit ProfileScope(const char *scopeName) : name(scopeName), start(profileNow()) {}
+    ~ProfileScope() { profileRecord(name, start, profileNow()); }
+
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+    const char *name;
+    int64_t start;
+};
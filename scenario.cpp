@@ -0,0 +1,598 @@
+#include "scenario.h"
+#include "units.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+double orbitalVelocity(double G, double centralMass, double distanceMeters)
+{
+    return sqrt(G * centralMass / distanceMeters);
+}
+
+void loadSolarSystem(BodyStore &bodies)
+{
+    double sunMass = 1.989e30;
+
+    // Add the Sun first so we can reference it (index 0)
+    bodies.Clear();
+
+    // Create Sun as a moving STAR object (initially at origin, zero velocity)
+    size_t sunIndex = bodies.Add(0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, sunMass, {{1.0f, 1.0f, 0.0f, 1.0f}}, STAR);
+    float sunRadius = bodies.Radius(sunIndex);
+
+    struct CelestialInfo
+    {
+        double distanceKm;
+        double mass;
+        std::array<float, 4> color;
+        CelestialType type;
+    };
+
+    std::vector<CelestialInfo> celestialInfos = {
+        {57.9e6, 3.285e23, {{0.6f, 0.6f, 0.6f, 1.0f}}, PLANET},   // Mercury
+        {108.2e6, 4.867e24, {{1.0f, 0.5f, 0.0f, 1.0f}}, PLANET},  // Venus
+        {149.6e6, 5.972e24, {{0.0f, 0.5f, 1.0f, 1.0f}}, PLANET},  // Earth
+        {227.9e6, 6.39e23, {{1.0f, 0.2f, 0.2f, 1.0f}}, PLANET},   // Mars
+        {778.5e6, 1.898e27, {{1.0f, 0.7f, 0.4f, 1.0f}}, PLANET},  // Jupiter
+        {1.433e9, 5.683e26, {{1.0f, 1.0f, 0.7f, 1.0f}}, PLANET},  // Saturn
+        {2.8725e9, 8.681e25, {{0.5f, 1.0f, 1.0f, 1.0f}}, PLANET}, // Uranus
+        {4.495e9, 1.024e26, {{0.2f, 0.4f, 1.0f, 1.0f}}, PLANET},  // Neptune
+        // Add a black hole beyond Neptune
+        // {6.0e9, sunMass * 0.5, {{0.0f, 0.0f, 0.0f, 1.0f}}, BLACK_HOLE} // Black hole
+
+    };
+
+    // Sort objects ascending by distance (optional)
+    std::sort(celestialInfos.begin(), celestialInfos.end(),
+              [](const CelestialInfo &a, const CelestialInfo &b)
+              {
+                  return a.distanceKm < b.distanceKm;
+              });
+
+    float lastOrbitRadius = sunRadius + 20.0f;
+    int objectIndex = 0;
+    for (const auto &c : celestialInfos)
+    {
+        double distanceMeters = c.distanceKm * 1000.0;
+        float distancePixels = (float)(distanceMeters / DISTANCE_SCALE);
+
+        float objectRadiusPixels = celestialRadius(c.mass, 1400.0, c.type);
+
+        float minOrbitRadius = lastOrbitRadius + objectRadiusPixels + 10.0f;
+        if (distancePixels < minOrbitRadius)
+            distancePixels = minOrbitRadius;
+
+        lastOrbitRadius = distancePixels;
+
+        // Use initial orbital speed around the Sun (approximation)
+        double distanceForVelocityMeters = distancePixels * DISTANCE_SCALE;
+        double velMag = orbitalVelocity(G, sunMass, distanceForVelocityMeters);
+        double velPixels = velMag / DISTANCE_SCALE;
+
+        // Add slight orbital inclinations for visual interest (in radians)
+        float inclination = (objectIndex * 5.0f) * M_PI / 180.0f; // 0-45 degrees
+        float startAngle = objectIndex * 40.0f * M_PI / 180.0f;   // Spread objects around
+
+        // Calculate 3D position
+        float posX = distancePixels * cosf(startAngle) * cosf(inclination);
+        float posY = distancePixels * sinf(startAngle) * cosf(inclination);
+        float posZ = distancePixels * sinf(inclination);
+
+        // Calculate 3D velocity (perpendicular to position vector to approximate circular orbit)
+        float velX = -posY * (float)velPixels / distancePixels;
+        float velY = posX * (float)velPixels / distancePixels;
+        float velZ = 0.0f; // Keep orbital motion mostly in XY plane
+
+        bodies.Add(posX, posY, posZ, velX, velY, velZ, c.mass, c.color, c.type);
+
+        objectIndex++;
+    }
+}
+
+const char *celestialTypeName(CelestialType type)
+{
+    switch (type)
+    {
+    case STAR:
+        return "STAR";
+    case BLACK_HOLE:
+        return "BLACK_HOLE";
+    default:
+        return "PLANET";
+    }
+}
+
+bool parseCelestialType(const char *name, CelestialType &type)
+{
+    if (std::strcmp(name, "PLANET") == 0)
+        type = PLANET;
+    else if (std::strcmp(name, "STAR") == 0)
+        type = STAR;
+    else if (std::strcmp(name, "BLACK_HOLE") == 0)
+        type = BLACK_HOLE;
+    else
+        return false;
+    return true;
+}
+
+void addTestParticleBelt(BodyStore &bodies, size_t count, float innerRadius, float outerRadius, unsigned seed)
+{
+    if (bodies.Size() == 0 || count == 0)
+        return;
+
+    const double mu = FORCE_SCALE * bodies.mass[0];
+    const double center[3] = {bodies.x[0], bodies.y[0], bodies.z[0]};
+    const double drift[3] = {bodies.vx[0], bodies.vy[0], bodies.vz[0]};
+    const double inner2 = (double)innerRadius * innerRadius;
+    const double outer2 = (double)outerRadius * outerRadius;
+    const double maxInclination = 2.0 * M_PI / 180.0;
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    bodies.Reserve(bodies.Size() + count);
+    for (size_t k = 0; k < count; ++k)
+    {
+        // Uniform in area, so the belt is as dense at its outer edge as its inner
+        double r = sqrt(inner2 + (outer2 - inner2) * unit(rng));
+        double angle = 2.0 * M_PI * unit(rng);
+        double inclination = maxInclination * (2.0 * unit(rng) - 1.0);
+        double node = 2.0 * M_PI * unit(rng);
+        double speed = sqrt(mu / r);
+
+        // Circular orbit in the XY plane, tilted about the line of nodes
+        double px = r * cos(angle), py = r * sin(angle);
+        double vx = -speed * sin(angle), vy = speed * cos(angle);
+        double cn = cos(node), sn = sin(node), ci = cos(inclination), si = sin(inclination);
+        double along = px * cn + py * sn, across = -px * sn + py * cn;
+        double vAlong = vx * cn + vy * sn, vAcross = -vx * sn + vy * cn;
+        bodies.Add((float)(center[0] + along * cn - across * ci * sn), (float)(center[1] + along * sn + across * ci * cn),
+                   (float)(center[2] + across * si), (float)(drift[0] + vAlong * cn - vAcross * ci * sn),
+                   (float)(drift[1] + vAlong * sn + vAcross * ci * cn), (float)(drift[2] + vAcross * si), 0.0,
+                   {{0.6f, 0.55f, 0.5f, 1.0f}});
+    }
+}
+
+bool parseBeltSpec(const char *spec, size_t &count, float &innerRadius, float &outerRadius)
+{
+    unsigned long long n = 0;
+    if (sscanf(spec, "%llu:%f:%f", &n, &innerRadius, &outerRadius) != 3 || innerRadius <= 0.0f ||
+        outerRadius < innerRadius)
+        return false;
+    count = (size_t)n;
+    return true;
+}
+
+bool loadTextScenario(const char *path, BodyStore &bodies)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to open scenario %s\n", path);
+        return false;
+    }
+
+    bodies.Clear();
+    char line[512];
+    int lineNumber = 0;
+    bool ok = true;
+    while (fgets(line, sizeof(line), file))
+    {
+        ++lineNumber;
+        const char *p = line;
+        while (*p == ' ' || *p == '\t')
+            ++p;
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+            continue;
+
+        char typeName[32];
+        double mass;
+        double density = 1400.0;
+        float x, y, z, vx, vy, vz;
+        std::array<float, 4> color = {{1.0f, 1.0f, 1.0f, 1.0f}};
+        int fields = sscanf(p, "%31s %lf %f %f %f %f %f %f %f %f %f %f %lf", typeName, &mass, &x, &y, &z, &vx, &vy,
+                            &vz, &color[0], &color[1], &color[2], &color[3], &density);
+
+        CelestialType type;
+        if (fields < 8 || !parseCelestialType(typeName, type) || !(density > 0.0))
+        {
+            fprintf(stderr, "%s:%d: expected TYPE mass x y z vx vy vz [r g b a [density]]\n", path, lineNumber);
+            ok = false;
+            break;
+        }
+        bodies.Add(x, y, z, vx, vy, vz, mass, color, type, density);
+    }
+    fclose(file);
+    return ok;
+}
+
+bool saveTextScenario(const char *path, const BodyStore &bodies)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to write scenario %s\n", path);
+        return false;
+    }
+
+    fprintf(file, "# TYPE mass x y z vx vy vz r g b a density\n");
+    for (size_t i = 0; i < bodies.Size(); ++i)
+    {
+        // %.9g round-trips float32 exactly, %.17g round-trips double. Positions
+        // are absolute, so they round-trip exactly while the origin is zero.
+        const std::array<float, 4> &c = bodies.hue[i];
+        const std::array<double, 3> r = bodies.Position(i);
+        fprintf(file, "%s %.17g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.17g\n",
+                celestialTypeName(bodies.type[i]), bodies.mass[i], (float)r[0], (float)r[1], (float)r[2],
+                bodies.vx[i], bodies.vy[i], bodies.vz[i], c[0], c[1], c[2], c[3], bodies.density[i]);
+    }
+
+    bool ok = fclose(file) == 0;
+    if (!ok)
+        fprintf(stderr, "Failed to write scenario %s\n", path);
+    return ok;
+}
+
+static const char BINARY_MAGIC[8] = {'G', 'R', 'A', 'V', 'S', 'C', 'N', '\0'};
+static const uint32_t BINARY_VERSION = 1;
+static const size_t BINARY_ALIGNMENT = 64;
+
+enum BinaryColumn
+{
+    COLUMN_X,
+    COLUMN_Y,
+    COLUMN_Z,
+    COLUMN_VX,
+    COLUMN_VY,
+    COLUMN_VZ,
+    COLUMN_MASS,
+    COLUMN_DENSITY,
+    COLUMN_HUE,
+    COLUMN_TYPE,
+    COLUMN_COUNT
+};
+
+struct BinaryHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t columnCount;
+    uint64_t bodyCount;
+    uint64_t columnOffset[COLUMN_COUNT];
+    double origin[3]; // pixels the position columns are relative to; zero in files from before it existed
+};
+static_assert(sizeof(BinaryHeader) == 128, "binary scenario header must stay 128 bytes");
+
+static size_t columnElementSize(int column)
+{
+    switch (column)
+    {
+    case COLUMN_MASS:
+    case COLUMN_DENSITY:
+        return sizeof(double);
+    case COLUMN_HUE:
+        return 4 * sizeof(float);
+    case COLUMN_TYPE:
+        return sizeof(uint8_t);
+    default:
+        return sizeof(float);
+    }
+}
+
+// The format is little-endian and columns are copied as-is
+static bool hostIsLittleEndian()
+{
+    const uint16_t probe = 1;
+    uint8_t low;
+    std::memcpy(&low, &probe, 1);
+    return low == 1;
+}
+
+static bool hasBinaryMagic(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return false;
+    char magic[sizeof(BINARY_MAGIC)];
+    bool match = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+                 std::memcmp(magic, BINARY_MAGIC, sizeof(magic)) == 0;
+    fclose(file);
+    return match;
+}
+
+bool readBinaryScenario(const unsigned char *data, size_t size, BodyStore &bodies, const char *name)
+{
+    if (!hostIsLittleEndian())
+    {
+        fprintf(stderr, "Binary scenarios are only supported on little-endian hosts\n");
+        return false;
+    }
+    if (size < sizeof(BinaryHeader))
+    {
+        fprintf(stderr, "%s: not a binary scenario\n", name);
+        return false;
+    }
+
+    BinaryHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC)) != 0)
+    {
+        fprintf(stderr, "%s: not a binary scenario\n", name);
+        return false;
+    }
+    if (header.version != BINARY_VERSION || header.columnCount != COLUMN_COUNT)
+    {
+        fprintf(stderr, "%s: unsupported scenario version %u\n", name, header.version);
+        return false;
+    }
+
+    const size_t count = (size_t)header.bodyCount;
+    for (int c = 0; c < COLUMN_COUNT; ++c)
+    {
+        uint64_t offset = header.columnOffset[c];
+        if (offset > size || count > (size - offset) / columnElementSize(c))
+        {
+            fprintf(stderr, "%s: truncated scenario\n", name);
+            return false;
+        }
+    }
+
+    // One block copy per column straight into the body arrays
+    bodies.Resize(count);
+    for (int k = 0; k < 3; ++k)
+        bodies.origin[k] = header.origin[k];
+    void *const targets[COLUMN_TYPE] = {bodies.x.data(), bodies.y.data(), bodies.z.data(),
+                                        bodies.vx.data(), bodies.vy.data(), bodies.vz.data(),
+                                        bodies.mass.data(), bodies.density.data(), bodies.hue.data()};
+    for (int c = 0; c < COLUMN_TYPE; ++c)
+    {
+        if (count > 0)
+            std::memcpy(targets[c], data + header.columnOffset[c], count * columnElementSize(c));
+    }
+
+    const unsigned char *types = data + header.columnOffset[COLUMN_TYPE];
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (types[i] > BLACK_HOLE)
+        {
+            fprintf(stderr, "%s: body %zu has unknown type %u\n", name, i, types[i]);
+            bodies.Clear();
+            return false;
+        }
+        bodies.type[i] = (CelestialType)types[i];
+    }
+    return true;
+}
+
+bool writeBinaryScenario(FILE *file, const BodyStore &bodies)
+{
+    if (!hostIsLittleEndian())
+    {
+        fprintf(stderr, "Binary scenarios are only supported on little-endian hosts\n");
+        return false;
+    }
+
+    const size_t count = bodies.Size();
+    BinaryHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC));
+    header.version = BINARY_VERSION;
+    header.columnCount = COLUMN_COUNT;
+    header.bodyCount = count;
+    for (int k = 0; k < 3; ++k)
+        header.origin[k] = bodies.origin[k];
+
+    uint64_t offset = sizeof(header);
+    for (int c = 0; c < COLUMN_COUNT; ++c)
+    {
+        offset = (offset + BINARY_ALIGNMENT - 1) / BINARY_ALIGNMENT * BINARY_ALIGNMENT;
+        header.columnOffset[c] = offset;
+        offset += count * columnElementSize(c);
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    uint64_t written = sizeof(header);
+    const void *const sources[COLUMN_TYPE] = {bodies.x.data(), bodies.y.data(), bodies.z.data(),
+                                              bodies.vx.data(), bodies.vy.data(), bodies.vz.data(),
+                                              bodies.mass.data(), bodies.density.data(), bodies.hue.data()};
+    static const uint8_t padding[BINARY_ALIGNMENT] = {0};
+    for (int c = 0; ok && c < COLUMN_COUNT; ++c)
+    {
+        size_t pad = (size_t)(header.columnOffset[c] - written);
+        ok = pad == 0 || fwrite(padding, 1, pad, file) == pad;
+        written = header.columnOffset[c];
+
+        if (c < COLUMN_TYPE)
+        {
+            size_t bytes = count * columnElementSize(c);
+            ok = ok && (bytes == 0 || fwrite(sources[c], 1, bytes, file) == bytes);
+        }
+        else
+        {
+            std::vector<uint8_t> types(count);
+            for (size_t i = 0; i < count; ++i)
+                types[i] = (uint8_t)bodies.type[i];
+            ok = ok && (count == 0 || fwrite(types.data(), 1, count, file) == count);
+        }
+        written += count * columnElementSize(c);
+    }
+    return ok;
+}
+
+bool loadBinaryScenario(const char *path, BodyStore &bodies)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to open scenario %s\n", path);
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        fprintf(stderr, "%s: not a binary scenario\n", path);
+        close(fd);
+        return false;
+    }
+
+    const size_t fileSize = (size_t)info.st_size;
+    void *mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "Failed to map scenario %s\n", path);
+        return false;
+    }
+    madvise(mapping, fileSize, MADV_SEQUENTIAL);
+
+    bool ok = readBinaryScenario(static_cast<const unsigned char *>(mapping), fileSize, bodies, path);
+    munmap(mapping, fileSize);
+    return ok;
+}
+
+bool saveBinaryScenario(const char *path, const BodyStore &bodies)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to write scenario %s\n", path);
+        return false;
+    }
+
+    bool ok = writeBinaryScenario(file, bodies);
+    ok = (fclose(file) == 0) && ok;
+    if (!ok)
+        fprintf(stderr, "Failed to write scenario %s\n", path);
+    return ok;
+}
+
+// Position and velocity (meters, m/s) relative to the primary from classical
+// elements; angles in radians
+static void elementsToState(double mu, double a, double e, double inc, double node, double peri, double meanAnomaly,
+                            double r[3], double v[3])
+{
+    // Kepler's equation E - e sin E = M by Newton iteration
+    double M = fmod(meanAnomaly, 2.0 * M_PI);
+    double E = e < 0.8 ? M : M_PI;
+    for (int iter = 0; iter < 50; ++iter)
+    {
+        double f = E - e * sin(E) - M;
+        double delta = f / (1.0 - e * cos(E));
+        E -= delta;
+        if (fabs(delta) < 1e-14)
+            break;
+    }
+
+    // Perifocal frame: periapsis along x, orbit normal along z
+    double cosE = cos(E), sinE = sin(E);
+    double b = a * sqrt(1.0 - e * e);
+    double px = a * (cosE - e);
+    double py = b * sinE;
+    double radius = a * (1.0 - e * cosE);
+    double speedScale = sqrt(mu * a) / radius;
+    double pvx = -speedScale * sinE;
+    double pvy = speedScale * sqrt(1.0 - e * e) * cosE;
+
+    // Rotate by argument of periapsis, inclination and ascending node
+    double cO = cos(node), sO = sin(node);
+    double cw = cos(peri), sw = sin(peri);
+    double ci = cos(inc), si = sin(inc);
+    const double xAxis[3] = {cO * cw - sO * sw * ci, sO * cw + cO * sw * ci, sw * si};
+    const double yAxis[3] = {-cO * sw - sO * cw * ci, -sO * sw + cO * cw * ci, cw * si};
+    for (int k = 0; k < 3; ++k)
+    {
+        r[k] = px * xAxis[k] + py * yAxis[k];
+        v[k] = pvx * xAxis[k] + pvy * yAxis[k];
+    }
+}
+
+bool loadOrbitalElements(const char *path, BodyStore &bodies)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to open scenario %s\n", path);
+        return false;
+    }
+
+    const double AU_METERS = 1.495978707e11;
+    const double DEGREES = M_PI / 180.0;
+
+    bodies.Clear();
+    char line[512];
+    int lineNumber = 0;
+    bool ok = true;
+    double primaryMass = 0.0;
+    while (fgets(line, sizeof(line), file))
+    {
+        ++lineNumber;
+        const char *p = line;
+        while (*p == ' ' || *p == '\t')
+            ++p;
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+            continue;
+
+        char typeName[32];
+        double mass, a = 0.0, e = 0.0, inc = 0.0, node = 0.0, peri = 0.0, meanAnomaly = 0.0;
+        std::array<float, 4> color = {{1.0f, 1.0f, 1.0f, 1.0f}};
+        int fields = sscanf(p, "%31s %lf %lf %lf %lf %lf %lf %lf %f %f %f %f", typeName, &mass, &a, &e, &inc, &node,
+                            &peri, &meanAnomaly, &color[0], &color[1], &color[2], &color[3]);
+
+        CelestialType type;
+        bool primary = bodies.Size() == 0;
+        if (fields < (primary ? 2 : 8) || !parseCelestialType(typeName, type))
+        {
+            fprintf(stderr, "%s:%d: expected TYPE mass a e i node peri M [r g b a]\n", path, lineNumber);
+            ok = false;
+            break;
+        }
+        if (primary)
+        {
+            primaryMass = mass;
+            if (fields < 8)
+                color = {{1.0f, 1.0f, 0.0f, 1.0f}};
+            bodies.Add(0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, mass, color, type);
+            continue;
+        }
+        if (!(a > 0.0) || !(e >= 0.0 && e < 1.0))
+        {
+            fprintf(stderr, "%s:%d: only bound elliptic orbits (a > 0, 0 <= e < 1) are supported\n", path, lineNumber);
+            ok = false;
+            break;
+        }
+
+        double r[3], v[3];
+        elementsToState(G * (primaryMass + mass), a * AU_METERS, e, inc * DEGREES, node * DEGREES, peri * DEGREES,
+                        meanAnomaly * DEGREES, r, v);
+        bodies.Add((float)(r[0] / DISTANCE_SCALE), (float)(r[1] / DISTANCE_SCALE), (float)(r[2] / DISTANCE_SCALE),
+                   (float)(v[0] / DISTANCE_SCALE), (float)(v[1] / DISTANCE_SCALE), (float)(v[2] / DISTANCE_SCALE), mass,
+                   color, type);
+    }
+    fclose(file);
+    return ok;
+}
+
+bool loadScenario(const char *path, BodyStore &bodies)
+{
+    if (hasBinaryMagic(path))
+        return loadBinaryScenario(path, bodies);
+    return loadTextScenario(path, bodies);
+}
+
+bool saveScenario(const char *path, const BodyStore &bodies)
+{
+    size_t length = std::strlen(path);
+    if (length >= 5 && std::strcmp(path + length - 5, ".grav") == 0)
+        return saveBinaryScenario(path, bodies);
+    return saveTextScenario(path, bodies);
+}
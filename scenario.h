@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdio>
+
+#include "bodies.h"
+
+// Sun (body 0) plus the eight planets, the viewer's default system
+void loadSolarSystem(BodyStore &bodies);
+
+// Append count massless test particles on circular orbits around body 0,
+// spread evenly over the annulus between innerRadius and outerRadius pixels
+// with up to two degrees of inclination. They feel gravity but exert none.
+void addTestParticleBelt(BodyStore &bodies, size_t count, float innerRadius, float outerRadius, unsigned seed = 1);
+
+// Command-line belt spec "N:INNER:OUTER" (radii in pixels)
+bool parseBeltSpec(const char *spec, size_t &count, float &innerRadius, float &outerRadius);
+
+// Plain-text scenarios, one body per line:
+//   TYPE mass x y z vx vy vz [r g b a [density]]
+// TYPE is PLANET, STAR or BLACK_HOLE; mass in kg, positions in pixels,
+// velocities in pixels/s, density in kg/m^3 (default 1400, and kept so
+// merged bodies reload with their radius); mass 0 makes a test particle.
+// Blank lines and lines starting with '#' are skipped.
+bool loadTextScenario(const char *path, BodyStore &bodies);
+bool saveTextScenario(const char *path, const BodyStore &bodies);
+
+// Binary scenarios: little-endian and column-oriented so a file can be
+// mmap'ed and each column copied into its BodyStore column in one block.
+//
+//   header (128 bytes): magic "GRAVSCN\0", uint32 version (1),
+//                       uint32 column count (10), uint64 body count,
+//                       uint64 byte offset of each column,
+//                       float64 origin x y z (see BodyStore::origin)
+//   columns, each 64-byte aligned, in order:
+//     x y z vx vy vz (float32), mass density (float64),
+//     colour (4 x float32), type (uint8)
+bool loadBinaryScenario(const char *path, BodyStore &bodies);
+bool saveBinaryScenario(const char *path, const BodyStore &bodies);
+
+// The same layout as a block inside a larger file (column offsets are
+// relative to the block); name is only used in error messages
+bool writeBinaryScenario(FILE *file, const BodyStore &bodies);
+bool readBinaryScenario(const unsigned char *data, size_t size, BodyStore &bodies, const char *name);
+
+// Orbital elements around the first body, one body per line:
+//   TYPE mass [a e i node peri M [r g b a]]
+// The first line is the primary, placed at rest at the origin; every other
+// line needs all six elements: semi-major axis a in AU, eccentricity e < 1,
+// and inclination, longitude of the ascending node, argument of periapsis
+// and mean anomaly in degrees. The XY plane is the reference plane.
+bool loadOrbitalElements(const char *path, BodyStore &bodies);
+
+// Binary files are recognised by their magic, anything else is read as text
+bool loadScenario(const char *path, BodyStore &bodies);
+// Paths ending in ".grav" are written as binary, anything else as text
+bool saveScenario(const char *path, const BodyStore &bodies);
+
+const char *celestialTypeName(CelestialType type);
+bool parseCelestialType(const char *name, CelestialType &type);
+
+double orbitalVelocity(double G, double centralMass, double distanceMeters);
@@ -0,0 +1,22 @@
+#pragma once
+
+// Target detection and floating-point settings shared by the SIMD kernel
+// files (direct_kernel.cpp, ensemble.cpp). Include it after every other
+// header: the pragma applies to everything compiled below it.
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GRAV_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define GRAV_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Multiply-adds are only ever written out explicitly. Kernels that must
+// round the same way on every target (the ensemble lanes, the reproducible
+// direct sum) rely on every other product and sum staying unfused. The
+// Makefile and CI build with -ffp-contract=off for that; clang also gets the
+// pragma so a build that drops the flag still keeps these files unfused.
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#endif
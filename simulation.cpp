@@ -0,0 +1,262 @@
+#include "simulation.h"
+
+#include <chrono>
+
+#include "profiler.h"
+#include "units.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// Steps run back to back before a publish when the thread falls behind; past
+// this the backlog is dropped so a slow solver slows the simulation instead
+// of spiralling
+static const int MAX_CATCH_UP_STEPS = 64;
+
+// Minimum wall time between snapshots; copying the bodies every step would
+// cost more than the step itself at high step rates
+static const Clock::duration PUBLISH_INTERVAL = std::chrono::milliseconds(4);
+
+SimulationThread::SimulationThread(const BodyStore &initial, ThreadPool *pool)
+    : bodies(initial), integrator(createIntegrator(LEAPFROG_KDK)), timestep(SECONDS_PER_YEAR), stepRate(60.0),
+      requestPending(false), running(false)
+{
+    gravity.pool = pool;
+    requestedForces = gravity.settings;
+
+    SimSnapshot first;
+    first.bodies = bodies;
+    snapshots.Fill(first);
+}
+
+SimulationThread::~SimulationThread()
+{
+    Stop();
+}
+
+void SimulationThread::Start()
+{
+    if (running)
+        return;
+    running = true;
+    thread = std::thread(&SimulationThread::Run, this);
+}
+
+void SimulationThread::Stop()
+{
+    running = false;
+    if (thread.joinable())
+    {
+        thread.join();
+        if (checkpoints)
+        {
+            WriteCheckpoint();
+            checkpoints->Flush();
+        }
+    }
+}
+
+void SimulationThread::Restore(Checkpoint &checkpoint)
+{
+    integrator = restoreIntegrator(checkpoint);
+    bodies = checkpoint.bodies;
+    simTime = checkpoint.simTime;
+    step = checkpoint.step;
+    timestep = checkpoint.timestep;
+    gravity.settings = checkpoint.forces;
+
+    // Matching requests, so applying them neither swaps nor resets the integrator
+    {
+        std::lock_guard<std::mutex> guard(requestLock);
+        requestedForces = gravity.settings;
+        requestedIntegrator = integrator->Type();
+        requestPending = false;
+    }
+
+    SimSnapshot first;
+    first.bodies = bodies;
+    first.simTime = simTime;
+    first.step = step;
+    snapshots.Fill(first);
+}
+
+void SimulationThread::EnableCheckpoints(const std::string &path, unsigned long long everySteps)
+{
+    checkpoints.reset(new CheckpointWriter(path));
+    checkpointEvery = everySteps;
+    nextCheckpoint = step + everySteps;
+}
+
+void SimulationThread::EnableDiagnostics(double energyTolerance)
+{
+    conservation.reset(new ConservationMonitor());
+    conservation->energyTolerance = energyTolerance;
+    ConservationMonitor::Prepare(gravity);
+}
+
+void SimulationThread::EnableCollisions()
+{
+    collisions.reset(new CollisionSolver());
+    collisions->pool = gravity.pool;
+}
+
+void SimulationThread::MeasureConservation()
+{
+    conservation->Measure(bodies, gravity, *integrator, simTime);
+    conservation->CheckAlarms();
+}
+
+void SimulationThread::WriteCheckpoint()
+{
+    PROFILE_SCOPE("checkpoint capture");
+    // Only the copy happens here; the writer thread does the I/O
+    captureCheckpoint(checkpointBuffer, bodies, gravity, *integrator, simTime, step, timestep);
+    checkpoints->Submit(checkpointBuffer);
+}
+
+void SimulationThread::SetForceSettings(const ForceSettings &settings)
+{
+    std::lock_guard<std::mutex> guard(requestLock);
+    requestedForces = settings;
+    requestPending = true;
+}
+
+void SimulationThread::SetIntegrator(IntegratorType type)
+{
+    std::lock_guard<std::mutex> guard(requestLock);
+    requestedIntegrator = type;
+    requestPending = true;
+}
+
+void SimulationThread::ApplyRequests()
+{
+    if (!requestPending.exchange(false))
+        return;
+
+    std::lock_guard<std::mutex> guard(requestLock);
+    if (requestedIntegrator != integrator->Type())
+    {
+        integrator = createIntegrator(requestedIntegrator);
+        if (conservation)
+            conservation->Reset(); // different integrators conserve different approximate energies
+    }
+    else if (requestedForces.solver != gravity.settings.solver || requestedForces.theta != gravity.settings.theta ||
+             requestedForces.softening != gravity.settings.softening)
+    {
+        integrator->Reset(); // cached forces came from the old solver
+        if (conservation)
+            conservation->Reset(); // and so did the potential energy
+    }
+    gravity.settings = requestedForces;
+}
+
+void SimulationThread::Publish()
+{
+    PROFILE_SCOPE("publish");
+    SimSnapshot &snapshot = snapshots.WriteSlot();
+    snapshot.bodies = bodies; // the columns keep their capacity, so this rarely allocates
+    snapshot.simTime = simTime;
+    snapshot.step = step;
+    if (conservation)
+    {
+        snapshot.hasConservation = true;
+        snapshot.conservation = conservation->Latest();
+        snapshot.energyDrift = conservation->EnergyDrift();
+    }
+    snapshot.absorbed = collisions ? collisions->absorbed : 0;
+    snapshots.Publish();
+}
+
+void SimulationThread::Advance(double dt)
+{
+    PROFILE_SCOPE("step");
+    integrator->Step(bodies, gravity, dt);
+    simTime += dt;
+    ++step;
+    recenterBodies(bodies, gravity.settings);
+
+    if (collisions)
+    {
+        collisions->softening = gravity.settings.softening; // may have changed with SetForceSettings()
+        if (collisions->Resolve(bodies, dt) > 0)
+        {
+            integrator->Reset(); // cached forces belong to bodies that are gone
+            if (conservation)
+                conservation->Absorb(collisions->Losses());
+        }
+    }
+    // After a merger the tracked potentials no longer match the bodies, and
+    // the monitor computes them itself
+    if (conservation && integrator->ForcesAtStepEnd())
+        MeasureConservation();
+}
+
+void SimulationThread::Run()
+{
+    PROFILE_THREAD("simulation");
+    Clock::time_point nextStep = Clock::now();
+    Clock::time_point lastPublish = nextStep;
+    bool unpublished = false;
+
+    while (running)
+    {
+        ApplyRequests();
+
+        const double rate = stepRate;
+        const double dt = timestep;
+        Clock::time_point now = Clock::now();
+
+        int steps = 0;
+        if (rate <= 0.0)
+        {
+            // Unthrottled: one batch of steps, then publish
+            while (steps < MAX_CATCH_UP_STEPS)
+            {
+                Advance(dt);
+                ++steps;
+                now = Clock::now();
+                if (now - lastPublish >= PUBLISH_INTERVAL)
+                    break;
+            }
+            nextStep = now;
+        }
+        else
+        {
+            const Clock::duration period =
+                std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate));
+            for (; steps < MAX_CATCH_UP_STEPS && now >= nextStep; ++steps)
+            {
+                Advance(dt);
+                nextStep += period;
+                now = Clock::now();
+            }
+            if (now > nextStep + period * MAX_CATCH_UP_STEPS)
+                nextStep = now; // too far behind to catch up
+        }
+        unpublished = unpublished || steps > 0;
+
+        if (checkpoints && checkpointEvery > 0 && step >= nextCheckpoint)
+        {
+            WriteCheckpoint();
+            nextCheckpoint = step + checkpointEvery;
+        }
+
+        if (unpublished && now - lastPublish >= PUBLISH_INTERVAL)
+        {
+            // Integrators without a trailing force pass pay for an extra one here
+            if (conservation && !integrator->ForcesAtStepEnd())
+                MeasureConservation();
+            Publish();
+            lastPublish = now;
+            unpublished = false;
+        }
+
+        if (rate > 0.0)
+        {
+            // Wake for the next step, or for a pending publish if that comes first
+            Clock::time_point wake = nextStep;
+            if (unpublished && lastPublish + PUBLISH_INTERVAL < wake)
+                wake = lastPublish + PUBLISH_INTERVAL;
+            std::this_thread::sleep_until(wake);
+        }
+    }
+}
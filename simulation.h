@@ -0,0 +1,148 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "bodies.h"
+#include "checkpoint.h"
+#include "collisions.h"
+#include "diagnostics.h"
+#include "integrators.h"
+#include "physics.h"
+#include "thread_pool.h"
+
+// Single-producer / single-consumer triple buffer.
+//
+// The producer fills WriteSlot() and calls Publish(); the consumer calls
+// Acquire() and gets the newest complete slot. The two sides only swap slot
+// indices through one atomic word, so neither ever waits for the other and
+// a slot is never written while the consumer can still see it.
+template <typename T>
+class TripleBuffer
+{
+public:
+    // Copy value into every slot; only before producer and consumer start
+    void Fill(const T &value)
+    {
+        for (T &slot : slots)
+            slot = value;
+    }
+
+    // Producer side
+    T &WriteSlot() { return slots[back]; }
+    void Publish() { back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX_MASK; }
+
+    // Consumer side: the returned slot stays untouched until the next Acquire()
+    const T &Acquire()
+    {
+        if (middle.load(std::memory_order_relaxed) & FRESH)
+            front = middle.exchange(front, std::memory_order_acq_rel) & INDEX_MASK;
+        return slots[front];
+    }
+
+private:
+    static const unsigned INDEX_MASK = 3;
+    static const unsigned FRESH = 4; // set while the middle slot holds an unread publish
+
+    T slots[3];
+    unsigned back = 0;  // producer only
+    unsigned front = 1; // consumer only
+    std::atomic<unsigned> middle{2};
+};
+
+// Immutable view of the simulation handed to the renderer
+struct SimSnapshot
+{
+    BodyStore bodies;
+    double simTime = 0.0;        // simulated seconds since start
+    unsigned long long step = 0; // steps taken since start
+
+    // Filled while diagnostics are enabled
+    bool hasConservation = false;
+    Conservation conservation;
+    double energyDrift = 0.0; // relative to the first measurement, or the last merger
+
+    unsigned long long absorbed = 0; // bodies merged away by collisions
+};
+
+// Runs the integrator on its own thread at a fixed number of steps per
+// wall-clock second, independent of the frame rate.
+//
+// The simulation thread owns the bodies, solver and integrator; other
+// threads only see them through Latest(). Settings changes are queued and
+// applied between steps.
+class SimulationThread
+{
+public:
+    SimulationThread(const BodyStore &initial, ThreadPool *pool);
+    ~SimulationThread();
+
+    SimulationThread(const SimulationThread &) = delete;
+    SimulationThread &operator=(const SimulationThread &) = delete;
+
+    void Start();
+    void Stop();
+
+    // Simulated seconds per step
+    void SetTimestep(double seconds) { timestep = seconds; }
+    // Steps per wall-clock second; 0 runs unthrottled
+    void SetStepRate(double stepsPerSecond) { stepRate = stepsPerSecond; }
+    double StepRate() const { return stepRate; }
+
+    void SetForceSettings(const ForceSettings &settings);
+    void SetIntegrator(IntegratorType type);
+
+    // Continue from a checkpoint; call before Start()
+    void Restore(Checkpoint &checkpoint);
+
+    // Checkpoint to path every everySteps steps and once more on Stop(); call before Start()
+    void EnableCheckpoints(const std::string &path, unsigned long long everySteps);
+
+    // Track energy and momenta, warning on stderr when they drift beyond
+    // energyTolerance; call before Start(). Measured after every step when
+    // the integrator's forces come for free, otherwise once per published batch.
+    void EnableDiagnostics(double energyTolerance);
+
+    // Merge bodies that collide; call before Start()
+    void EnableCollisions();
+
+    // Newest published state; call from one consumer thread only
+    const SimSnapshot &Latest() { return snapshots.Acquire(); }
+
+private:
+    void Run();
+    void Advance(double dt);
+    void ApplyRequests();
+    void Publish();
+    void WriteCheckpoint();
+    void MeasureConservation();
+
+    BodyStore bodies;
+    GravitySolver gravity;
+    std::unique_ptr<Integrator> integrator;
+    double simTime = 0.0;
+    unsigned long long step = 0;
+
+    TripleBuffer<SimSnapshot> snapshots;
+
+    std::unique_ptr<CheckpointWriter> checkpoints;
+    Checkpoint checkpointBuffer;
+    unsigned long long checkpointEvery = 0;
+    unsigned long long nextCheckpoint = 0;
+
+    std::unique_ptr<ConservationMonitor> conservation;
+    std::unique_ptr<CollisionSolver> collisions;
+
+    std::atomic<double> timestep;
+    std::atomic<double> stepRate;
+
+    std::mutex requestLock; // guards the requested* fields
+    ForceSettings requestedForces;
+    IntegratorType requestedIntegrator = LEAPFROG_KDK;
+    std::atomic<bool> requestPending;
+
+    std::atomic<bool> running;
+    std::thread thread;
+};
@@ -0,0 +1,180 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+#include "profiler.h"
+
+// Set on pool workers and on a caller while it is inside ParallelFor
+static thread_local bool insidePool = false;
+
+ThreadPool::ThreadPool(unsigned threadCount) : queued(0), stopping(false)
+{
+    Start(threadCount);
+}
+
+ThreadPool::~ThreadPool()
+{
+    Stop();
+}
+
+unsigned ThreadPool::HardwareThreads()
+{
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+void ThreadPool::SetThreadCount(unsigned threadCount)
+{
+    std::lock_guard<std::mutex> guard(submitLock);
+    Stop();
+    Start(threadCount);
+}
+
+void ThreadPool::Start(unsigned threadCount)
+{
+    if (threadCount == 0)
+        threadCount = HardwareThreads();
+
+    stopping = false;
+    queues.clear();
+    for (unsigned i = 0; i < threadCount; ++i)
+        queues.emplace_back(new WorkQueue());
+
+    for (unsigned i = 1; i < threadCount; ++i)
+        workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+void ThreadPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(sleepLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers)
+        worker.join();
+    workers.clear();
+}
+
+void ThreadPool::WorkerLoop(unsigned index)
+{
+    insidePool = true;
+    PROFILE_THREAD("pool worker");
+    for (;;)
+    {
+        Task task;
+        if (PopOrSteal(index, task))
+        {
+            Run(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(sleepLock);
+        wake.wait(guard, [this]
+                  { return stopping || queued > 0; });
+        if (stopping)
+            return;
+    }
+}
+
+bool ThreadPool::PopOrSteal(unsigned index, Task &task)
+{
+    if (queued == 0)
+        return false;
+
+    // Own queue first, newest chunk (LIFO)
+    {
+        WorkQueue &own = *queues[index];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty())
+        {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            --queued;
+            return true;
+        }
+    }
+
+    // Then steal the oldest chunk from the others, starting with our neighbour
+    size_t count = queues.size();
+    for (size_t k = 1; k < count; ++k)
+    {
+        WorkQueue &victim = *queues[(index + k) % count];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty())
+        {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            --queued;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::Run(const Task &task)
+{
+    PROFILE_SCOPE("pool task");
+    (*task.job->body)(task.begin, task.end);
+    task.job->pending.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void ThreadPool::ParallelFor(size_t count, size_t grain, const RangeFn &body)
+{
+    if (count == 0)
+        return;
+    grain = std::max<size_t>(grain, 1);
+
+    size_t chunks = (count + grain - 1) / grain;
+    if (insidePool || queues.size() == 1 || chunks == 1)
+    {
+        body(0, count);
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(submitLock);
+    insidePool = true;
+
+    Job job;
+    job.body = &body;
+    job.pending = chunks;
+
+    // Deal chunks out as contiguous runs so each thread starts on its own slice
+    size_t threads = queues.size();
+    for (size_t t = 0; t < threads; ++t)
+    {
+        size_t firstChunk = chunks * t / threads;
+        size_t lastChunk = chunks * (t + 1) / threads;
+        if (firstChunk == lastChunk)
+            continue;
+
+        WorkQueue &queue = *queues[t];
+        std::lock_guard<std::mutex> queueGuard(queue.lock);
+        for (size_t c = firstChunk; c < lastChunk; ++c)
+        {
+            Task task;
+            task.job = &job;
+            task.begin = c * grain;
+            task.end = std::min(count, task.begin + grain);
+            queue.tasks.push_back(task);
+        }
+        queued += lastChunk - firstChunk;
+    }
+
+    {
+        std::lock_guard<std::mutex> sleepGuard(sleepLock);
+    }
+    wake.notify_all();
+
+    // The caller works through queue 0 and steals like any other thread
+    Task task;
+    while (job.pending.load(std::memory_order_acquire) > 0)
+    {
+        if (PopOrSteal(0, task))
+            Run(task);
+        else
+            std::this_thread::yield();
+    }
+
+    insidePool = false;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size work-stealing thread pool.
+//
+// ParallelFor splits a range into chunks and deals them out as contiguous
+// runs onto one deque per thread. Each thread pops from the back of its own
+// deque (keeping neighbouring chunks on the same core) and, when it runs
+// dry, steals from the front of another thread's deque. The calling thread
+// takes part as thread 0, so a pool of N threads starts N - 1 workers.
+class ThreadPool
+{
+public:
+    typedef std::function<void(size_t begin, size_t end)> RangeFn;
+
+    // threadCount == 0 uses every hardware thread
+    explicit ThreadPool(unsigned threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Total threads taking part in ParallelFor, including the caller
+    unsigned ThreadCount() const { return (unsigned)queues.size(); }
+
+    // Stop the workers and restart with a new thread count
+    void SetThreadCount(unsigned threadCount);
+
+    // Run body over [0, count) in chunks of about grain items and wait for
+    // all of them. Calls made from inside a pool task run inline.
+    void ParallelFor(size_t count, size_t grain, const RangeFn &body);
+
+    static unsigned HardwareThreads();
+
+private:
+    struct Job
+    {
+        const RangeFn *body;
+        std::atomic<size_t> pending;
+    };
+
+    struct Task
+    {
+        Job *job;
+        size_t begin, end;
+    };
+
+    struct WorkQueue
+    {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    void Start(unsigned threadCount);
+    void Stop();
+    void WorkerLoop(unsigned index);
+    bool PopOrSteal(unsigned index, Task &task);
+    void Run(const Task &task);
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex sleepLock;
+    std::condition_variable wake;
+    std::atomic<size_t> queued;
+    std::atomic<bool> stopping;
+    std::mutex submitLock; // one ParallelFor at a time
+};
@@ -0,0 +1,473 @@
+#include "trajectory.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char TRAJECTORY_MAGIC[8] = {'G', 'R', 'A', 'V', 'T', 'R', 'J', '\0'};
+static const uint32_t TRAJECTORY_VERSION = 1;
+static const uint32_t CHUNK_MAGIC = 0x4B4E4843; // "CHNK"
+
+struct TrajectoryHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t framesPerChunk;
+    uint64_t bodyCount;
+    double positionQuantum;
+    double velocityQuantum;
+    double frameInterval; // simulated seconds between recorded frames
+    uint64_t indexOffset; // 0 until the writer is closed
+    uint64_t chunkCount;
+};
+static_assert(sizeof(TrajectoryHeader) == 64, "trajectory header must stay 64 bytes");
+
+struct ChunkHeader
+{
+    uint32_t magic;
+    uint32_t frames;
+    uint64_t payloadBytes; // frame times, then the varint stream
+    double firstTime;
+    double lastTime;
+};
+static_assert(sizeof(ChunkHeader) == 32, "chunk header must stay 32 bytes");
+
+// Body table is padded so chunks start 8-byte aligned
+static size_t bodyTableBytes(size_t bodyCount)
+{
+    return (bodyCount * sizeof(uint32_t) + 7) & ~(size_t)7;
+}
+
+static void putVarint(std::vector<unsigned char> &out, int64_t value)
+{
+    uint64_t zigzag = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+    while (zigzag >= 0x80)
+    {
+        out.push_back((unsigned char)(zigzag | 0x80));
+        zigzag >>= 7;
+    }
+    out.push_back((unsigned char)zigzag);
+}
+
+static bool getVarint(const unsigned char *&p, const unsigned char *end, int64_t &value)
+{
+    uint64_t zigzag = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (p == end)
+            return false;
+        unsigned char byte = *p++;
+        zigzag |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            value = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Linear prediction from the two previous frames of the chunk
+static inline int64_t predict(const int64_t *values, size_t f, size_t stride, size_t k)
+{
+    if (f == 0)
+        return 0;
+    int64_t previous = values[(f - 1) * stride + k];
+    if (f == 1)
+        return previous;
+    return 2 * previous - values[(f - 2) * stride + k];
+}
+
+TrajectoryWriter::TrajectoryWriter(const std::string &path, const BodyStore &bodies, double timestep,
+                                   const TrajectorySettings &trajectorySettings)
+    : settings(trajectorySettings), queue(std::max(1u, trajectorySettings.queueDepth)), closing(false), dropped(0),
+      framesWritten(0)
+{
+    settings.every = std::max(1u, settings.every);
+    settings.stride = std::max(1u, settings.stride);
+    settings.framesPerChunk = std::max(1u, settings.framesPerChunk);
+
+    for (size_t i = 0; i < bodies.Size(); i += settings.stride)
+        selected.push_back((uint32_t)i);
+
+    // One velocity quantum moves a body one position quantum between frames
+    double frameInterval = timestep * settings.every;
+    double velocityQuantum = frameInterval > 0.0 ? settings.positionQuantum / frameInterval : settings.positionQuantum;
+    for (int c = 0; c < 3; ++c)
+    {
+        quanta[c] = settings.positionQuantum;
+        quanta[3 + c] = velocityQuantum;
+    }
+
+    file = fopen(path.c_str(), "w+b"); // read back when the header is patched
+    if (!file)
+    {
+        fprintf(stderr, "Failed to write trajectory %s\n", path.c_str());
+        return;
+    }
+
+    TrajectoryHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC));
+    header.version = TRAJECTORY_VERSION;
+    header.framesPerChunk = settings.framesPerChunk;
+    header.bodyCount = selected.size();
+    header.positionQuantum = quanta[0];
+    header.velocityQuantum = quanta[3];
+    header.frameInterval = frameInterval;
+    fwrite(&header, sizeof(header), 1, file);
+
+    std::vector<unsigned char> table(bodyTableBytes(selected.size()), 0);
+    if (!selected.empty())
+        std::memcpy(table.data(), selected.data(), selected.size() * sizeof(uint32_t));
+    fwrite(table.data(), 1, table.size(), file);
+
+    thread = std::thread(&TrajectoryWriter::Run, this);
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+    Close();
+}
+
+bool TrajectoryWriter::Record(const BodyStore &bodies, double simTime, uint64_t step)
+{
+    if (!file || step % settings.every != 0)
+        return true;
+
+    Frame *frame = queue.WriteSlot();
+    if (!frame)
+    {
+        if (settings.dropWhenFull)
+        {
+            ++dropped;
+            return false;
+        }
+        PROFILE_SCOPE("trajectory wait");
+        std::unique_lock<std::mutex> guard(sleepLock);
+        slotFree.wait(guard, [this, &frame]
+                      { return (frame = queue.WriteSlot()) != nullptr; });
+    }
+
+    const size_t n = selected.size();
+    const float *columns[6] = {bodies.x.data(), bodies.y.data(), bodies.z.data(),
+                               bodies.vx.data(), bodies.vy.data(), bodies.vz.data()};
+    frame->time = simTime;
+    frame->values.resize(6 * n);
+    for (int c = 0; c < 6; ++c)
+    {
+        float *out = &frame->values[c * n];
+        for (size_t k = 0; k < n; ++k)
+        {
+            // Bodies removed since the writer opened are recorded at the origin;
+            // positions are absolute so a moving BodyStore::origin does not show
+            uint32_t i = selected[k];
+            if (i >= bodies.Size())
+                out[k] = 0.0f;
+            else
+                out[k] = c < 3 ? (float)(bodies.origin[c] + columns[c][i]) : columns[c][i];
+        }
+    }
+    queue.Push();
+    {
+        // Taking the lock orders the push before the writer's next check
+        std::lock_guard<std::mutex> guard(sleepLock);
+    }
+    frameReady.notify_one();
+    return true;
+}
+
+void TrajectoryWriter::Remap(const std::vector<uint32_t> &remap)
+{
+    // An absorbed body follows the body that swallowed it
+    for (uint32_t &i : selected)
+    {
+        if (i < remap.size())
+            i = remap[i];
+    }
+}
+
+void TrajectoryWriter::Run()
+{
+    PROFILE_THREAD("trajectory writer");
+    for (;;)
+    {
+        Frame *frame = queue.ReadSlot();
+        if (frame)
+        {
+            AddFrame(*frame);
+            queue.Pop();
+            {
+                std::lock_guard<std::mutex> guard(sleepLock);
+            }
+            slotFree.notify_one();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(sleepLock);
+        frameReady.wait(guard, [this]
+                        { return queue.ReadSlot() != nullptr || closing.load(std::memory_order_acquire); });
+        // The producer has stopped once closing is set; anything it pushed is visible now
+        if (!queue.ReadSlot())
+            return;
+    }
+}
+
+void TrajectoryWriter::AddFrame(const Frame &frame)
+{
+    const size_t stride = frame.values.size();
+    chunkTimes.push_back(frame.time);
+    size_t base = chunkValues.size();
+    chunkValues.resize(base + stride);
+    const size_t n = stride / 6;
+    for (size_t k = 0; k < stride; ++k)
+        chunkValues[base + k] = llround(frame.values[k] / quanta[k / std::max<size_t>(n, 1)]);
+
+    ++framesWritten;
+    if (chunkTimes.size() >= settings.framesPerChunk)
+        FlushChunk();
+}
+
+void TrajectoryWriter::FlushChunk()
+{
+    const size_t frames = chunkTimes.size();
+    if (frames == 0)
+        return;
+    PROFILE_SCOPE("trajectory chunk");
+
+    const size_t stride = chunkValues.size() / frames;
+    encoded.clear();
+    for (size_t f = 0; f < frames; ++f)
+    {
+        for (size_t k = 0; k < stride; ++k)
+            putVarint(encoded, chunkValues[f * stride + k] - predict(chunkValues.data(), f, stride, k));
+    }
+
+    ChunkHeader header;
+    header.magic = CHUNK_MAGIC;
+    header.frames = (uint32_t)frames;
+    header.payloadBytes = frames * sizeof(double) + encoded.size();
+    header.firstTime = chunkTimes.front();
+    header.lastTime = chunkTimes.back();
+
+    ChunkEntry entry;
+    entry.offset = (uint64_t)ftello(file);
+    entry.firstTime = header.firstTime;
+    entry.lastTime = header.lastTime;
+    entry.frames = header.frames;
+    entry.reserved = 0;
+    index.push_back(entry);
+
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(chunkTimes.data(), sizeof(double), frames, file);
+    fwrite(encoded.data(), 1, encoded.size(), file);
+
+    chunkTimes.clear();
+    chunkValues.clear();
+}
+
+void TrajectoryWriter::Close()
+{
+    if (!file)
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard(sleepLock);
+        closing.store(true, std::memory_order_release);
+    }
+    frameReady.notify_one();
+    thread.join();
+    FlushChunk();
+
+    uint64_t indexOffset = (uint64_t)ftello(file);
+    if (!index.empty())
+        fwrite(index.data(), sizeof(ChunkEntry), index.size(), file);
+
+    // Patch the header so readers can find the index
+    TrajectoryHeader header;
+    fseeko(file, 0, SEEK_SET);
+    if (fread(&header, sizeof(header), 1, file) != 1)
+        std::memset(&header, 0, sizeof(header));
+    header.indexOffset = indexOffset;
+    header.chunkCount = index.size();
+    fseeko(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+
+    if (fclose(file) != 0)
+        fprintf(stderr, "Failed to write trajectory\n");
+    file = nullptr;
+}
+
+bool TrajectoryReader::Open(const char *path)
+{
+    Close();
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to open trajectory %s\n", path);
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(TrajectoryHeader))
+    {
+        fprintf(stderr, "%s: not a trajectory\n", path);
+        close(fd);
+        return false;
+    }
+
+    size = (size_t)info.st_size;
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "Failed to map trajectory %s\n", path);
+        size = 0;
+        return false;
+    }
+    data = static_cast<const unsigned char *>(mapping);
+
+    TrajectoryHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC)) != 0 ||
+        header.version != TRAJECTORY_VERSION)
+    {
+        fprintf(stderr, "%s: not a trajectory or unsupported version\n", path);
+        Close();
+        return false;
+    }
+
+    size_t tableEnd = sizeof(header) + bodyTableBytes((size_t)header.bodyCount);
+    if (header.bodyCount > size / sizeof(uint32_t) || tableEnd > size)
+    {
+        fprintf(stderr, "%s: truncated trajectory\n", path);
+        Close();
+        return false;
+    }
+    bodies.resize((size_t)header.bodyCount);
+    if (!bodies.empty())
+        std::memcpy(bodies.data(), data + sizeof(header), bodies.size() * sizeof(uint32_t));
+    for (int c = 0; c < 3; ++c)
+    {
+        quanta[c] = header.positionQuantum;
+        quanta[3 + c] = header.velocityQuantum;
+    }
+
+    const size_t entryBytes = 32; // offset, firstTime, lastTime, frames, reserved
+    if (header.indexOffset != 0 && header.indexOffset <= size &&
+        header.chunkCount <= (size - header.indexOffset) / entryBytes)
+    {
+        for (uint64_t c = 0; c < header.chunkCount; ++c)
+        {
+            const unsigned char *entry = data + header.indexOffset + c * entryBytes;
+            Chunk chunk;
+            std::memcpy(&chunk.offset, entry, 8);
+            std::memcpy(&chunk.firstTime, entry + 8, 8);
+            std::memcpy(&chunk.lastTime, entry + 16, 8);
+            std::memcpy(&chunk.frames, entry + 24, 4);
+            chunks.push_back(chunk);
+        }
+    }
+    else
+    {
+        // Writer never finished: walk the chunk headers instead
+        size_t offset = tableEnd;
+        while (offset + sizeof(ChunkHeader) <= size)
+        {
+            ChunkHeader chunkHeader;
+            std::memcpy(&chunkHeader, data + offset, sizeof(chunkHeader));
+            if (chunkHeader.magic != CHUNK_MAGIC || chunkHeader.payloadBytes > size - offset - sizeof(chunkHeader))
+                break;
+            Chunk chunk = {offset, chunkHeader.firstTime, chunkHeader.lastTime, chunkHeader.frames};
+            chunks.push_back(chunk);
+            offset += sizeof(chunkHeader) + (size_t)chunkHeader.payloadBytes;
+        }
+    }
+
+    frameCount = 0;
+    for (const Chunk &chunk : chunks)
+        frameCount += chunk.frames;
+    return true;
+}
+
+void TrajectoryReader::Close()
+{
+    if (data)
+        munmap(const_cast<unsigned char *>(data), size);
+    data = nullptr;
+    size = 0;
+    bodies.clear();
+    chunks.clear();
+    frameCount = 0;
+}
+
+double TrajectoryReader::StartTime() const
+{
+    return chunks.empty() ? 0.0 : chunks.front().firstTime;
+}
+
+double TrajectoryReader::EndTime() const
+{
+    return chunks.empty() ? 0.0 : chunks.back().lastTime;
+}
+
+size_t TrajectoryReader::FindChunk(double t) const
+{
+    // First chunk that ends at or after t
+    size_t lo = 0, hi = chunks.size();
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (chunks[mid].lastTime < t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return std::min(lo, chunks.empty() ? 0 : chunks.size() - 1);
+}
+
+bool TrajectoryReader::ReadChunk(size_t chunk, std::vector<double> &times, std::vector<float> &values) const
+{
+    if (chunk >= chunks.size())
+        return false;
+
+    ChunkHeader header;
+    const size_t offset = (size_t)chunks[chunk].offset;
+    if (offset + sizeof(header) > size)
+        return false;
+    std::memcpy(&header, data + offset, sizeof(header));
+    if (header.magic != CHUNK_MAGIC || header.payloadBytes > size - offset - sizeof(header) ||
+        header.frames > header.payloadBytes / sizeof(double))
+        return false;
+
+    const size_t frames = header.frames;
+    const size_t stride = 6 * bodies.size();
+    const unsigned char *p = data + offset + sizeof(header);
+    const unsigned char *end = p + header.payloadBytes;
+
+    times.resize(frames);
+    std::memcpy(times.data(), p, frames * sizeof(double));
+    p += frames * sizeof(double);
+
+    std::vector<int64_t> quantized(frames * stride);
+    values.resize(frames * stride);
+    for (size_t f = 0; f < frames; ++f)
+    {
+        for (size_t k = 0; k < stride; ++k)
+        {
+            int64_t residual;
+            if (!getVarint(p, end, residual))
+                return false;
+            int64_t q = residual + predict(quantized.data(), f, stride, k);
+            quantized[f * stride + k] = q;
+            values[f * stride + k] = (float)(q * quanta[k / bodies.size()]);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bodies.h"
+
+// Trajectory files: a 64-byte header (magic "GRAVTRJ\0", version, body
+// count, quanta, index location), the recorded body indices, then chunks of
+// up to framesPerChunk frames and finally a chunk index for random access
+// by time.
+//
+// Each frame holds x, y, z, vx, vy, vz of every recorded body. Values are
+// quantized (positions to positionQuantum pixels, velocities so that one
+// quantum moves a body one positionQuantum over a frame interval) and each
+// one is stored as its difference from a linear prediction from the two
+// previous frames of the chunk, zig-zag varint coded. Smooth orbits
+// therefore cost a byte or two per value. Chunks decode independently.
+
+struct TrajectorySettings
+{
+    unsigned every = 10;           // record every K-th step
+    unsigned stride = 1;           // record every stride-th body
+    float positionQuantum = 1e-3f; // pixels
+    unsigned framesPerChunk = 64;
+    unsigned queueDepth = 8; // frames buffered between the step loop and the writer thread
+    bool dropWhenFull = true; // false: Record() waits for the writer instead of losing frames
+};
+
+// Bounded single-producer / single-consumer ring of preallocated slots.
+// Neither side locks: WriteSlot() returns nullptr when the ring is full and
+// ReadSlot() when it is empty.
+template <typename T>
+class SpscRing
+{
+public:
+    explicit SpscRing(size_t capacity) : slots(capacity), head(0), tail(0) {}
+
+    // Producer: slot to fill, or nullptr when full; Push() publishes it
+    T *WriteSlot()
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == slots.size())
+            return nullptr;
+        return &slots[h % slots.size()];
+    }
+    void Push() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    // Consumer: oldest filled slot, or nullptr when empty; Pop() frees it
+    T *ReadSlot()
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire))
+            return nullptr;
+        return &slots[t % slots.size()];
+    }
+    void Pop() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+private:
+    std::vector<T> slots;
+    std::atomic<size_t> head; // next slot the producer fills
+    std::atomic<size_t> tail; // next slot the consumer reads
+};
+
+// Streams trajectories to disk from a background thread. Record() is meant
+// for the step loop: it copies the recorded bodies into a free queue slot
+// and returns. If the writer has fallen behind, the frame is dropped and
+// counted rather than stalling the physics, unless settings.dropWhenFull is
+// off, in which case Record() waits for a slot and every frame is kept.
+class TrajectoryWriter
+{
+public:
+    TrajectoryWriter(const std::string &path, const BodyStore &bodies, double timestep,
+                     const TrajectorySettings &settings = TrajectorySettings());
+    ~TrajectoryWriter();
+
+    TrajectoryWriter(const TrajectoryWriter &) = delete;
+    TrajectoryWriter &operator=(const TrajectoryWriter &) = delete;
+
+    bool IsOpen() const { return file != nullptr; }
+
+    // Queue a frame if step is a multiple of settings.every; false if it was dropped
+    bool Record(const BodyStore &bodies, double simTime, uint64_t step);
+
+    // Follow bodies to their new indices after the store was compacted;
+    // remap[old] is the new index (see CollisionSolver::Remap)
+    void Remap(const std::vector<uint32_t> &remap);
+
+    // Drain the queue, write the index and close the file
+    void Close();
+
+    unsigned long long Dropped() const { return dropped; }
+    unsigned long long FramesWritten() const { return framesWritten; }
+
+private:
+    struct Frame
+    {
+        double time;
+        std::vector<float> values; // x, y, z, vx, vy, vz columns of the recorded bodies
+    };
+
+    struct ChunkEntry
+    {
+        uint64_t offset;
+        double firstTime;
+        double lastTime;
+        uint32_t frames;
+        uint32_t reserved;
+    };
+
+    void Run();
+    void AddFrame(const Frame &frame);
+    void FlushChunk();
+
+    TrajectorySettings settings;
+    FILE *file = nullptr;
+    std::vector<uint32_t> selected;
+    double quanta[6];
+
+    SpscRing<Frame> queue;
+    std::atomic<bool> closing;
+    std::atomic<unsigned long long> dropped;
+    std::atomic<unsigned long long> framesWritten;
+    std::thread thread;
+
+    // Sleeping only: frames pass through the ring without the lock
+    std::mutex sleepLock;
+    std::condition_variable frameReady; // signalled on Push() and Close()
+    std::condition_variable slotFree;   // signalled on Pop()
+
+    // Writer thread only
+    std::vector<double> chunkTimes;
+    std::vector<int64_t> chunkValues; // quantized, frame after frame
+    std::vector<unsigned char> encoded;
+    std::vector<ChunkEntry> index;
+};
+
+// Random access to a trajectory file through a read-only mapping. Files
+// whose writer never closed them (no index) are indexed by scanning chunks.
+class TrajectoryReader
+{
+public:
+    ~TrajectoryReader() { Close(); }
+
+    bool Open(const char *path);
+    void Close();
+
+    size_t BodyCount() const { return bodies.size(); }
+    const std::vector<uint32_t> &Bodies() const { return bodies; } // indices into the original BodyStore
+    size_t ChunkCount() const { return chunks.size(); }
+    size_t FrameCount() const { return frameCount; }
+    double StartTime() const;
+    double EndTime() const;
+
+    // Chunk holding time t (clamped to the recorded range)
+    size_t FindChunk(double t) const;
+    double ChunkStartTime(size_t chunk) const { return chunks[chunk].firstTime; }
+    double ChunkEndTime(size_t chunk) const { return chunks[chunk].lastTime; }
+
+    // Decode one chunk: times[f] and, per frame, 6 * BodyCount() values laid
+    // out as x, y, z, vx, vy, vz columns
+    bool ReadChunk(size_t chunk, std::vector<double> &times, std::vector<float> &values) const;
+
+private:
+    struct Chunk
+    {
+        uint64_t offset;
+        double firstTime;
+        double lastTime;
+        uint32_t frames;
+    };
+
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+    std::vector<uint32_t> bodies;
+    std::vector<Chunk> chunks;
+    size_t frameCount = 0;
+    double quanta[6];
+};
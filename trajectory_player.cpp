@@ -0,0 +1,163 @@
+#include "trajectory_player.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+
+// Recorded frames shown per wall-clock second at the default speed
+static const double DEFAULT_FRAMES_PER_SECOND = 30.0;
+
+bool TrajectoryPlayer::Open(const char *path, const BodyStore &appearance)
+{
+    if (!reader.Open(path))
+        return false;
+    if (reader.FrameCount() == 0 || reader.BodyCount() == 0)
+    {
+        fprintf(stderr, "%s: trajectory has no frames\n", path);
+        return false;
+    }
+
+    const std::vector<uint32_t> &indices = reader.Bodies();
+    bodies.Resize(indices.size());
+    for (size_t k = 0; k < indices.size(); ++k)
+    {
+        size_t i = indices[k];
+        if (i < appearance.Size())
+        {
+            bodies.mass[k] = appearance.mass[i];
+            bodies.density[k] = appearance.density[i];
+            bodies.hue[k] = appearance.hue[i];
+            bodies.type[k] = appearance.type[i];
+        }
+        else
+        {
+            // Not in the scenario: draw a small grey planet
+            bodies.mass[k] = 1e20;
+            bodies.density[k] = 1400.0;
+            bodies.hue[k] = {{0.7f, 0.7f, 0.7f, 1.0f}};
+            bodies.type[k] = PLANET;
+        }
+    }
+
+    cache[0].index = cache[1].index = (size_t)-1;
+    time = reader.StartTime();
+    double frameInterval =
+        reader.FrameCount() > 1 ? (reader.EndTime() - reader.StartTime()) / (reader.FrameCount() - 1) : 0.0;
+    speed = frameInterval * DEFAULT_FRAMES_PER_SECOND;
+    paused = false;
+    sampled = false;
+    return true;
+}
+
+void TrajectoryPlayer::Seek(double t)
+{
+    time = std::min(std::max(t, reader.StartTime()), reader.EndTime());
+}
+
+void TrajectoryPlayer::Advance(double wallSeconds)
+{
+    if (paused)
+        return;
+    Seek(time + speed * wallSeconds);
+    if ((speed > 0.0 && time >= reader.EndTime()) || (speed < 0.0 && time <= reader.StartTime()))
+        paused = true;
+}
+
+const TrajectoryPlayer::DecodedChunk *TrajectoryPlayer::Load(size_t chunk)
+{
+    for (int s = 0; s < 2; ++s)
+    {
+        if (cache[s].index == chunk)
+        {
+            lastUsed = s;
+            return &cache[s];
+        }
+    }
+
+    // Evict the slot not used last, so a frame pair spanning two chunks stays resident
+    int slot = 1 - lastUsed;
+    DecodedChunk &decoded = cache[slot];
+    decoded.index = (size_t)-1;
+    if (!reader.ReadChunk(chunk, decoded.times, decoded.values) || decoded.times.empty())
+    {
+        fprintf(stderr, "Corrupt trajectory chunk %zu\n", chunk);
+        return nullptr;
+    }
+    decoded.index = chunk;
+    lastUsed = slot;
+    return &decoded;
+}
+
+const BodyStore &TrajectoryPlayer::Bodies(ThreadPool *pool)
+{
+    if (!sampled || time != sampledTime)
+        Sample(time, pool);
+    return bodies;
+}
+
+void TrajectoryPlayer::Sample(double t, ThreadPool *pool)
+{
+    PROFILE_SCOPE("replay interpolate");
+    sampled = true;
+    sampledTime = t;
+
+    // Bracketing frames: (c0, f0) at or before t, (c1, f1) after it
+    size_t c1 = reader.FindChunk(t);
+    const DecodedChunk *next = Load(c1);
+    if (!next)
+        return;
+    const DecodedChunk *prev = next;
+    size_t f1 = std::upper_bound(next->times.begin(), next->times.end(), t) - next->times.begin();
+    size_t f0 = f1 - 1;
+    if (f1 == 0)
+    {
+        if (c1 == 0)
+            f0 = f1 = 0;
+        else
+        {
+            prev = Load(c1 - 1);
+            if (!prev)
+                return;
+            f0 = prev->times.size() - 1;
+            next = Load(c1); // still resident: the eviction skips the last used slot
+        }
+    }
+    else if (f1 == next->times.size())
+        f1 = f0; // at the end of the recording
+
+    const size_t n = bodies.Size();
+    const size_t stride = 6 * n;
+    const float *p0 = &prev->values[f0 * stride];
+    const float *p1 = &next->values[f1 * stride];
+    const double t0 = prev->times[f0];
+    const double h = next->times[f1] - t0;
+    const double s = h > 0.0 ? (t - t0) / h : 0.0;
+
+    // Hermite basis for positions and its derivative for velocities
+    const double s2 = s * s, s3 = s2 * s;
+    const float h00 = (float)(2 * s3 - 3 * s2 + 1), h10 = (float)((s3 - 2 * s2 + s) * h);
+    const float h01 = (float)(-2 * s3 + 3 * s2), h11 = (float)((s3 - s2) * h);
+    const float d00 = h > 0.0 ? (float)((6 * s2 - 6 * s) / h) : 0.0f, d10 = (float)(3 * s2 - 4 * s + 1);
+    const float d01 = -d00, d11 = (float)(3 * s2 - 2 * s);
+
+    float *position[3] = {bodies.x.data(), bodies.y.data(), bodies.z.data()};
+    float *velocity[3] = {bodies.vx.data(), bodies.vy.data(), bodies.vz.data()};
+    auto interpolate = [&](size_t begin, size_t end)
+    {
+        for (int a = 0; a < 3; ++a)
+        {
+            const float *x0 = p0 + a * n, *v0 = p0 + (3 + a) * n;
+            const float *x1 = p1 + a * n, *v1 = p1 + (3 + a) * n;
+            for (size_t k = begin; k < end; ++k)
+            {
+                position[a][k] = h00 * x0[k] + h10 * v0[k] + h01 * x1[k] + h11 * v1[k];
+                velocity[a][k] = d00 * x0[k] + d10 * v0[k] + d01 * x1[k] + d11 * v1[k];
+            }
+        }
+    };
+
+    if (pool)
+        pool->ParallelFor(n, 4096, interpolate);
+    else
+        interpolate(0, n);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "bodies.h"
+#include "thread_pool.h"
+#include "trajectory.h"
+
+// Plays a recorded trajectory back instead of simulating it.
+//
+// Positions between stored frames come from cubic Hermite interpolation
+// of the bracketing frames' positions and velocities, so playback stays
+// smooth even when only every K-th step was recorded. Only the two chunks
+// around the current time are decoded at once.
+class TrajectoryPlayer
+{
+public:
+    // Map the trajectory; mass, type and colour of each recorded body are
+    // taken from appearance (the scenario the run started from) when it has them
+    bool Open(const char *path, const BodyStore &appearance);
+
+    double Time() const { return time; }
+    double StartTime() const { return reader.StartTime(); }
+    double EndTime() const { return reader.EndTime(); }
+    size_t FrameCount() const { return reader.FrameCount(); }
+
+    // Playback speed in simulated seconds per wall-clock second
+    double Speed() const { return speed; }
+    void SetSpeed(double simSecondsPerSecond) { speed = simSecondsPerSecond; }
+
+    bool Paused() const { return paused; }
+    void SetPaused(bool pause) { paused = pause; }
+
+    // Jump to t, clamped to the recorded range
+    void Seek(double t);
+
+    // Move the playhead by wallSeconds of playback; pauses at the end
+    void Advance(double wallSeconds);
+
+    // Bodies at Time(); interpolation is spread over the pool when one is given
+    const BodyStore &Bodies(ThreadPool *pool = nullptr);
+
+private:
+    struct DecodedChunk
+    {
+        size_t index = (size_t)-1;
+        std::vector<double> times;
+        std::vector<float> values; // per frame: x, y, z, vx, vy, vz columns
+    };
+
+    const DecodedChunk *Load(size_t chunk);
+    void Sample(double t, ThreadPool *pool);
+
+    TrajectoryReader reader;
+    BodyStore bodies;
+    DecodedChunk cache[2];
+    int lastUsed = 0;
+
+    double time = 0.0;
+    double speed = 0.0;
+    bool paused = false;
+    double sampledTime = 0.0;
+    bool sampled = false;
+};
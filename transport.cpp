@@ -0,0 +1,284 @@
+#include "transport.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+bool allGather(Transport &transport, const void *data, size_t bytes, std::vector<std::vector<char>> &all)
+{
+    const int size = transport.Size();
+    const int rank = transport.Rank();
+    all.resize(size);
+    all[rank].assign((const char *)data, (const char *)data + bytes);
+
+    // Round k: everyone sends to the rank k ahead and hears from the one k behind
+    for (int k = 1; k < size; ++k)
+    {
+        if (!transport.Exchange((rank + k) % size, data, bytes, (rank - k + size) % size, all[(rank - k + size) % size]))
+            return false;
+    }
+    return true;
+}
+
+bool allToAll(Transport &transport, const std::vector<std::vector<char>> &outgoing,
+              std::vector<std::vector<char>> &incoming)
+{
+    const int size = transport.Size();
+    const int rank = transport.Rank();
+    incoming.resize(size);
+    incoming[rank] = outgoing[rank];
+    for (int k = 1; k < size; ++k)
+    {
+        const int to = (rank + k) % size;
+        const int from = (rank - k + size) % size;
+        if (!transport.Exchange(to, outgoing[to].data(), outgoing[to].size(), from, incoming[from]))
+            return false;
+    }
+    return true;
+}
+
+bool allReduce(Transport &transport, double *values, size_t count, ReduceOp op)
+{
+    std::vector<std::vector<char>> all;
+    if (!allGather(transport, values, count * sizeof(double), all))
+        return false;
+    for (size_t r = 0; r < all.size(); ++r)
+    {
+        if (all[r].size() != count * sizeof(double))
+        {
+            fprintf(stderr, "Rank %zu reduced %zu values, expected %zu\n", r, all[r].size() / sizeof(double), count);
+            return false;
+        }
+    }
+
+    for (size_t k = 0; k < count; ++k)
+    {
+        double result;
+        std::memcpy(&result, all[0].data() + k * sizeof(double), sizeof(double));
+        for (size_t r = 1; r < all.size(); ++r)
+        {
+            double v;
+            std::memcpy(&v, all[r].data() + k * sizeof(double), sizeof(double));
+            result = op == REDUCE_SUM ? result + v : op == REDUCE_MIN ? std::min(result, v) : std::max(result, v);
+        }
+        values[k] = result;
+    }
+    return true;
+}
+
+SocketTransport::~SocketTransport()
+{
+    for (int fd : peers)
+        if (fd >= 0)
+            close(fd);
+}
+
+bool SocketTransport::Launch(int count)
+{
+    if (count < 1)
+        return false;
+
+    // ends[i][j] is rank i's end of the socket it shares with rank j
+    std::vector<std::vector<int>> ends(count, std::vector<int>(count, -1));
+    auto closeAll = [&]()
+    {
+        for (std::vector<int> &row : ends)
+            for (int fd : row)
+                if (fd >= 0)
+                    close(fd);
+    };
+    for (int i = 0; i < count; ++i)
+    {
+        for (int j = i + 1; j < count; ++j)
+        {
+            int pair[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+            {
+                fprintf(stderr, "Could not create sockets between ranks: %s\n", strerror(errno));
+                closeAll();
+                return false;
+            }
+            ends[i][j] = pair[0];
+            ends[j][i] = pair[1];
+        }
+    }
+
+    // A rank that dies must show up as a failed read, not kill its peers
+    signal(SIGPIPE, SIG_IGN);
+    fflush(stdout);
+    fflush(stderr);
+
+    rank = 0;
+    for (int r = 1; r < count; ++r)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            // Ranks already started see their sockets close and exit
+            fprintf(stderr, "Could not start rank %d: %s\n", r, strerror(errno));
+            closeAll();
+            Join();
+            return false;
+        }
+        if (pid == 0)
+        {
+            rank = r;
+            children.clear();
+            break;
+        }
+        children.push_back(pid);
+    }
+
+    for (int i = 0; i < count; ++i)
+        for (int j = 0; j < count; ++j)
+            if (i != rank && ends[i][j] >= 0)
+                close(ends[i][j]);
+    peers = ends[rank];
+    for (int fd : peers)
+        if (fd >= 0)
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return true;
+}
+
+bool SocketTransport::Join()
+{
+    // Ranks still waiting on this one see the sockets close and give up
+    for (int &fd : peers)
+    {
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+    }
+
+    bool ok = true;
+    for (pid_t pid : children)
+    {
+        int status = 0;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        {
+        }
+        ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    children.clear();
+    return ok;
+}
+
+bool SocketTransport::Exchange(int to, const void *data, size_t bytes, int from, std::vector<char> &received)
+{
+    // Every message is its length (8 bytes) followed by the payload
+    const uint64_t outLength = bytes;
+    const size_t outTotal = sizeof(outLength) + bytes;
+    size_t sent = 0;
+    uint64_t inLength = 0;
+    size_t got = 0; // header bytes first, then payload
+    bool haveHeader = false;
+    received.clear();
+
+    const int outFd = peers[to];
+    const int inFd = peers[from];
+    while (sent < outTotal || !haveHeader || got < received.size())
+    {
+        pollfd fds[2];
+        int count = 0;
+        const bool sending = sent < outTotal;
+        const bool receiving = !haveHeader || got < received.size();
+        if (sending)
+            fds[count++] = {outFd, POLLOUT, 0};
+        if (receiving)
+        {
+            if (sending && inFd == outFd)
+                fds[0].events |= POLLIN;
+            else
+                fds[count++] = {inFd, POLLIN, 0};
+        }
+        if (poll(fds, count, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Rank %d: poll failed: %s\n", rank, strerror(errno));
+            return false;
+        }
+
+        for (int f = 0; f < count; ++f)
+        {
+            if (fds[f].revents & (POLLERR | POLLNVAL))
+            {
+                fprintf(stderr, "Rank %d lost its connection to rank %d\n", rank, fds[f].fd == outFd ? to : from);
+                return false;
+            }
+        }
+
+        // A hang-up is let through to write(), which then reports it
+        if (sending && (fds[0].revents & (POLLOUT | POLLHUP)))
+        {
+            const char *chunk;
+            size_t left;
+            if (sent < sizeof(outLength))
+            {
+                chunk = (const char *)&outLength + sent;
+                left = sizeof(outLength) - sent;
+            }
+            else
+            {
+                chunk = (const char *)data + (sent - sizeof(outLength));
+                left = outTotal - sent;
+            }
+            ssize_t n = write(outFd, chunk, left);
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                fprintf(stderr, "Rank %d could not send to rank %d: %s\n", rank, to, strerror(errno));
+                return false;
+            }
+            if (n > 0)
+                sent += (size_t)n;
+        }
+
+        const pollfd &in = fds[count - 1];
+        if (receiving && (in.revents & (POLLIN | POLLHUP)))
+        {
+            char *chunk;
+            size_t left;
+            if (!haveHeader)
+            {
+                chunk = (char *)&inLength + got;
+                left = sizeof(inLength) - got;
+            }
+            else
+            {
+                chunk = received.data() + got;
+                left = received.size() - got;
+            }
+            ssize_t n = read(inFd, chunk, left);
+            if (n == 0)
+            {
+                fprintf(stderr, "Rank %d: rank %d closed its connection\n", rank, from);
+                return false;
+            }
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                fprintf(stderr, "Rank %d could not receive from rank %d: %s\n", rank, from, strerror(errno));
+                return false;
+            }
+            if (n > 0)
+            {
+                got += (size_t)n;
+                if (!haveHeader && got == sizeof(inLength))
+                {
+                    haveHeader = true;
+                    got = 0;
+                    received.resize((size_t)inLength);
+                }
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <sys/types.h>
+
+// Messages between the processes of one multi-process run.
+//
+// Processes (ranks) run the same steps in lockstep, so every call below is
+// made by all of them in the same order. Backends only provide Exchange();
+// the collectives are built on top of it, so a new interconnect is one
+// class away.
+class Transport
+{
+public:
+    virtual ~Transport() {}
+
+    virtual int Rank() const = 0;
+    virtual int Size() const = 0;
+
+    // Send bytes to rank to while receiving the next message from rank from.
+    // Both directions make progress together, so every rank can shift data
+    // around a ring at once however large the messages. False if a peer
+    // has gone away.
+    virtual bool Exchange(int to, const void *data, size_t bytes, int from, std::vector<char> &received) = 0;
+};
+
+// all[r] receives rank r's bytes, this rank's own included
+bool allGather(Transport &transport, const void *data, size_t bytes, std::vector<std::vector<char>> &all);
+
+// outgoing[r] goes to rank r; incoming[r] is what rank r sent here
+bool allToAll(Transport &transport, const std::vector<std::vector<char>> &outgoing,
+              std::vector<std::vector<char>> &incoming);
+
+enum ReduceOp
+{
+    REDUCE_SUM,
+    REDUCE_MIN,
+    REDUCE_MAX
+};
+
+// Element-wise reduction over every rank, combined in rank order so each
+// rank ends up with the same bits
+bool allReduce(Transport &transport, double *values, size_t count, ReduceOp op);
+
+// Unix-domain socket pairs between processes forked on this machine.
+class SocketTransport : public Transport
+{
+public:
+    SocketTransport() {}
+    ~SocketTransport();
+
+    SocketTransport(const SocketTransport &) = delete;
+    SocketTransport &operator=(const SocketTransport &) = delete;
+
+    // Fork into count processes connected pairwise; returns in each of them
+    // with its rank set (the caller is rank 0). Call before any thread is
+    // started. False, still in the caller, if the sockets or a fork failed.
+    bool Launch(int count);
+
+    // Rank 0, once done: disconnect and wait for the other ranks to exit;
+    // false if any failed
+    bool Join();
+
+    int Rank() const { return rank; }
+    int Size() const { return peers.empty() ? 1 : (int)peers.size(); }
+    bool Exchange(int to, const void *data, size_t bytes, int from, std::vector<char> &received);
+
+private:
+    int rank = 0;
+    std::vector<int> peers; // socket to each rank, -1 for our own
+    std::vector<pid_t> children;
+};
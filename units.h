@@ -0,0 +1,17 @@
+#pragma once
+
+// Use a scaled distance system:
+// Scale all planet distances so Neptune fits around 90% of window width.
+constexpr double REAL_NEPTUNE_DISTANCE_M = 4.495e12; // meters (4.495 billion km)
+constexpr float MAX_ORBIT_RADIUS_PIXELS = 540.0f;    // max radius for Neptune orbit in pixels (45% of the 1200px window)
+
+// Calculate a scale factor so Neptune’s orbit fits on screen
+constexpr double DISTANCE_SCALE = REAL_NEPTUNE_DISTANCE_M / MAX_ORBIT_RADIUS_PIXELS; // meters per pixel
+
+constexpr double G = 6.67430e-11; // gravitational constant (m^3 kg^-1 s^-2)
+
+// Acceleration in pixels/s^2 from a mass in kg at a distance in pixels:
+// a = G * m / (r * DISTANCE_SCALE)^2 / DISTANCE_SCALE = FORCE_SCALE * m / r^2
+constexpr double FORCE_SCALE = G / (DISTANCE_SCALE * DISTANCE_SCALE * DISTANCE_SCALE);
+
+constexpr double SECONDS_PER_YEAR = 3600.0 * 24 * 365.24;
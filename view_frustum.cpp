@@ -0,0 +1,57 @@
+#include "view_frustum.h"
+
+#include <cmath>
+
+void ViewFrustum::Extract(const float projection[16], const float modelview[16], int viewportHeight)
+{
+    // clip = projection * modelview, both column-major
+    float clip[16];
+    for (int col = 0; col < 4; ++col)
+    {
+        for (int row = 0; row < 4; ++row)
+        {
+            float sum = 0.0f;
+            for (int k = 0; k < 4; ++k)
+                sum += projection[k * 4 + row] * modelview[col * 4 + k];
+            clip[col * 4 + row] = sum;
+        }
+    }
+
+    // Each plane is the w row plus or minus the x, y or z row (Gribb & Hartmann)
+    for (int p = 0; p < 6; ++p)
+    {
+        int axis = p / 2;
+        float sign = (p % 2 == 0) ? 1.0f : -1.0f;
+        for (int c = 0; c < 4; ++c)
+            planes[p][c] = clip[c * 4 + 3] + sign * clip[c * 4 + axis];
+
+        float length = sqrtf(planes[p][0] * planes[p][0] + planes[p][1] * planes[p][1] + planes[p][2] * planes[p][2]);
+        if (length > 0.0f)
+        {
+            for (int c = 0; c < 4; ++c)
+                planes[p][c] /= length;
+        }
+    }
+
+    for (int c = 0; c < 4; ++c)
+        depthRow[c] = clip[c * 4 + 3];
+    pixelsPerUnit = projection[5] * viewportHeight * 0.5f;
+}
+
+bool ViewFrustum::SphereVisible(float x, float y, float z, float radius) const
+{
+    for (int p = 0; p < 6; ++p)
+    {
+        if (planes[p][0] * x + planes[p][1] * y + planes[p][2] * z + planes[p][3] < -radius)
+            return false;
+    }
+    return true;
+}
+
+float ViewFrustum::ProjectedRadius(float x, float y, float z, float radius) const
+{
+    float depth = depthRow[0] * x + depthRow[1] * y + depthRow[2] * z + depthRow[3];
+    if (depth <= radius)
+        return HUGE_VALF; // camera is inside or right next to the sphere
+    return radius * pixelsPerUnit / depth;
+}
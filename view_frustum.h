@@ -0,0 +1,23 @@
+#pragma once
+
+// View frustum for culling and screen-space level of detail.
+//
+// Built from the column-major projection and modelview matrices OpenGL
+// reports (glGetFloatv), so it always matches what gluPerspective and
+// gluLookAt set up for the frame.
+class ViewFrustum
+{
+public:
+    void Extract(const float projection[16], const float modelview[16], int viewportHeight);
+
+    // False when a sphere (world units) lies entirely outside any clip plane
+    bool SphereVisible(float x, float y, float z, float radius) const;
+
+    // Approximate on-screen radius in pixels of a sphere in front of the camera
+    float ProjectedRadius(float x, float y, float z, float radius) const;
+
+private:
+    float planes[6][4];  // a, b, c, d with unit normals pointing inwards
+    float depthRow[4];   // clip-space w as a function of world position
+    float pixelsPerUnit; // projection y scale times half the viewport height
+};